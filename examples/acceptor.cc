@@ -27,26 +27,29 @@ namespace rdmapp {
 
 acceptor::acceptor(std::shared_ptr<socket::event_loop> loop, uint16_t port,
                    std::shared_ptr<pd> pd, std::shared_ptr<cq> cq,
-                   std::shared_ptr<srq> srq)
-    : acceptor(loop, port, pd, cq, cq, srq) {}
+                   std::shared_ptr<srq> srq, qp_config const &config)
+    : acceptor(loop, port, pd, cq, cq, srq, config) {}
 
 acceptor::acceptor(std::shared_ptr<socket::event_loop> loop, uint16_t port,
                    std::shared_ptr<pd> pd, std::shared_ptr<cq> recv_cq,
-                   std::shared_ptr<cq> send_cq, std::shared_ptr<srq> srq)
-    : acceptor(loop, "", port, pd, recv_cq, send_cq, srq) {}
+                   std::shared_ptr<cq> send_cq, std::shared_ptr<srq> srq,
+                   qp_config const &config)
+    : acceptor(loop, "", port, pd, recv_cq, send_cq, srq, config) {}
 
 acceptor::acceptor(std::shared_ptr<socket::event_loop> loop,
                    std::string const &hostname, uint16_t port,
                    std::shared_ptr<pd> pd, std::shared_ptr<cq> cq,
-                   std::shared_ptr<srq> srq)
-    : acceptor(loop, hostname, port, pd, cq, cq, srq) {}
+                   std::shared_ptr<srq> srq, qp_config const &config)
+    : acceptor(loop, hostname, port, pd, cq, cq, srq, config) {}
 
 acceptor::acceptor(std::shared_ptr<socket::event_loop> loop,
                    std::string const &hostname, uint16_t port,
                    std::shared_ptr<pd> pd, std::shared_ptr<cq> recv_cq,
-                   std::shared_ptr<cq> send_cq, std::shared_ptr<srq> srq)
+                   std::shared_ptr<cq> send_cq, std::shared_ptr<srq> srq,
+                   qp_config const &config)
     : listener_(std::make_unique<socket::tcp_listener>(loop, hostname, port)),
-      pd_(pd), recv_cq_(recv_cq), send_cq_(send_cq), srq_(srq) {}
+      pd_(pd), recv_cq_(recv_cq), send_cq_(send_cq), srq_(srq),
+      config_(config) {}
 
 task<std::shared_ptr<qp>> acceptor::accept() {
   auto channel = co_await listener_->accept();
@@ -54,7 +57,7 @@ task<std::shared_ptr<qp>> acceptor::accept() {
   auto remote_qp = co_await recv_qp(connection);
   auto local_qp = std::make_shared<qp>(
       remote_qp.header.lid, remote_qp.header.qp_num, remote_qp.header.sq_psn,
-      remote_qp.header.gid, pd_, recv_cq_, send_cq_);
+      remote_qp.header.gid, pd_, recv_cq_, send_cq_, srq_, config_);
   local_qp->user_data() = std::move(remote_qp.user_data);
   co_await send_qp(*local_qp, connection);
   co_return local_qp;
@@ -66,7 +69,7 @@ task<std::shared_ptr<qp>> acceptor::accept(std::shared_ptr<cq> recv_cq, std::sha
   auto remote_qp = co_await recv_qp(connection);
   auto local_qp = std::make_shared<qp>(
       remote_qp.header.lid, remote_qp.header.qp_num, remote_qp.header.sq_psn,
-      remote_qp.header.gid, pd_, recv_cq, send_cq);
+      remote_qp.header.gid, pd_, recv_cq, send_cq, srq_, config_);
   local_qp->user_data() = std::move(remote_qp.user_data);
   co_await send_qp(*local_qp, connection);
   co_return local_qp;
@@ -16,14 +16,16 @@ namespace rdmapp {
  * @param send_cq The completion queue of send work completions.
  * @param srq (Optional) If set, all recv work requests will be posted to this
  * SRQ.
+ * @param config (Optional) The creation-time attributes of the new Queue Pair.
  * @return task<std::shared_ptr<qp>> A coroutine that returns a shared pointer
  * to the new Queue Pair.
  */
 static task<std::shared_ptr<qp>>
 from_tcp_connection(socket::tcp_connection &connection, std::shared_ptr<pd> pd,
                     std::shared_ptr<cq> recv_cq, std::shared_ptr<cq> send_cq,
-                    std::shared_ptr<srq> srq = nullptr) {
-  auto qp_ptr = std::make_shared<qp>(pd, recv_cq, send_cq, srq);
+                    std::shared_ptr<srq> srq = nullptr,
+                    qp_config const &config = {}) {
+  auto qp_ptr = std::make_shared<qp>(pd, recv_cq, send_cq, srq, config);
   co_await send_qp(*qp_ptr, connection);
   auto remote_qp = co_await recv_qp(connection);
   qp_ptr->rtr(remote_qp.header.lid, remote_qp.header.qp_num,
@@ -36,29 +38,30 @@ from_tcp_connection(socket::tcp_connection &connection, std::shared_ptr<pd> pd,
 connector::connector(std::shared_ptr<socket::event_loop> loop,
                      std::string const &hostname, uint16_t port,
                      std::shared_ptr<pd> pd, std::shared_ptr<cq> recv_cq,
-                     std::shared_ptr<cq> send_cq, std::shared_ptr<srq> srq)
-    : pd_(pd), recv_cq_(recv_cq), send_cq_(send_cq), srq_(srq), loop_(loop),
-      hostname_(hostname), port_(port) {}
+                     std::shared_ptr<cq> send_cq, std::shared_ptr<srq> srq,
+                     qp_config const &config)
+    : pd_(pd), recv_cq_(recv_cq), send_cq_(send_cq), srq_(srq),
+      config_(config), loop_(loop), hostname_(hostname), port_(port) {}
 
 connector::connector(std::shared_ptr<socket::event_loop> loop,
                      std::string const &hostname, uint16_t port,
                      std::shared_ptr<pd> pd, std::shared_ptr<cq> cq,
-                     std::shared_ptr<srq> srq)
-    : connector(loop, hostname, port, pd, cq, cq, srq) {}
+                     std::shared_ptr<srq> srq, qp_config const &config)
+    : connector(loop, hostname, port, pd, cq, cq, srq, config) {}
 
 task<std::shared_ptr<qp>> connector::connect() {
   auto connection =
       co_await rdmapp::socket::tcp_connection::connect(loop_, hostname_, port_);
-  auto qp =
-      co_await from_tcp_connection(*connection, pd_, recv_cq_, send_cq_, srq_);
+  auto qp = co_await from_tcp_connection(*connection, pd_, recv_cq_, send_cq_,
+                                        srq_, config_);
   co_return qp;
 }
 
 task<std::shared_ptr<qp>> connector::connect(std::shared_ptr<cq> recv_cq, std::shared_ptr<cq> send_cq) {
   auto connection =
       co_await rdmapp::socket::tcp_connection::connect(loop_, hostname_, port_);
-  auto qp =
-      co_await from_tcp_connection(*connection, pd_, recv_cq, send_cq, srq_);
+  auto qp = co_await from_tcp_connection(*connection, pd_, recv_cq, send_cq,
+                                        srq_, config_);
   co_return qp;
 }
 
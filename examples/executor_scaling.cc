@@ -0,0 +1,165 @@
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <rdmapp/rdmapp.h>
+
+#include <rdmapp/detail/spinlock.h>
+
+// Measures how the executor scales with its number of workers. Coroutines
+// stand in for Queue Pair operations: every resume burns a little CPU, then
+// the coroutine suspends until a poller thread hands it back to the executor,
+// as a completion would. No device is needed.
+
+constexpr size_t kCoroutines = 1024;
+constexpr size_t kResumesPerCoroutine = 2048;
+constexpr size_t kPollers = 4;
+constexpr size_t kWorkPerResume = 64;
+
+// Stands in for a poller thread: completes the coroutines queued to it.
+class fake_poller {
+  rdmapp::detail::spinlock lock_;
+  std::vector<std::pair<void *, uint32_t>> completed_;
+  std::vector<std::pair<void *, uint32_t>> draining_;
+  std::atomic<bool> stopped_;
+  std::jthread thread_;
+
+  void run(rdmapp::executor &executor) {
+    while (!stopped_.load(std::memory_order_relaxed)) {
+      {
+        std::lock_guard lock(lock_);
+        draining_.swap(completed_);
+      }
+      if (draining_.empty()) {
+        std::this_thread::yield();
+        continue;
+      }
+      for (auto [h_ptr, qp_num] : draining_) {
+        executor.process_wc(h_ptr, qp_num);
+      }
+      draining_.clear();
+    }
+  }
+
+public:
+  explicit fake_poller(rdmapp::executor &executor)
+      : stopped_(false),
+        thread_(&fake_poller::run, this, std::ref(executor)) {}
+
+  void complete(void *h_ptr, uint32_t qp_num) {
+    std::lock_guard lock(lock_);
+    completed_.emplace_back(h_ptr, qp_num);
+  }
+
+  ~fake_poller() {
+    stopped_ = true;
+    thread_.join();
+  }
+};
+
+// Suspends until the poller completes the fake operation.
+struct fake_operation {
+  fake_poller &poller;
+  uint32_t qp_num;
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> h) {
+    poller.complete(h.address(), qp_num);
+  }
+  void await_resume() const noexcept {}
+};
+
+// Reschedules the coroutine on the executor from its worker, which keeps it
+// in the LIFO slot of that worker.
+struct yield_to {
+  rdmapp::executor &executor;
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> h) {
+    executor.process_wc(h.address());
+  }
+  void await_resume() const noexcept {}
+};
+
+static uint64_t burn(uint64_t seed) {
+  for (size_t i = 0; i < kWorkPerResume; ++i) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+  }
+  return seed;
+}
+
+static std::atomic<uint64_t> sink{0};
+
+rdmapp::task<void> fake_qp(rdmapp::executor &executor, fake_poller &poller,
+                           uint32_t qp_num, bool yields,
+                           std::atomic<size_t> &done) {
+  uint64_t seed = qp_num;
+  for (size_t i = 0; i < kResumesPerCoroutine; ++i) {
+    seed = burn(seed);
+    if (yields && i % 2 == 1) {
+      co_await yield_to{executor};
+    } else {
+      co_await fake_operation{poller, qp_num};
+    }
+  }
+  sink.fetch_add(seed, std::memory_order_relaxed);
+  done.fetch_add(1, std::memory_order_release);
+  co_return;
+}
+
+static void run(size_t nr_worker, rdmapp::executor_policy policy,
+                bool yields) {
+  auto executor = std::make_unique<rdmapp::executor>(nr_worker, policy);
+  std::vector<std::unique_ptr<fake_poller>> pollers;
+  for (size_t i = 0; i < kPollers; ++i) {
+    pollers.push_back(std::make_unique<fake_poller>(*executor));
+  }
+  std::atomic<size_t> done = 0;
+  auto const start = std::chrono::steady_clock::now();
+  for (uint32_t qp_num = 0; qp_num < kCoroutines; ++qp_num) {
+    // A Queue Pair is polled by a single poller.
+    fake_qp(*executor, *pollers[qp_num % kPollers], qp_num, yields, done)
+        .detach();
+  }
+  while (done.load(std::memory_order_acquire) != kCoroutines) {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  std::chrono::duration<double> seconds =
+      std::chrono::steady_clock::now() - start;
+  auto const stats = executor->stats();
+  pollers.clear();
+  executor.reset();
+
+  auto const resumes = static_cast<double>(kCoroutines * kResumesPerCoroutine);
+  std::cout << std::setw(7) << nr_worker << std::setw(13)
+            << (policy == rdmapp::executor_policy::by_qp ? "by_qp"
+                                                         : "round_robin")
+            << std::setw(8) << (yields ? "yes" : "no") << std::setw(12)
+            << std::fixed << std::setprecision(2)
+            << resumes / seconds.count() / 1e6 << std::setw(10)
+            << 100.0 * stats.stolen / resumes << "%" << std::setw(9)
+            << 100.0 * stats.lifo / resumes << "%" << std::setw(8)
+            << stats.parks << std::endl;
+}
+
+int main() {
+  std::cout << "workers       policy  yields  Mresumes/s    stolen     lifo"
+               "   parks"
+            << std::endl;
+  for (size_t nr_worker = 1; nr_worker <= 32; nr_worker *= 2) {
+    for (auto policy : {rdmapp::executor_policy::round_robin,
+                        rdmapp::executor_policy::by_qp}) {
+      for (bool yields : {false, true}) {
+        run(nr_worker, policy, yields);
+      }
+    }
+  }
+  return 0;
+}
@@ -25,6 +25,7 @@ class acceptor : public noncopyable {
   std::shared_ptr<cq> recv_cq_;
   std::shared_ptr<cq> send_cq_;
   std::shared_ptr<srq> srq_;
+  qp_config config_;
 
 public:
   /**
@@ -36,10 +37,12 @@ public:
    * @param send_cq The send completion queue to use for incoming Queue Pairs.
    * @param srq (Optional) The shared receive queue to use for incoming Queue
    * Pairs.
+   * @param config (Optional) The creation-time attributes of incoming Queue
+   * Pairs.
    */
   acceptor(std::shared_ptr<socket::event_loop> loop, uint16_t port,
            std::shared_ptr<pd> pd, std::shared_ptr<cq> cq = nullptr,
-           std::shared_ptr<srq> srq = nullptr);
+           std::shared_ptr<srq> srq = nullptr, qp_config const &config = {});
 
   /**
    * @brief Construct a new acceptor object.
@@ -51,10 +54,13 @@ public:
    * @param send_cq The send completion queue to use for incoming Queue Pairs.
    * @param srq (Optional) The shared receive queue to use for incoming Queue
    * Pairs.
+   * @param config (Optional) The creation-time attributes of incoming Queue
+   * Pairs.
    */
   acceptor(std::shared_ptr<socket::event_loop> loop, uint16_t port,
            std::shared_ptr<pd> pd, std::shared_ptr<cq> recv_cq,
-           std::shared_ptr<cq> send_cq, std::shared_ptr<srq> srq = nullptr);
+           std::shared_ptr<cq> send_cq, std::shared_ptr<srq> srq = nullptr,
+           qp_config const &config = {});
 
   /**
    * @brief Construct a new acceptor object.
@@ -66,10 +72,13 @@ public:
    * @param cq The send/recv completion queue to use for all new Queue Pairs.
    * @param srq (Optional) The shared receive queue to use for all new Queue
    * Pairs.
+   * @param config (Optional) The creation-time attributes of all new Queue
+   * Pairs.
    */
   acceptor(std::shared_ptr<socket::event_loop> loop,
            std::string const &hostname, uint16_t port, std::shared_ptr<pd> pd,
-           std::shared_ptr<cq> cq = nullptr, std::shared_ptr<srq> srq = nullptr);
+           std::shared_ptr<cq> cq = nullptr, std::shared_ptr<srq> srq = nullptr,
+           qp_config const &config = {});
 
   /**
    * @brief Construct a new acceptor object.
@@ -82,11 +91,13 @@ public:
    * @param send_cq The send completion queue to use for incoming Queue Pairs.
    * @param srq (Optional) The shared receive queue to use for incoming Queue
    * Pairs.
+   * @param config (Optional) The creation-time attributes of incoming Queue
+   * Pairs.
    */
   acceptor(std::shared_ptr<socket::event_loop> loop,
            std::string const &hostname, uint16_t port, std::shared_ptr<pd> pd,
            std::shared_ptr<cq> recv_cq, std::shared_ptr<cq> send_cq,
-           std::shared_ptr<srq> srq = nullptr);
+           std::shared_ptr<srq> srq = nullptr, qp_config const &config = {});
 
   /**
    * @brief This function is used to accept an incoming connection and queue
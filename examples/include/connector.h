@@ -22,6 +22,7 @@ class connector : public noncopyable {
   std::shared_ptr<cq> recv_cq_;
   std::shared_ptr<cq> send_cq_;
   std::shared_ptr<srq> srq_;
+  qp_config config_;
   std::shared_ptr<socket::event_loop> loop_;
   std::string hostname_;
   uint16_t port_;
@@ -36,11 +37,12 @@ public:
    * @param recv_cq The recv completion queue to use for new Queue Pairs.
    * @param send_cq The send completion queue to use for new Queue Pairs.
    * @param srq (Optional) The shared receive queue to use for new Queue Pairs.
+   * @param config (Optional) The creation-time attributes of new Queue Pairs.
    */
   connector(std::shared_ptr<socket::event_loop> loop,
             std::string const &hostname, uint16_t port, std::shared_ptr<pd> pd,
             std::shared_ptr<cq> recv_cq, std::shared_ptr<cq> send_cq,
-            std::shared_ptr<srq> srq = nullptr);
+            std::shared_ptr<srq> srq = nullptr, qp_config const &config = {});
 
   /**
    * @brief Construct a new connector object.
@@ -50,10 +52,12 @@ public:
    * @param port The port to connect to.
    * @param recv_cq The send/recv completion queue to use for new Queue Pairs.
    * @param srq (Optional) The shared receive queue to use for new Queue Pairs.
+   * @param config (Optional) The creation-time attributes of new Queue Pairs.
    */
   connector(std::shared_ptr<socket::event_loop> loop,
             std::string const &hostname, uint16_t port, std::shared_ptr<pd> pd,
-            std::shared_ptr<cq> cq = nullptr, std::shared_ptr<srq> srq = nullptr);
+            std::shared_ptr<cq> cq = nullptr, std::shared_ptr<srq> srq = nullptr,
+            qp_config const &config = {});
 
   /**
    * @brief This function is used to connect to a remote endpoint and establish
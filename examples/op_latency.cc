@@ -0,0 +1,206 @@
+#include "acceptor.h"
+#include "connector.h"
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <rdmapp/rdmapp.h>
+
+constexpr size_t kOpCount = 1024 * 1024;
+// Recvs kept posted by the receiving side, so that sends do not wait for RNR
+// retries.
+constexpr size_t kRecvDepth = 16;
+
+template <class Fn>
+rdmapp::task<void> measure(char const *name, Fn &&fn) {
+  auto const start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < kOpCount; ++i) {
+    co_await fn();
+  }
+  auto const elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << name << ": "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                       .count() /
+                   kOpCount
+            << " ns/op" << std::endl;
+  co_return;
+}
+
+template <class Fn> rdmapp::task<void> recv_worker(size_t count, Fn &fn) {
+  for (size_t i = 0; i < count; ++i) {
+    co_await fn();
+  }
+  co_return;
+}
+
+// Awaits fn() count times from kRecvDepth coroutines at once, returning once
+// all are done.
+template <class Fn> rdmapp::task<void> recv_all(size_t count, Fn &&fn) {
+  std::vector<rdmapp::task<void>> workers;
+  workers.reserve(kRecvDepth);
+  for (size_t i = 0; i < kRecvDepth; ++i) {
+    workers.push_back(recv_worker(count / kRecvDepth, fn));
+  }
+  for (auto &worker : workers) {
+    co_await worker;
+  }
+  co_return;
+}
+
+// Unlike measure(), the recvs are awaited kRecvDepth at a time, so this is
+// the time per message while the sender keeps the link busy.
+template <class Fn>
+rdmapp::task<void> measure_recv(char const *name, Fn &&fn) {
+  auto const start = std::chrono::steady_clock::now();
+  co_await recv_all(kOpCount, fn);
+  auto const elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << name << ": "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                       .count() /
+                   kOpCount
+            << " ns/op" << std::endl;
+  co_return;
+}
+
+char const *opcode_name(enum ibv_wc_opcode opcode) {
+  switch (opcode) {
+  case IBV_WC_SEND:
+    return "send";
+  case IBV_WC_RDMA_WRITE:
+    return "write";
+  case IBV_WC_RDMA_READ:
+    return "read";
+  case IBV_WC_COMP_SWAP:
+    return "compare_and_swap";
+  case IBV_WC_FETCH_ADD:
+    return "fetch_and_add";
+  default:
+    return "recv";
+  }
+}
+
+void print_breakdown() {
+  // With completion timestamps, the latency of every operation is split at
+  // its completion: device is the NIC and the wire, queueing is the poller
+  // and the executor.
+  for (auto const &latency : rdmapp::op_latencies()) {
+    std::cout << opcode_name(latency.opcode)
+              << ": count=" << latency.total_ns.count
+              << " device p50=" << latency.device_ns.percentile(0.5)
+              << " p99=" << latency.device_ns.percentile(0.99)
+              << " queueing p50=" << latency.queueing_ns.percentile(0.5)
+              << " p99=" << latency.queueing_ns.percentile(0.99)
+              << " total p50=" << latency.total_ns.percentile(0.5)
+              << " p99=" << latency.total_ns.percentile(0.99) << " ns"
+              << std::endl;
+  }
+}
+
+rdmapp::task<void> client_worker(std::shared_ptr<rdmapp::qp> qp) {
+  uint64_t buffer = 0;
+  auto local_mr = std::make_shared<rdmapp::local_mr>(
+      qp->pd_ptr()->reg_mr(&buffer, sizeof(buffer)));
+  char remote_mr_serialized[rdmapp::remote_mr::kSerializedSize];
+  co_await qp->recv(remote_mr_serialized, sizeof(remote_mr_serialized));
+  auto remote_mr = rdmapp::remote_mr::deserialize(remote_mr_serialized);
+  std::cout << "Received mr addr=" << remote_mr.addr()
+            << " length=" << remote_mr.length() << " rkey=" << remote_mr.rkey()
+            << " from server" << std::endl;
+
+  // Every operation is awaited one at a time, so the difference between the
+  // two columns is the per-operation cost of the reference counting path.
+  co_await measure("write shared",
+                   [&] { return qp->write(remote_mr, local_mr); });
+  co_await measure("write light",
+                   [&] { return qp->write(&remote_mr, local_mr.get()); });
+  co_await measure("read shared",
+                   [&] { return qp->read(remote_mr, local_mr); });
+  co_await measure("read light",
+                   [&] { return qp->read(&remote_mr, local_mr.get()); });
+  co_await measure("fetch_and_add shared",
+                   [&] { return qp->fetch_and_add(remote_mr, local_mr, 1); });
+  co_await measure("fetch_and_add light", [&] {
+    return qp->fetch_and_add(&remote_mr, local_mr.get(), 1);
+  });
+  co_await measure("compare_and_swap shared", [&] {
+    return qp->compare_and_swap(remote_mr, local_mr, 0, 0);
+  });
+  co_await measure("compare_and_swap light", [&] {
+    return qp->compare_and_swap(&remote_mr, local_mr.get(), 0, 0);
+  });
+  // The server has recvs posted for these.
+  co_await measure("send shared", [&] { return qp->send(local_mr); });
+  co_await measure("send light", [&] { return qp->send(local_mr.get()); });
+  co_await measure("write_with_imm shared", [&] {
+    return qp->write_with_imm(remote_mr, local_mr, 0);
+  });
+  co_await measure("write_with_imm light", [&] {
+    return qp->write_with_imm(&remote_mr, local_mr.get(), sizeof(buffer), 0);
+  });
+  // Then the server sends to us.
+  co_await measure_recv("recv shared", [&] { return qp->recv(local_mr); });
+  co_await measure_recv("recv light",
+                        [&] { return qp->recv(local_mr.get()); });
+  co_await qp->write_with_imm(&remote_mr, local_mr.get(), 0, 0xDEADBEEF);
+  print_breakdown();
+  co_return;
+}
+
+rdmapp::task<void> server(rdmapp::acceptor &acceptor) {
+  auto qp = co_await acceptor.accept();
+  uint64_t buffer = 0;
+  auto local_mr = std::make_shared<rdmapp::local_mr>(
+      qp->pd_ptr()->reg_mr(&buffer, sizeof(buffer)));
+  auto local_mr_serialized = local_mr->serialize();
+  co_await qp->send(local_mr_serialized.data(), local_mr_serialized.size());
+  std::cout << "Sent mr addr=" << local_mr->addr()
+            << " length=" << local_mr->length() << " rkey=" << local_mr->rkey()
+            << " to client" << std::endl;
+  // The sends and writes with imm of the client, shared and light.
+  co_await recv_all(4 * kOpCount, [&] { return qp->recv(local_mr.get()); });
+  // The recvs of the client, shared and light.
+  for (size_t i = 0; i < 2 * kOpCount; ++i) {
+    co_await qp->send(local_mr.get());
+  }
+  auto imm = (co_await qp->recv(local_mr.get())).second;
+  if (!imm.has_value()) {
+    throw std::runtime_error("No imm received");
+  }
+  if (imm.value() != 0xDEADBEEF) {
+    throw std::runtime_error("Wrong imm received");
+  }
+  co_return;
+}
+
+rdmapp::task<void> client(rdmapp::connector &connector) {
+  auto qp = co_await connector.connect();
+  co_await client_worker(qp);
+  co_return;
+}
+
+int main(int argc, char *argv[]) {
+  auto device = std::make_shared<rdmapp::device>(0, 1);
+  auto pd = std::make_shared<rdmapp::pd>(device);
+  auto cq = std::make_shared<rdmapp::cq>(device, 128, nullptr, true);
+  auto cq_poller = std::make_shared<rdmapp::cq_poller>(cq);
+  auto loop = rdmapp::socket::event_loop::new_loop();
+  auto looper = std::thread([loop]() { loop->loop(); });
+  if (argc == 2) {
+    rdmapp::acceptor acceptor(loop, std::stoi(argv[1]), pd, cq);
+    server(acceptor);
+  } else if (argc == 3) {
+    rdmapp::connector connector(loop, argv[1], std::stoi(argv[2]), pd, cq);
+    client(connector);
+  } else {
+    std::cout << "Usage: " << argv[0] << " [port] for server and " << argv[0]
+              << " [server_ip] [port] for client" << std::endl;
+  }
+  loop->close();
+  looper.join();
+  return 0;
+}
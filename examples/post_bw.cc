@@ -0,0 +1,98 @@
+#include "acceptor.h"
+#include "connector.h"
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <rdmapp/rdmapp.h>
+
+using namespace std::literals::chrono_literals;
+
+constexpr size_t kBufferSizeBytes = 8;
+constexpr size_t kWorkers = 64;
+constexpr size_t kWritesPerWorker = 64 * 1024;
+constexpr uint32_t kDoneImm = 0xDEADBEEF;
+
+rdmapp::task<void> client_worker(std::shared_ptr<rdmapp::qp> qp,
+                                 rdmapp::remote_mr remote_mr,
+                                 std::shared_ptr<rdmapp::local_mr> local_mr) {
+  for (size_t i = 0; i < kWritesPerWorker; ++i) {
+    co_await qp->write(remote_mr, local_mr);
+  }
+  co_return;
+}
+
+rdmapp::task<void> client(rdmapp::connector &connector, char const *mode) {
+  auto qp = co_await connector.connect();
+  std::vector<uint8_t> buffer(kBufferSizeBytes);
+  auto local_mr = std::make_shared<rdmapp::local_mr>(
+      qp->pd_ptr()->reg_mr(&buffer[0], buffer.size()));
+  char remote_mr_serialized[rdmapp::remote_mr::kSerializedSize];
+  co_await qp->recv(remote_mr_serialized, sizeof(remote_mr_serialized));
+  auto remote_mr = rdmapp::remote_mr::deserialize(remote_mr_serialized);
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<rdmapp::task<void>> workers;
+  workers.reserve(kWorkers);
+  for (size_t i = 0; i < kWorkers; ++i) {
+    workers.emplace_back(client_worker(qp, remote_mr, local_mr));
+  }
+  for (auto &worker : workers) {
+    co_await worker;
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+  auto const nr_writes = kWorkers * kWritesPerWorker;
+  std::cout << mode << ": " << nr_writes << " writes of " << kBufferSizeBytes
+            << " bytes in " << elapsed.count() << " us, "
+            << nr_writes * 1e6 / elapsed.count() << " writes/s" << std::endl;
+  co_await qp->write_with_imm(remote_mr, local_mr, kDoneImm);
+  co_return;
+}
+
+rdmapp::task<void> server(rdmapp::acceptor &acceptor) {
+  auto qp = co_await acceptor.accept();
+  std::vector<uint8_t> buffer(kBufferSizeBytes);
+  auto local_mr = std::make_shared<rdmapp::local_mr>(
+      qp->pd_ptr()->reg_mr(&buffer[0], buffer.size()));
+  auto local_mr_serialized = local_mr->serialize();
+  co_await qp->send(local_mr_serialized.data(), local_mr_serialized.size());
+  auto imm = (co_await qp->recv(local_mr)).second;
+  if (!imm.has_value() || imm.value() != kDoneImm) {
+    throw std::runtime_error("Wrong imm received");
+  }
+  co_return;
+}
+
+int main(int argc, char *argv[]) {
+  auto device = std::make_shared<rdmapp::device>(0, 1);
+  auto pd = std::make_shared<rdmapp::pd>(device);
+  auto cq = std::make_shared<rdmapp::cq>(device);
+  auto cq_poller = std::make_shared<rdmapp::cq_poller>(cq);
+  auto loop = rdmapp::socket::event_loop::new_loop();
+  auto looper = std::thread([loop]() { loop->loop(); });
+  if (argc == 2) {
+    rdmapp::acceptor acceptor(loop, std::stoi(argv[1]), pd, cq);
+    server(acceptor);
+  } else if (argc == 3 || argc == 4) {
+    // Compare the legacy ibv_post_send path with the ibv_wr_* builders by
+    // running the client once in each mode against the same server.
+    char const *mode = argc == 4 ? argv[3] : "legacy";
+    rdmapp::qp_config config;
+    config.extended_verbs = ::strcmp(mode, "ex") == 0;
+    rdmapp::connector connector(loop, argv[1], std::stoi(argv[2]), pd, cq,
+                                nullptr, config);
+    client(connector, mode);
+  } else {
+    std::cout << "Usage: " << argv[0] << " [port] for server and " << argv[0]
+              << " [server_ip] [port] [legacy|ex] for client" << std::endl;
+  }
+  loop->close();
+  looper.join();
+  return 0;
+}
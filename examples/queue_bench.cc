@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <rdmapp/histogram.h>
+
+#include <rdmapp/detail/bounded_queue.h>
+#include <rdmapp/detail/tsc.h>
+
+// Compares the bounded queue variants. Throughput is measured with as many
+// producers and consumers as each variant allows, pushing and popping one
+// element or a batch at a time. Latency is the time from push to pop, with a
+// single paced producer so that it does not include queueing.
+
+constexpr size_t kCapacity = 4096;
+constexpr size_t kItems = 1 << 22;
+constexpr size_t kLatencyItems = 1 << 16;
+constexpr size_t kMultiThreads = 4;
+
+template <class Queue>
+static void run_throughput(char const *name, size_t nr_producer,
+                           size_t nr_consumer, size_t batch) {
+  Queue queue(kCapacity);
+  std::atomic<size_t> consumed = 0;
+  std::atomic<bool> start = false;
+  auto const per_producer = kItems / nr_producer;
+  auto const total = per_producer * nr_producer;
+  std::vector<std::jthread> threads;
+  for (size_t p = 0; p < nr_producer; ++p) {
+    threads.emplace_back([&]() {
+      std::vector<uint64_t> items(batch, 1);
+      while (!start.load(std::memory_order_acquire)) {
+      }
+      for (size_t sent = 0; sent < per_producer;) {
+        auto const n = std::min(batch, per_producer - sent);
+        auto const nr = queue.push_n(items.data(), n);
+        if (nr == 0) {
+          std::this_thread::yield();
+        }
+        sent += nr;
+      }
+    });
+  }
+  for (size_t c = 0; c < nr_consumer; ++c) {
+    threads.emplace_back([&]() {
+      std::vector<uint64_t> items(batch);
+      while (!start.load(std::memory_order_acquire)) {
+      }
+      while (consumed.load(std::memory_order_relaxed) < total) {
+        auto const nr = queue.pop_n(items.data(), batch);
+        if (nr == 0) {
+          std::this_thread::yield();
+          continue;
+        }
+        consumed.fetch_add(nr, std::memory_order_relaxed);
+      }
+    });
+  }
+  auto const begin = std::chrono::steady_clock::now();
+  start.store(true, std::memory_order_release);
+  threads.clear();
+  std::chrono::duration<double> seconds =
+      std::chrono::steady_clock::now() - begin;
+  std::cout << std::setw(6) << name << std::setw(5) << nr_producer << "p"
+            << std::setw(3) << nr_consumer << "c" << std::setw(7) << batch
+            << std::setw(12) << std::fixed << std::setprecision(2)
+            << total / seconds.count() / 1e6 << " Mops/s" << std::endl;
+}
+
+template <class Queue> static void run_latency(char const *name) {
+  Queue queue(kCapacity);
+  rdmapp::detail::log_histogram latency;
+  std::jthread consumer([&]() {
+    uint64_t pushed_at;
+    for (size_t received = 0; received < kLatencyItems;) {
+      if (queue.pop(pushed_at)) {
+        latency.record(rdmapp::detail::rdtsc() - pushed_at);
+        ++received;
+      }
+    }
+  });
+  for (size_t i = 0; i < kLatencyItems; ++i) {
+    // Paced, so that the consumer is waiting when the element arrives.
+    auto const due = rdmapp::detail::rdtsc() + 2000;
+    while (rdmapp::detail::rdtsc() < due) {
+    }
+    while (!queue.push(rdmapp::detail::rdtsc())) {
+    }
+  }
+  consumer.join();
+  auto const snapshot = latency.snapshot();
+  auto const ns_per_tick = rdmapp::detail::tsc_ns_per_tick();
+  std::cout << std::setw(6) << name << "  p50=" << std::setw(6)
+            << static_cast<uint64_t>(snapshot.percentile(0.5) * ns_per_tick)
+            << "ns p99=" << std::setw(6)
+            << static_cast<uint64_t>(snapshot.percentile(0.99) * ns_per_tick)
+            << "ns" << std::endl;
+}
+
+int main() {
+  using rdmapp::detail::mpmc_queue;
+  using rdmapp::detail::mpsc_queue;
+  using rdmapp::detail::spmc_queue;
+  using rdmapp::detail::spsc_queue;
+
+  std::cout << "throughput" << std::endl;
+  for (size_t batch : {1, 32}) {
+    run_throughput<spsc_queue<uint64_t>>("spsc", 1, 1, batch);
+    run_throughput<mpsc_queue<uint64_t>>("mpsc", kMultiThreads, 1, batch);
+    run_throughput<spmc_queue<uint64_t>>("spmc", 1, kMultiThreads, batch);
+    run_throughput<mpmc_queue<uint64_t>>("mpmc", kMultiThreads,
+                                         kMultiThreads, batch);
+    // The price of the compare-and-swaps alone.
+    run_throughput<mpmc_queue<uint64_t>>("mpmc", 1, 1, batch);
+  }
+
+  std::cout << "latency (1 producer, 1 consumer)" << std::endl;
+  run_latency<spsc_queue<uint64_t>>("spsc");
+  run_latency<mpsc_queue<uint64_t>>("mpsc");
+  run_latency<spmc_queue<uint64_t>>("spmc");
+  run_latency<mpmc_queue<uint64_t>>("mpmc");
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include "acceptor.h"
+#include "connector.h"
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <rdmapp/rdmapp.h>
+
+constexpr size_t kMessageSizeBytes = 64;
+constexpr size_t kMessageCount = 1024 * 1024;
+constexpr size_t kRingBuffers = 256;
+
+static void print_rnr_counters(rdmapp::device const &device) {
+  for (auto name : {"out_of_buffer", "rnr_nak_retry_err"}) {
+    auto value = device.port_counter(name);
+    std::cout << "  " << name << ": "
+              << (value.has_value() ? std::to_string(value.value()) : "n/a")
+              << std::endl;
+  }
+}
+
+static void print_throughput(char const *name,
+                             std::chrono::steady_clock::duration elapsed) {
+  std::chrono::duration<double> seconds = elapsed;
+  std::cout << name << ": " << kMessageCount / seconds.count() / 1e6
+            << " Mmsg/s" << std::endl;
+}
+
+rdmapp::task<void> server(rdmapp::acceptor &acceptor) {
+  auto qp = co_await acceptor.accept();
+  std::vector<uint8_t> buffer(kMessageSizeBytes);
+  auto local_mr = std::make_shared<rdmapp::local_mr>(
+      qp->pd_ptr()->reg_mr(buffer.data(), buffer.size()));
+  // One round against a receiver posting a buffer per await, one against the
+  // ring. The receiver acknowledges the end of each round.
+  for (int round = 0; round < 2; ++round) {
+    for (size_t i = 0; i < kMessageCount; ++i) {
+      co_await qp->send(local_mr);
+    }
+    co_await qp->recv(local_mr);
+  }
+  co_return;
+}
+
+rdmapp::task<void> client(rdmapp::connector &connector,
+                          rdmapp::device const &device) {
+  auto qp = co_await connector.connect();
+  std::vector<uint8_t> buffer(kMessageSizeBytes);
+  auto local_mr = std::make_shared<rdmapp::local_mr>(
+      qp->pd_ptr()->reg_mr(buffer.data(), buffer.size()));
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < kMessageCount; ++i) {
+    co_await qp->recv(local_mr);
+  }
+  print_throughput("recv per await", std::chrono::steady_clock::now() - start);
+  print_rnr_counters(device);
+
+  // The ring posts its buffers before the server is told to go on, so that
+  // the first round cannot consume them.
+  rdmapp::recv_ring ring(qp, kRingBuffers, kMessageSizeBytes);
+  co_await qp->send(local_mr);
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < kMessageCount; ++i) {
+    auto view = co_await ring.recv();
+  }
+  print_throughput("recv ring", std::chrono::steady_clock::now() - start);
+  print_rnr_counters(device);
+  auto const stats = ring.stats();
+  std::cout << "  reposts: " << stats.reposts
+            << " in batches: " << stats.repost_batches
+            << " starvations: " << stats.starvations << std::endl;
+  co_await qp->send(local_mr);
+  co_return;
+}
+
+int main(int argc, char *argv[]) {
+  auto device = std::make_shared<rdmapp::device>(0, 1);
+  auto pd = std::make_shared<rdmapp::pd>(device);
+  auto cq = std::make_shared<rdmapp::cq>(device);
+  auto cq_poller = std::make_shared<rdmapp::cq_poller>(cq);
+  auto loop = rdmapp::socket::event_loop::new_loop();
+  auto looper = std::thread([loop]() { loop->loop(); });
+  if (argc == 2) {
+    rdmapp::acceptor acceptor(loop, std::stoi(argv[1]), pd, cq);
+    server(acceptor);
+  } else if (argc == 3) {
+    rdmapp::connector connector(loop, argv[1], std::stoi(argv[2]), pd, cq);
+    client(connector, *device);
+  } else {
+    std::cout << "Usage: " << argv[0] << " [port] for server and " << argv[0]
+              << " [server_ip] [port] for client" << std::endl;
+  }
+  loop->close();
+  looper.join();
+  return 0;
+}
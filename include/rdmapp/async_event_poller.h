@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/device.h"
+
+#include "rdmapp/detail/noncopyable.h"
+
+namespace rdmapp {
+
+/**
+ * @brief This class consumes the asynchronous events of a device on a
+ * background thread. SRQ limit events are handed to the srq they name;
+ * other events are logged.
+ *
+ */
+class async_event_poller : public noncopyable {
+  std::shared_ptr<device> device_;
+  std::atomic<bool> stopped_;
+  std::jthread poller_thread_;
+  void worker();
+
+  /**
+   * @brief Handles one event. The event is acknowledged by the caller.
+   *
+   * @param event The event.
+   */
+  void process_event(struct ibv_async_event const &event);
+
+public:
+  /**
+   * @brief Construct a new async event poller and start its thread. At most
+   * one poller should run per device.
+   *
+   * @param device The device to read events from.
+   */
+  explicit async_event_poller(std::shared_ptr<device> device);
+
+  ~async_event_poller();
+};
+
+} // namespace rdmapp
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <thread>
@@ -8,23 +9,32 @@
 #include <infiniband/verbs.h>
 
 #include "rdmapp/cq.h"
+#include "rdmapp/cq_scheduler.h"
 #include "rdmapp/executor.h"
+#include "rdmapp/poll_batch.h"
+#include "rdmapp/poller_metrics.h"
+
+#include "rdmapp/detail/cq_waiter.h"
 
 namespace rdmapp {
 
 /**
- * @brief This class is used to poll a completion queue.
+ * @brief This class is used to poll a set of completion queues on one
+ * thread. They are served fairly by weight (see cq_scheduler).
  *
  */
 class batch_cq_poller {
-  std::vector<std::shared_ptr<cq>> cqs_;
   std::atomic<bool> connected_;
   std::atomic<bool> stopped_;
   std::jthread poller_thread_;
   std::shared_ptr<executor> executor_;
   std::vector<struct ibv_wc> wc_vec_;
-  void recv_worker();
-  void send_worker();
+  detail::batch_sizer batch_;
+  cq_scheduler scheduler_;
+  detail::cq_waiter waiter_;
+  detail::poller_metrics metrics_;
+  bool poll_round();
+  void worker();
 
 public:
   void connect_loop();
@@ -33,19 +43,73 @@ public:
    * @brief Construct a new cq poller object. A new executor will be created.
    *
    * @param cq The completion queue to poll.
-   * @param batch_size The number of completion entries to poll at a time.
+   * @param is_recv Unused: send and recv completions take the same path.
+   * @param batch_size The number of completion entries to poll at a time,
+   * or a range to adapt it within (see poll_batch).
+   * @param spin_budget (Optional) How long to spin without completions on any
+   * cq before sleeping on their completion channels. Never sleeps by default
+   * or if a cq has no channel.
    */
-  batch_cq_poller(std::vector<std::shared_ptr<cq>>& cqs, bool is_recv = true, size_t batch_size = 16);
+  batch_cq_poller(std::vector<std::shared_ptr<cq>>& cqs, bool is_recv = true, poll_batch batch_size = 16,
+                  std::chrono::nanoseconds spin_budget =
+                      detail::cq_waiter::kSpinForever);
 
   /**
    * @brief Construct a new cq poller object.
    *
    * @param cq The completion queue to poll.
+   * @param is_recv Unused: send and recv completions take the same path.
    * @param executor The executor to use to process the completion entries.
-   * @param batch_size The number of completion entries to poll at a time.
+   * @param batch_size The number of completion entries to poll at a time,
+   * or a range to adapt it within (see poll_batch).
+   * @param spin_budget (Optional) How long to spin without completions on any
+   * cq before sleeping on their completion channels.
    */
   batch_cq_poller(std::vector<std::shared_ptr<cq>>& cqs, bool is_recv, std::shared_ptr<executor> executor,
-            size_t batch_size = 16);
+            poll_batch batch_size = 16,
+            std::chrono::nanoseconds spin_budget =
+                detail::cq_waiter::kSpinForever);
+
+  /**
+   * @brief Add a completion queue to poll, or change its weight. Takes
+   * effect at the next round, without restarting the poller.
+   *
+   * @param cq The completion queue.
+   * @param weight (Optional) Its share of every round relative to the
+   * others. Completion queues given at construction have weight 1.
+   */
+  void add_cq(std::shared_ptr<cq> cq, uint32_t weight = 1);
+
+  /**
+   * @brief Stop polling a completion queue. Takes effect at the next round.
+   *
+   * @param cq The completion queue.
+   */
+  void remove_cq(std::shared_ptr<cq> const &cq);
+
+  /**
+   * @brief Get how every completion queue was served.
+   *
+   * @return std::vector<std::pair<std::shared_ptr<cq>, cq_service_stats>>
+   * The completion queues with their statistics.
+   */
+  std::vector<std::pair<std::shared_ptr<cq>, cq_service_stats>>
+  cq_stats() const;
+
+  /**
+   * @brief Get how the poller spent its idle time.
+   *
+   * @return wait_stats The statistics.
+   */
+  wait_stats stats() const;
+
+  /**
+   * @brief Get the metrics of the polling loop. Cheap enough to call
+   * periodically, e.g. from a metrics_dumper.
+   *
+   * @return poller_metrics_snapshot The metrics.
+   */
+  poller_metrics_snapshot metrics() const;
 
   ~batch_cq_poller();
 };
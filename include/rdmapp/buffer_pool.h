@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/detail/noncopyable.h"
+
+namespace rdmapp {
+
+/**
+ * @brief This class is a pool of small pre-registered buffers. Payloads of
+ * unregistered memory are copied into them, which is much cheaper than
+ * registering the memory for a single operation.
+ *
+ * The buffers are carved from one registered region into power-of-two size
+ * classes. Every thread gets its own cache of free buffers per class, which it
+ * uses without locking, and exchanges buffers with the shared free lists in
+ * batches. Up to kMaxThreadCaches threads have a cache at a time; a cache is
+ * handed to another thread once its thread exits.
+ *
+ */
+class buffer_pool : public noncopyable {
+public:
+  static constexpr size_t kMinBufferSize = 64;
+  static constexpr size_t kMaxThreadCaches = 64;
+  static constexpr size_t kThreadCacheDepth = 32;
+  static constexpr size_t kMaxClasses = 16;
+
+  /**
+   * @brief A buffer taken from the pool. It goes back to the pool when
+   * destroyed.
+   *
+   */
+  class buffer : public noncopyable {
+    buffer_pool *pool_;
+    void *addr_;
+    uint32_t size_class_;
+
+  public:
+    buffer();
+    buffer(buffer_pool *pool, void *addr, uint32_t size_class);
+    buffer(buffer &&other);
+    buffer &operator=(buffer &&other);
+    ~buffer();
+
+    /**
+     * @brief Get the address of the buffer.
+     *
+     * @return void* The address, or nullptr if the buffer is empty.
+     */
+    void *addr() const;
+
+    /**
+     * @brief Get the local key of the registered region.
+     *
+     * @return uint32_t The local key.
+     */
+    uint32_t lkey() const;
+
+    explicit operator bool() const;
+  };
+
+private:
+  struct alignas(64) thread_cache {
+    void *blocks[kMaxClasses][kThreadCacheDepth];
+    uint32_t count[kMaxClasses];
+  };
+
+  /**
+   * @brief The index of the caches of a thread, the same in every pool. It
+   * is taken on first use and given back when the thread exits, after its
+   * cached buffers went back to the shared free lists of every pool.
+   *
+   */
+  struct cache_index {
+    size_t value;
+    cache_index();
+    ~cache_index();
+  };
+
+  struct ibv_mr *mr_;
+  uint8_t *region_;
+  size_t max_size_;
+  uint32_t nr_classes_;
+  std::mutex mutex_;
+  std::vector<void *> free_[kMaxClasses];
+  thread_cache caches_[kMaxThreadCaches];
+
+  /**
+   * @brief Move the buffers of a thread cache to the shared free lists.
+   *
+   * @param index The index of the cache.
+   */
+  void flush_cache(size_t index);
+
+  /**
+   * @brief Get the cache of the calling thread.
+   *
+   * @return thread_cache* The cache, or nullptr if all caches are taken.
+   */
+  thread_cache *local_cache();
+
+  /**
+   * @brief Return a buffer to the pool.
+   *
+   * @param addr The address of the buffer.
+   * @param size_class The size class of the buffer.
+   */
+  void release(void *addr, uint32_t size_class);
+
+public:
+  /**
+   * @brief Construct a new buffer pool object and register its region.
+   *
+   * @param pd The protection domain to register the region in.
+   * @param max_size The largest payload served by the pool.
+   * @param buffers_per_class The number of buffers of every size class.
+   */
+  buffer_pool(struct ibv_pd *pd, size_t max_size, size_t buffers_per_class);
+
+  /**
+   * @brief Take a buffer large enough for a payload.
+   *
+   * @param size The size of the payload.
+   * @return buffer The buffer. It is empty if the payload is larger than the
+   * pool serves or the size class is exhausted.
+   */
+  buffer acquire(size_t size);
+
+  /**
+   * @brief Get the largest payload served by the pool.
+   *
+   * @return size_t The size in bytes.
+   */
+  size_t max_size() const;
+
+  ~buffer_pool();
+};
+
+} // namespace rdmapp
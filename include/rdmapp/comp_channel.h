@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/device.h"
+
+#include "rdmapp/detail/noncopyable.h"
+
+namespace rdmapp {
+
+namespace detail {
+class cq_waiter;
+} // namespace detail
+
+/**
+ * @brief How a poller spent its idle time. Pollers only sleep when all their
+ * completion queues have a completion channel and a spin budget is set.
+ *
+ */
+struct wait_stats {
+  // Times the poller blocked on its completion channels.
+  uint64_t sleeps;
+  // Sleeps ended by a completion event or a wake-up.
+  uint64_t wakeups;
+  // Sleeps ended by the timeout used to check for shutdown.
+  uint64_t timeouts;
+  // Time spent blocked, in total and at most at once.
+  uint64_t asleep_ns;
+  uint64_t max_asleep_ns;
+  // Time from a wake-up to the first completion delivered after it, in total
+  // over the wake-ups followed by one, and at most.
+  uint64_t wake_latency_ns;
+  uint64_t max_wake_latency_ns;
+  uint64_t woken_completions;
+  // CPU time used by the poller thread and wall time since it started.
+  uint64_t cpu_ns;
+  uint64_t wall_ns;
+};
+
+/**
+ * @brief This class is an abstraction of a Completion Channel. Completion
+ * queues created with a channel can be armed to raise an event on it for
+ * their next completion, so that a poller can block on the channel instead
+ * of spinning. A channel can be shared by a group of completion queues.
+ *
+ */
+class comp_channel : public noncopyable {
+  std::shared_ptr<device> device_;
+  struct ibv_comp_channel *channel_;
+  int wake_fd_;
+  std::atomic<int> sleepers_;
+  friend class cq;
+  friend class detail::cq_waiter;
+
+  /**
+   * @brief Consume and acknowledge all pending completion events, and clear
+   * pending wake-ups.
+   *
+   */
+  void drain();
+
+  /**
+   * @brief Wake the pollers blocked on this channel, if any.
+   *
+   */
+  void wake_sleepers() {
+    if (sleepers_.load(std::memory_order_seq_cst) > 0) [[unlikely]] {
+      wake();
+    }
+  }
+
+public:
+  /**
+   * @brief Construct a new completion channel.
+   *
+   * @param device The device to use.
+   */
+  explicit comp_channel(std::shared_ptr<device> device);
+
+  /**
+   * @brief Get the file descriptor of the channel. It is readable when a
+   * completion event is pending.
+   *
+   * @return int The file descriptor.
+   */
+  int fd() const;
+
+  /**
+   * @brief Wake the pollers waiting on this channel without a completion,
+   * e.g. to make them flush batched sends or notice shutdown.
+   *
+   */
+  void wake();
+
+  ~comp_channel();
+};
+
+} // namespace rdmapp
@@ -1,28 +1,210 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 #include <vector>
 
 #include <infiniband/verbs.h>
 
+#include "rdmapp/comp_channel.h"
 #include "rdmapp/device.h"
 #include "rdmapp/error.h"
 
 #include "rdmapp/detail/noncopyable.h"
+#include "rdmapp/detail/spinlock.h"
+#include "rdmapp/detail/tsc.h"
 
 namespace rdmapp {
 
 class qp;
 
+/**
+ * @brief Where the completion timestamps of a completion queue come from.
+ *
+ */
+enum class timestamp_source {
+  // Completions are not timestamped.
+  none,
+  // The device stamps every completion; the stamps are converted to ticks.
+  hardware,
+  // Completions are stamped with the tick of the poll that returned them.
+  software,
+};
+
+/**
+ * @brief What a completion queue does when the Queue Pairs attached to it
+ * could have more work requests outstanding than it has entries. An
+ * overflowing completion queue is an asynchronous error that kills every
+ * Queue Pair using it.
+ *
+ */
+enum class cq_overflow_policy {
+  // Resize the completion queue to fit, up to the limit of the device.
+  grow,
+  // Refuse the Queue Pair that would not fit.
+  refuse,
+  // Only account for the depth, as if the Queue Pairs never fill up.
+  ignore,
+};
+
+/**
+ * @brief How deep a completion queue is and how deep it gets.
+ *
+ */
+struct cq_depth_stats {
+  // Entries of the completion queue.
+  size_t capacity;
+  // Entries the attached Queue Pairs may fill at once.
+  size_t reserved;
+  size_t reserved_high_watermark;
+  // Most completions found queued at once, as seen by consecutive full
+  // polls.
+  size_t backlog_high_watermark;
+  uint64_t resizes;
+  // Queue Pairs refused for lack of room.
+  uint64_t refused;
+};
+
 /**
  * @brief This class is an abstraction of a Completion Queue.
  *
  */
 class cq : public noncopyable {
   std::shared_ptr<device> device_;
+  std::shared_ptr<comp_channel> channel_;
   struct ibv_cq *cq_;
+  struct ibv_cq_ex *cq_ex_;
+  timestamp_source timestamps_;
+  uint64_t poll_tick_;
+  std::vector<uint64_t> completed_at_;
+  uint64_t hca_mask_;
+  uint64_t hca_ref_;
+  uint64_t tick_ref_;
+  double ticks_per_hca_cycle_;
+  std::atomic<uint32_t> unacked_events_;
+  std::atomic<bool> has_pending_flush_;
+  detail::spinlock pending_flush_lock_;
+  std::vector<qp *> pending_flush_;
+  std::shared_mutex qps_mutex_;
+  std::unordered_map<uint32_t, qp *> qps_;
+  std::atomic<size_t> backlog_;
+  std::atomic<size_t> backlog_high_watermark_;
+  mutable std::mutex depth_mutex_;
+  cq_overflow_policy overflow_policy_;
+  size_t reserved_;
+  size_t reserved_high_watermark_;
+  uint64_t resizes_;
+  uint64_t refused_;
+  // Shared receive queues are reserved once however many Queue Pairs use
+  // them.
+  std::unordered_map<void const *, size_t> shared_refs_;
   friend class qp;
+  friend class ud_qp;
+  friend class comp_channel;
+
+  /**
+   * @brief Count a completion event read from the channel. Events are
+   * acknowledged in batches, as acknowledging takes a lock.
+   *
+   */
+  void ack_event();
+
+  /**
+   * @brief Register a Queue Pair that uses this CQ as its send CQ, so that
+   * its tracked send completions can be routed back to it.
+   *
+   * @param qp_num The QPN of the Queue Pair.
+   * @param qp The Queue Pair.
+   */
+  void attach(uint32_t qp_num, qp *qp);
+
+  /**
+   * @brief Unregister a Queue Pair. Blocks until no poller is retiring its
+   * send work requests.
+   *
+   * @param qp_num The QPN of the Queue Pair.
+   */
+  void detach(uint32_t qp_num);
+
+  /**
+   * @brief Queue a Queue Pair whose send batch should be posted by the next
+   * call to flush_sends(), which also hands out its failed sends.
+   *
+   * @param qp The Queue Pair using this CQ as its send CQ.
+   */
+  void schedule_flush(qp *qp);
+
+  /**
+   * @brief Remove a Queue Pair from the pending flush list. Blocks until any
+   * in-progress flush of that Queue Pair has finished, so it must not be
+   * called from a sent handler.
+   *
+   * @param qp The Queue Pair to remove.
+   */
+  void cancel_flush(qp *qp);
+
+  /**
+   * @brief Reserve entries for the work requests of a Queue Pair about to
+   * use this CQ, growing it or refusing them as the overflow policy says.
+   *
+   * @param nr_cqe The number of entries.
+   * @param shared (Optional) The shared receive queue the entries are for.
+   * Only its first reservation counts.
+   * @exception std::runtime_error The entries do not fit and the completion
+   * queue cannot grow.
+   */
+  void reserve(size_t nr_cqe, void const *shared = nullptr);
+
+  /**
+   * @brief Release entries reserved with reserve().
+   *
+   * @param nr_cqe The number of entries.
+   * @param shared (Optional) The shared receive queue the entries are for.
+   * Only its last release counts.
+   */
+  void unreserve(size_t nr_cqe, void const *shared = nullptr);
+
+  /**
+   * @brief Record the result of a poll for the backlog high watermark.
+   *
+   * @param nr_wc The number of completion entries it returned.
+   * @param count The number of completion entries it asked for.
+   */
+  void note_backlog(size_t nr_wc, size_t count) {
+    auto const backlog = backlog_.load(std::memory_order_relaxed) + nr_wc;
+    if (nr_wc == count) {
+      backlog_.store(backlog, std::memory_order_relaxed);
+      return;
+    }
+    if (backlog > backlog_high_watermark_.load(std::memory_order_relaxed))
+        [[unlikely]] {
+      backlog_high_watermark_.store(backlog, std::memory_order_relaxed);
+    }
+    backlog_.store(0, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Pair the current device clock with the current tick, so that
+   * device timestamps can be converted to ticks.
+   *
+   * @return true The device clock was read.
+   * @return false The device clock cannot be read.
+   */
+  bool calibrate();
+
+  /**
+   * @brief Poll an extended completion queue, converting its entries to work
+   * completions and their timestamps to ticks.
+   *
+   * @param wc The work completions to fill.
+   * @param count The maximum number of work completions.
+   * @return size_t The number of work completions.
+   */
+  size_t poll_ex(struct ibv_wc *wc, int count);
 
 public:
   /**
@@ -30,8 +212,78 @@ public:
    *
    * @param device The device to use.
    * @param num_cqe The number of completion entries to allocate.
+   * @param channel (Optional) The completion channel to raise events on when
+   * armed. Pollers can only sleep on completion queues that have one.
+   * @param timestamps (Optional) Timestamp completions, so that operations
+   * of the Queue Pairs using the completion queue are timed (see
+   * op_latencies()). Device timestamps are used if the device supports them,
+   * otherwise completions are stamped when polled.
+   */
+  cq(std::shared_ptr<device> device, size_t num_cqe = 128,
+     std::shared_ptr<comp_channel> channel = nullptr, bool timestamps = false);
+
+  /**
+   * @brief Get where the completion timestamps come from.
+   *
+   * @return timestamp_source The source, none if timestamps are off.
+   */
+  timestamp_source timestamps() const;
+
+  /**
+   * @brief Get the completion channel of the completion queue.
+   *
+   * @return std::shared_ptr<comp_channel> The channel, or nullptr.
    */
-  cq(std::shared_ptr<device> device, size_t num_cqe = 128);
+  std::shared_ptr<comp_channel> channel() const;
+
+  /**
+   * @brief Moderate the completion events of the completion queue: once
+   * armed, an event is raised only after count completions or period
+   * microseconds since the first one. Pollers sleeping on the channel then
+   * wake once per burst instead of once per completion, at the cost of up to
+   * period of latency. Busy polling is not affected.
+   *
+   * @param count The number of completions per event, up to
+   * cq_mod_caps.max_cq_count of the device. 0 disables moderation.
+   * @param period_us The maximum delay of an event in microseconds, up to
+   * cq_mod_caps.max_cq_period of the device.
+   * @exception std::runtime_error The device does not support moderation or
+   * the values exceed its limits.
+   */
+  void moderate(uint16_t count, uint16_t period_us);
+
+  /**
+   * @brief Set what happens when a Queue Pair connecting to the completion
+   * queue would overflow it. Queue Pairs reserve their send and receive
+   * depth on their completion queues when created and release it when
+   * destroyed.
+   *
+   * @param policy The policy, grow by default.
+   */
+  void set_overflow_policy(cq_overflow_policy policy);
+
+  /**
+   * @brief Get the depth of the completion queue and its high watermarks.
+   *
+   * @return cq_depth_stats The depth.
+   */
+  cq_depth_stats depth_stats() const;
+
+  /**
+   * @brief Arm the completion queue to raise an event on its channel for the
+   * next completion. The completion queue must be polled once more after
+   * arming, as completions that arrived before do not raise an event.
+   *
+   */
+  void req_notify();
+
+  /**
+   * @brief Checks if batched sends are waiting for flush_sends().
+   *
+   * @return true Sends are waiting.
+   * @return false No send is waiting.
+   */
+  bool has_pending_flush() const;
 
   /**
    * @brief Poll the completion queue.
@@ -56,15 +308,61 @@ public:
    */
   size_t poll(std::vector<struct ibv_wc> &wc_vec);
   template <class It> size_t poll(It wc, int count) {
-    int rc = ::ibv_poll_cq(cq_, count, wc);
+    if (cq_ex_ != nullptr) {
+      auto const nr = poll_ex(&*wc, count);
+      note_backlog(nr, count);
+      return nr;
+    }
+    int rc = ::ibv_poll_cq(cq_, count, &*wc);
     if (rc < 0) {
       throw_with("failed to poll cq: %s (rc=%d)", strerror(rc), rc);
     }
+    if (timestamps_ != timestamp_source::none && rc > 0) {
+      poll_tick_ = detail::rdtsc();
+    }
+    note_backlog(rc, count);
     return rc;
   }
   template <int N> size_t poll(std::array<struct ibv_wc, N> &wc_array) {
     return poll(&wc_array[0], N);
   }
+
+  /**
+   * @brief Get the completion tick of a work completion returned by the last
+   * poll.
+   *
+   * @param i The index of the work completion in the last poll.
+   * @return uint64_t The tick, or 0 if timestamps are off.
+   */
+  uint64_t completed_at(size_t i) const {
+    if (cq_ex_ != nullptr) {
+      return completed_at_[i];
+    }
+    return timestamps_ == timestamp_source::none ? 0 : poll_tick_;
+  }
+
+  /**
+   * @brief Post the batched send work requests of all Queue Pairs that use
+   * this CQ as their send CQ. Pollers call this at the end of every poll loop
+   * iteration so that a partially filled batch never waits for long. Sends
+   * that failed to post are completed with an error instead of throwing.
+   *
+   * @param handles The coroutines of failed sends to resume are appended to
+   * it.
+   */
+  void flush_sends(std::vector<void *> &handles);
+
+  /**
+   * @brief Retire the tracked send work requests of the Queue Pair that
+   * produced a tracked work completion. Every unsignaled work request posted
+   * before the completed one is retired as successful.
+   *
+   * @param wc A work completion whose wr_id is a tracked sequence number.
+   * @param handles The coroutines to resume are appended to it, oldest first.
+   * @param completed_at (Optional) The tick of the work completion.
+   */
+  void retire_sends(struct ibv_wc const &wc, std::vector<void *> &handles,
+                    uint64_t completed_at = 0);
   ~cq();
 };
 
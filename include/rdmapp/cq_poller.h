@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <thread>
@@ -9,6 +10,10 @@
 
 #include "rdmapp/cq.h"
 #include "rdmapp/executor.h"
+#include "rdmapp/poll_batch.h"
+#include "rdmapp/poller_metrics.h"
+
+#include "rdmapp/detail/cq_waiter.h"
 
 namespace rdmapp {
 
@@ -22,27 +27,58 @@ class cq_poller {
   std::jthread poller_thread_;
   std::shared_ptr<executor> executor_;
   std::vector<struct ibv_wc> wc_vec_;
-  void recv_worker();
-  void send_worker();
+  detail::batch_sizer batch_;
+  detail::cq_waiter waiter_;
+  detail::poller_metrics metrics_;
+  size_t poll_once();
+  void worker();
 
 public:
   /**
    * @brief Construct a new cq poller object. A new executor will be created.
    *
    * @param cq The completion queue to poll.
-   * @param batch_size The number of completion entries to poll at a time.
+   * @param is_recv Unused: send and recv completions take the same path.
+   * @param batch_size The number of completion entries to poll at a time,
+   * or a range to adapt it within (see poll_batch).
+   * @param spin_budget (Optional) How long to spin without completions before
+   * sleeping on the completion channel of the cq. Never sleeps by default or
+   * if the cq has no channel.
    */
-  cq_poller(std::shared_ptr<cq> cq, bool is_recv = true, size_t batch_size = 16);
+  cq_poller(std::shared_ptr<cq> cq, bool is_recv = true, poll_batch batch_size = 16,
+            std::chrono::nanoseconds spin_budget =
+                detail::cq_waiter::kSpinForever);
 
   /**
    * @brief Construct a new cq poller object.
    *
    * @param cq The completion queue to poll.
+   * @param is_recv Unused: send and recv completions take the same path.
    * @param executor The executor to use to process the completion entries.
-   * @param batch_size The number of completion entries to poll at a time.
+   * @param batch_size The number of completion entries to poll at a time,
+   * or a range to adapt it within (see poll_batch).
+   * @param spin_budget (Optional) How long to spin without completions before
+   * sleeping on the completion channel of the cq.
    */
   cq_poller(std::shared_ptr<cq> cq, bool is_recv, std::shared_ptr<executor> executor,
-            size_t batch_size = 16);
+            poll_batch batch_size = 16,
+            std::chrono::nanoseconds spin_budget =
+                detail::cq_waiter::kSpinForever);
+
+  /**
+   * @brief Get how the poller spent its idle time.
+   *
+   * @return wait_stats The statistics.
+   */
+  wait_stats stats() const;
+
+  /**
+   * @brief Get the metrics of the polling loop. Cheap enough to call
+   * periodically, e.g. from a metrics_dumper.
+   *
+   * @return poller_metrics_snapshot The metrics.
+   */
+  poller_metrics_snapshot metrics() const;
 
   ~cq_poller();
 };
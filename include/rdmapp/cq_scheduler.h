@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "rdmapp/cq.h"
+
+#include "rdmapp/detail/noncopyable.h"
+#include "rdmapp/detail/tsc.h"
+
+namespace rdmapp {
+
+/**
+ * @brief How a poller served one of its completion queues.
+ *
+ */
+struct cq_service_stats {
+  uint32_t weight;
+  // Polls of the completion queue, empty or not.
+  uint64_t polls;
+  // Rounds that found it empty.
+  uint64_t empty_polls;
+  // Rounds the completion queue sat out while backing off.
+  uint64_t skipped_rounds;
+  uint64_t completions;
+  // Nanoseconds spent polling it and delivering its completions.
+  uint64_t service_ns;
+};
+
+/**
+ * @brief Decides which completion queues a poller polls and how much of
+ * each, with deficit round robin. Every round, a completion queue may take
+ * up to quantum times its weight completions, so that a busy one cannot
+ * starve the others. A completion queue found empty several rounds in a row
+ * is skipped for an exponentially growing number of rounds.
+ *
+ * Completion queues can be added and removed from any thread; the poller
+ * picks the changes up at the start of its next round.
+ *
+ */
+class cq_scheduler : public noncopyable {
+  // Empty polls in a row before a completion queue backs off.
+  static constexpr uint32_t kBackoffAfter = 4;
+  // Most rounds a backed off completion queue sits out.
+  static constexpr uint32_t kMaxSkippedRounds = 32;
+
+  struct entry {
+    std::shared_ptr<rdmapp::cq> queue;
+    std::atomic<uint32_t> weight;
+    uint32_t empty_streak;
+    uint32_t skip;
+    std::atomic<uint64_t> polls;
+    std::atomic<uint64_t> empty_polls;
+    std::atomic<uint64_t> skipped_rounds;
+    std::atomic<uint64_t> completions;
+    std::atomic<uint64_t> service_ticks;
+
+    entry(std::shared_ptr<rdmapp::cq> cq, uint32_t weight)
+        : queue(std::move(cq)), weight(weight), empty_streak(0), skip(0),
+          polls(0), empty_polls(0), skipped_rounds(0),
+          completions(0), service_ticks(0) {}
+  };
+
+  static void bump(std::atomic<uint64_t> &counter, uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+  }
+
+  size_t quantum_;
+  // Owned by the poller thread.
+  std::vector<std::shared_ptr<entry>> entries_;
+  std::vector<std::shared_ptr<cq>> cqs_;
+  mutable std::mutex mutex_;
+  std::vector<std::shared_ptr<entry>> pending_;
+  std::atomic<bool> changed_;
+
+public:
+  /**
+   * @brief Construct a new cq scheduler.
+   *
+   * @param quantum The completions a completion queue of weight 1 may take
+   * every round.
+   */
+  explicit cq_scheduler(size_t quantum);
+
+  /**
+   * @brief Add a completion queue, or change its weight if already added.
+   *
+   * @param cq The completion queue.
+   * @param weight Its share relative to the others, at least 1.
+   */
+  void add(std::shared_ptr<cq> cq, uint32_t weight = 1);
+
+  /**
+   * @brief Remove a completion queue. The poller keeps a reference to it
+   * until its next round.
+   *
+   * @param cq The completion queue.
+   */
+  void remove(std::shared_ptr<cq> const &cq);
+
+  /**
+   * @brief Apply the pending additions and removals. Called by the poller
+   * thread before a round.
+   *
+   * @return true The completion queues changed.
+   * @return false Nothing changed.
+   */
+  bool sync() {
+    if (!changed_.load(std::memory_order_acquire)) [[likely]] {
+      return false;
+    }
+    return apply();
+  }
+
+  /**
+   * @brief Apply the pending changes unconditionally.
+   *
+   * @return true The completion queues changed.
+   * @return false Nothing was pending.
+   */
+  bool apply();
+
+  /**
+   * @brief Get the completion queues of the current round. Called by the
+   * poller thread.
+   *
+   * @return std::vector<std::shared_ptr<cq>> const& The completion queues.
+   */
+  std::vector<std::shared_ptr<cq>> const &cqs() const { return cqs_; }
+
+  /**
+   * @brief Run a round over the completion queues.
+   *
+   * @param poll_all Poll every completion queue once, even those backing
+   * off, e.g. because they were just armed.
+   * @param batch The most completions to poll at a time.
+   * @param poll Called as poll(cq, max): polls and delivers up to max
+   * completions of cq and returns how many there were.
+   * @return true Some completion queue had completions.
+   * @return false All were empty.
+   */
+  template <class Fn> bool round(bool poll_all, size_t batch, Fn &&poll) {
+    bool progress = false;
+    for (auto &e : entries_) {
+      if (e->skip != 0 && !poll_all) {
+        --e->skip;
+        bump(e->skipped_rounds, 1);
+        continue;
+      }
+      auto deficit = quantum_ * e->weight.load(std::memory_order_relaxed);
+      size_t served = 0;
+      auto const start = detail::rdtsc();
+      while (deficit != 0) {
+        auto const max = std::min(deficit, batch);
+        auto const nr = poll(*e->queue, max);
+        bump(e->polls, 1);
+        served += nr;
+        if (nr < max) {
+          break;
+        }
+        deficit -= nr;
+      }
+      if (served == 0) {
+        bump(e->empty_polls, 1);
+        if (++e->empty_streak > kBackoffAfter) {
+          e->skip = std::min(1U << std::min(e->empty_streak - kBackoffAfter,
+                                            5U),
+                             kMaxSkippedRounds);
+        }
+        continue;
+      }
+      bump(e->service_ticks, detail::rdtsc() - start);
+      bump(e->completions, served);
+      e->empty_streak = 0;
+      e->skip = 0;
+      progress = true;
+    }
+    return progress;
+  }
+
+  /**
+   * @brief Get how every completion queue was served. Can be called from
+   * any thread.
+   *
+   * @return std::vector<std::pair<std::shared_ptr<cq>, cq_service_stats>>
+   * The completion queues with their statistics.
+   */
+  std::vector<std::pair<std::shared_ptr<cq>, cq_service_stats>> stats() const;
+};
+
+} // namespace rdmapp
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+#include "rdmapp/detail/noncopyable.h"
+
+namespace rdmapp {
+namespace detail {
+
+/**
+ * @brief A bounded lock-free queue with a sequence number per slot (Vyukov).
+ * A slot is free for the producer at position p when its sequence is p, and
+ * holds an element for the consumer at position p when its sequence is p + 1,
+ * so producers and consumers only ever touch the index of their own side.
+ * A side with a single thread claims positions with a plain store instead of
+ * a compare-and-swap.
+ *
+ * @tparam T A trivially copyable element.
+ * @tparam MultiProducer Whether several threads may push concurrently.
+ * @tparam MultiConsumer Whether several threads may pop concurrently.
+ */
+template <class T, bool MultiProducer, bool MultiConsumer>
+class bounded_queue : public noncopyable {
+  static_assert(std::is_trivially_copyable_v<T>);
+  static constexpr size_t kCacheLine = 64;
+
+  struct slot {
+    std::atomic<uint64_t> seq;
+    T value;
+  };
+
+  uint64_t const mask_;
+  std::unique_ptr<slot[]> slots_;
+  alignas(kCacheLine) std::atomic<uint64_t> tail_;
+  // The alignment also pads the queue, keeping the consumer index off the
+  // line of whatever follows it.
+  alignas(kCacheLine) std::atomic<uint64_t> head_;
+
+  static uint64_t round_up(size_t capacity) {
+    uint64_t pow2 = 1;
+    while (pow2 < capacity) {
+      pow2 *= 2;
+    }
+    return pow2;
+  }
+
+  // Claims up to n consecutive positions of one side. A position is ready
+  // when its slot has the sequence position + lag.
+  template <bool Multi>
+  size_t claim(std::atomic<uint64_t> &index, uint64_t lag, size_t n,
+               uint64_t &pos) {
+    pos = index.load(std::memory_order_relaxed);
+    while (true) {
+      size_t nr = 0;
+      while (nr < n && slots_[(pos + nr) & mask_].seq.load(
+                           std::memory_order_acquire) == pos + nr + lag) {
+        ++nr;
+      }
+      if (nr == 0) {
+        if constexpr (Multi) {
+          // Another thread may have moved the index past a full (or empty)
+          // slot: only give up if it did not.
+          auto const now = index.load(std::memory_order_relaxed);
+          if (now != pos) {
+            pos = now;
+            continue;
+          }
+        }
+        return 0;
+      }
+      if constexpr (Multi) {
+        if (!index.compare_exchange_weak(pos, pos + nr,
+                                         std::memory_order_relaxed)) {
+          continue;
+        }
+      } else {
+        index.store(pos + nr, std::memory_order_relaxed);
+      }
+      return nr;
+    }
+  }
+
+public:
+  /**
+   * @brief Construct a new bounded queue.
+   *
+   * @param capacity The number of elements, rounded up to a power of 2.
+   */
+  explicit bounded_queue(size_t capacity)
+      : mask_(round_up(capacity) - 1), slots_(new slot[mask_ + 1]),
+        tail_(0), head_(0) {
+    for (uint64_t i = 0; i <= mask_; ++i) {
+      slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * @brief Push an element.
+   *
+   * @param value The element.
+   * @return true The element was pushed.
+   * @return false The queue is full.
+   */
+  bool push(T const &value) { return push_n(&value, 1) == 1; }
+
+  /**
+   * @brief Push up to n elements, in order, as far as there is room.
+   *
+   * @param values The elements.
+   * @param n The number of elements.
+   * @return size_t The number of elements pushed, the first ones.
+   */
+  size_t push_n(T const *values, size_t n) {
+    uint64_t pos;
+    auto const nr = claim<MultiProducer>(tail_, 0, n, pos);
+    for (size_t i = 0; i < nr; ++i) {
+      auto &s = slots_[(pos + i) & mask_];
+      s.value = values[i];
+      s.seq.store(pos + i + 1, std::memory_order_release);
+    }
+    return nr;
+  }
+
+  /**
+   * @brief Pop the oldest element.
+   *
+   * @param value Set to the element, if any.
+   * @return true An element was popped.
+   * @return false The queue is empty.
+   */
+  bool pop(T &value) { return pop_n(&value, 1) == 1; }
+
+  /**
+   * @brief Pop up to n of the oldest elements, in order.
+   *
+   * @param values Filled with the elements.
+   * @param n The maximum number of elements.
+   * @return size_t The number of elements popped.
+   */
+  size_t pop_n(T *values, size_t n) {
+    uint64_t pos;
+    auto const nr = claim<MultiConsumer>(head_, 1, n, pos);
+    for (size_t i = 0; i < nr; ++i) {
+      auto &s = slots_[(pos + i) & mask_];
+      values[i] = s.value;
+      s.seq.store(pos + i + mask_ + 1, std::memory_order_release);
+    }
+    return nr;
+  }
+
+  /**
+   * @brief Get the number of elements. Only a hint while other threads push
+   * or pop.
+   *
+   * @return size_t The number of elements.
+   */
+  size_t size() const {
+    auto const head = head_.load(std::memory_order_relaxed);
+    auto const tail = tail_.load(std::memory_order_relaxed);
+    return tail > head ? static_cast<size_t>(tail - head) : 0;
+  }
+
+  /**
+   * @brief Checks if the queue is empty. Only a hint while other threads
+   * push or pop.
+   *
+   * @return true The queue is empty.
+   * @return false The queue has elements.
+   */
+  bool empty() const { return size() == 0; }
+
+  /**
+   * @brief Get the capacity of the queue.
+   *
+   * @return size_t The number of elements it can hold.
+   */
+  size_t capacity() const { return mask_ + 1; }
+};
+
+template <class T> using spsc_queue = bounded_queue<T, false, false>;
+template <class T> using mpsc_queue = bounded_queue<T, true, false>;
+template <class T> using spmc_queue = bounded_queue<T, false, true>;
+template <class T> using mpmc_queue = bounded_queue<T, true, true>;
+
+} // namespace detail
+} // namespace rdmapp
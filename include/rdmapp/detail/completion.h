@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/cq.h"
+
+#include "rdmapp/detail/completion_slab.h"
+
+namespace rdmapp {
+namespace detail {
+
+/**
+ * @brief Send work requests posted by a Queue Pair carry a sequence number
+ * in their wr_id, so that the Queue Pair can account for its send queue
+ * slots. The lowest bit tells them apart from completion slab wr_ids.
+ *
+ */
+constexpr uint64_t kTrackedWrIdTag = 1;
+
+static inline uint64_t make_tracked_wr_id(uint64_t seq) {
+  return (seq << 1) | kTrackedWrIdTag;
+}
+
+static inline uint64_t tracked_wr_id_seq(uint64_t wr_id) { return wr_id >> 1; }
+
+static inline bool is_tracked_wr_id(uint64_t wr_id) {
+  return (wr_id & kTrackedWrIdTag) != 0;
+}
+
+/**
+ * @brief Fire-and-forget send work requests are submitted with their cookie
+ * in the wr_id, which the Queue Pair moves to its send ring before replacing
+ * the wr_id with a sequence number. Awaited ones carry their slot pointer,
+ * whose low bits are 0.
+ *
+ */
+constexpr uint64_t kDirectWrIdTag = 3;
+
+static inline uint64_t make_direct_wr_id(uint64_t cookie) {
+  return (cookie << 2) | kDirectWrIdTag;
+}
+
+static inline bool is_direct_wr_id(uint64_t wr_id) {
+  return (wr_id & kWrIdTagMask) == kDirectWrIdTag;
+}
+
+/**
+ * @brief Retire all tracked send work requests completed by a work completion
+ * and resume the coroutines waiting for them, oldest first.
+ *
+ * @param cq The completion queue the work completion was polled from.
+ * @param wc A work completion with a tracked wr_id.
+ * @param resume Called with the address of every coroutine to resume.
+ * @param completed_at (Optional) The tick of the work completion.
+ */
+template <class Fn>
+static inline void retire_tracked_wc(cq &cq, struct ibv_wc const &wc,
+                                     Fn &&resume, uint64_t completed_at = 0) {
+  thread_local std::vector<void *> handles;
+  cq.retire_sends(wc, handles, completed_at);
+  for (auto h_ptr : handles) {
+    resume(h_ptr);
+  }
+  handles.clear();
+}
+
+/**
+ * @brief Post the batched sends of the Queue Pairs using a CQ as their send
+ * CQ and resume the coroutines of the sends that failed to post.
+ *
+ * @param cq The completion queue.
+ * @param resume Called with the address of every coroutine to resume.
+ */
+template <class Fn> static inline void flush_sends(cq &cq, Fn &&resume) {
+  thread_local std::vector<void *> handles;
+  cq.flush_sends(handles);
+  for (auto h_ptr : handles) {
+    resume(h_ptr);
+  }
+  handles.clear();
+}
+
+/**
+ * @brief Deliver a work completion to the awaiter waiting for it. Its result
+ * is copied into the completion slot named by the wr_id and its coroutine is
+ * handed to resume. Completions without an awaiter (wr_id 0), stale ones and
+ * duplicates are dropped.
+ *
+ * @param cq The completion queue the work completion was polled from.
+ * @param wc The work completion.
+ * @param resume Called with the address of every coroutine to resume.
+ * @param completed_at (Optional) The tick of the work completion.
+ */
+template <class Fn>
+static inline void dispatch_wc(cq &cq, struct ibv_wc const &wc, Fn &&resume,
+                               uint64_t completed_at = 0) {
+  if (is_tracked_wr_id(wc.wr_id)) {
+    retire_tracked_wc(cq, wc, resume, completed_at);
+    return;
+  }
+  if (is_slab_wr_id(wc.wr_id)) [[likely]] {
+    if (auto h_ptr = completion_slab::complete(wc, completed_at);
+        h_ptr != nullptr) {
+      resume(h_ptr);
+    }
+  }
+}
+
+/**
+ * @brief Deliver a batch of polled work completions, prefetching the slot of
+ * the next completion while delivering the current one.
+ *
+ * @param cq The completion queue the work completions were polled from.
+ * @param wc The work completions.
+ * @param nr_wc The number of work completions.
+ * @param resume Called with the address of every coroutine to resume, and
+ * with its work completion if it accepts one.
+ */
+template <class Fn>
+static inline void dispatch_wcs(cq &cq, struct ibv_wc const *wc, size_t nr_wc,
+                                Fn &&resume) {
+  if (nr_wc != 0) {
+    completion_slab::prefetch(wc[0]);
+  }
+  for (size_t i = 0; i < nr_wc; ++i) {
+    if (i + 1 < nr_wc) {
+      completion_slab::prefetch(wc[i + 1]);
+    }
+    if constexpr (std::is_invocable_v<Fn &, void *, struct ibv_wc const &>) {
+      dispatch_wc(
+          cq, wc[i], [&](void *h_ptr) { resume(h_ptr, wc[i]); },
+          cq.completed_at(i));
+    } else {
+      dispatch_wc(cq, wc[i], resume, cq.completed_at(i));
+    }
+  }
+}
+
+} // namespace detail
+} // namespace rdmapp
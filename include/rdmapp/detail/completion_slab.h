@@ -0,0 +1,297 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/latency.h"
+
+#include "rdmapp/detail/debug.h"
+#include "rdmapp/detail/noncopyable.h"
+#include "rdmapp/detail/spinlock.h"
+#include "rdmapp/detail/tsc.h"
+
+namespace rdmapp {
+namespace detail {
+
+/**
+ * @brief Work requests whose completion is delivered through a completion
+ * slab carry this tag in the two lowest bits of their wr_id. Tracked sends
+ * use the lowest bit alone, so the two never collide.
+ *
+ */
+constexpr uint64_t kSlabWrIdTag = 2;
+constexpr uint64_t kWrIdTagMask = 3;
+
+static inline bool is_slab_wr_id(uint64_t wr_id) {
+  return (wr_id & kWrIdTagMask) == kSlabWrIdTag;
+}
+
+/**
+ * @brief The part of a work completion an awaiter reads once resumed.
+ *
+ */
+struct completion_result {
+  enum ibv_wc_status status;
+  uint32_t byte_len;
+  uint32_t imm_data;
+  uint32_t wc_flags;
+  uint32_t src_qp;
+  uint16_t slid;
+  // The tick the operation completed at, or 0 if its completion queue has no
+  // timestamps.
+  uint64_t completed_at;
+};
+
+struct completion_slot;
+
+/**
+ * @brief Called instead of resuming a coroutine when a slot owned by a
+ * longer-lived consumer completes. Its context is in coroutine_addr.
+ *
+ * @return void* The coroutine to resume, or nullptr.
+ */
+using completion_handler = void *(*)(completion_slot &slot);
+
+/**
+ * @brief A pending operation: the coroutine waiting for it and, once
+ * completed, its result. Every slot takes a cache line of its own, so that a
+ * poller completing one slot never shares a line with the awaiter of another.
+ *
+ */
+struct alignas(64) completion_slot {
+  completion_result result;
+  void *coroutine_addr;
+  completion_handler handler;
+  // The generation in the upper bits and whether a completion is awaited in
+  // the lowest one.
+  std::atomic<uint32_t> state;
+  uint32_t index;
+  // The tick the operation was posted at, or 0 if it is not timed.
+  uint64_t posted_at;
+};
+
+static_assert(sizeof(completion_slot) == 64);
+
+/**
+ * @brief Copy a work completion into a pending slot and mark it completed.
+ *
+ * @param slot The slot.
+ * @param wc The work completion.
+ * @param completed_at (Optional) The tick of the completion, if known.
+ * @return void* The coroutine to resume, or nullptr if the slot was not
+ * pending (a double completion) or nobody is to be resumed.
+ */
+static inline void *complete_slot(completion_slot &slot,
+                                  struct ibv_wc const &wc,
+                                  uint64_t completed_at = 0) {
+  auto const state = slot.state.load(std::memory_order_acquire);
+  if ((state & 1) == 0) [[unlikely]] {
+    RDMAPP_LOG_DEBUG("ignored double completion of slot %u", slot.index);
+    return nullptr;
+  }
+  slot.result.status = wc.status;
+  slot.result.byte_len = wc.byte_len;
+  slot.result.imm_data = wc.imm_data;
+  slot.result.wc_flags = wc.wc_flags;
+  slot.result.src_qp = wc.src_qp;
+  slot.result.slid = wc.slid;
+  slot.result.completed_at = completed_at;
+  slot.state.store(state & ~1U, std::memory_order_release);
+  if (slot.handler != nullptr) {
+    return slot.handler(slot);
+  }
+  return slot.coroutine_addr;
+}
+
+/**
+ * @brief This class holds the completion slots of the operations of a Queue
+ * Pair. A slot is named by a compact wr_id made of the slab, the slot index
+ * and the generation of the slot, so pollers find it without knowing the
+ * layout of any awaitable, and a completion for a slot since reused or
+ * already completed is dropped instead of resuming the wrong coroutine.
+ *
+ * Slots are taken when an operation is posted and given back when its
+ * awaiter resumes. The slab grows by chunks and never moves a slot.
+ *
+ * A poller may still hold a slot of a destroyed slab, and its late
+ * completions may still arrive, so the chunks of a slab id are never freed:
+ * the next slab given that id adopts them, with the generations they had.
+ * A late completion for a destroyed slab thus finds a slot whose generation
+ * has moved on, and is dropped like any other stale completion.
+ *
+ */
+class completion_slab : public noncopyable {
+public:
+  static constexpr size_t kMaxSlabs = 1 << 16;
+  static constexpr size_t kMaxChunks = 32;
+
+private:
+  // The slots of a slab id, outliving the slabs that use it.
+  struct record {
+    uint32_t chunk_shift;
+    std::atomic<completion_slot *> chunks[kMaxChunks];
+    // Written by the slab using the id only.
+    size_t nr_chunks;
+  };
+
+  static std::atomic<record *> registry[kMaxSlabs];
+
+  uint32_t id_;
+  record *record_;
+  uint32_t chunk_shift_;
+  bool timed_;
+  spinlock lock_;
+  std::vector<uint32_t> free_;
+
+  void grow_locked();
+
+  completion_slot *slot(uint32_t index) const {
+    auto chunk =
+        record_->chunks[index >> chunk_shift_].load(std::memory_order_acquire);
+    return chunk + (index & ((1U << chunk_shift_) - 1));
+  }
+
+  static completion_slot *lookup(uint64_t wr_id) {
+    auto r = registry[wr_id >> 48].load(std::memory_order_acquire);
+    if (r == nullptr) [[unlikely]] {
+      return nullptr;
+    }
+    auto const index = static_cast<uint32_t>((wr_id >> 2) & 0x3fffffff);
+    if ((index >> r->chunk_shift) >= kMaxChunks) [[unlikely]] {
+      return nullptr;
+    }
+    auto chunk =
+        r->chunks[index >> r->chunk_shift].load(std::memory_order_acquire);
+    if (chunk == nullptr) [[unlikely]] {
+      return nullptr;
+    }
+    return chunk + (index & ((1U << r->chunk_shift) - 1));
+  }
+
+public:
+  /**
+   * @brief Construct a new completion slab and register it for lookups.
+   *
+   * @param chunk_size The number of slots allocated at once, rounded up to a
+   * power of two. The expected number of outstanding operations is a good
+   * choice. A slab reusing the id of a destroyed one keeps its chunk size.
+   */
+  explicit completion_slab(size_t chunk_size);
+
+  /**
+   * @brief Take a free slot for an operation about to be posted.
+   *
+   * @param coroutine_addr The coroutine to resume on completion, or the
+   * context of the handler.
+   * @param handler (Optional) Called on completion instead of resuming
+   * coroutine_addr.
+   * @return completion_slot* The pending slot.
+   */
+  completion_slot *acquire(void *coroutine_addr,
+                           completion_handler handler = nullptr);
+
+  /**
+   * @brief Stamp slots with the tick they are acquired at, which is when
+   * their operation is posted, so that take() can record the latency of the
+   * operation.
+   *
+   * @param timed Whether to time operations.
+   */
+  void set_timed(bool timed) { timed_ = timed; }
+
+  /**
+   * @brief Make a completed slot pending again without giving it back, for
+   * consumers that post the same slot over and over. Its generation changes
+   * like on release.
+   *
+   * @param slot The slot.
+   */
+  void rearm(completion_slot *slot) {
+    auto const state = slot->state.load(std::memory_order_relaxed);
+    slot->state.store(((state | 1) + 1) | 1, std::memory_order_release);
+  }
+
+  /**
+   * @brief Give a slot back. Its generation changes, so late completions
+   * naming it are dropped.
+   *
+   * @param slot The slot.
+   */
+  void release(completion_slot *slot);
+
+  /**
+   * @brief Read the result of a completed slot and give it back. If the
+   * operation was timed, its latency is recorded.
+   *
+   * @param slot The slot.
+   * @param opcode The opcode of the completed operation.
+   * @return completion_result The result.
+   */
+  completion_result take(completion_slot *slot, enum ibv_wc_opcode opcode) {
+    auto const result = slot->result;
+    if (slot->posted_at != 0 && result.completed_at != 0) [[unlikely]] {
+      record_op_latency(opcode, slot->posted_at, result.completed_at, rdtsc());
+    }
+    release(slot);
+    return result;
+  }
+
+  /**
+   * @brief Get the wr_id naming a pending slot.
+   *
+   * @param slot The slot.
+   * @return uint64_t The wr_id.
+   */
+  uint64_t wr_id(completion_slot const *slot) const {
+    auto const generation =
+        slot->state.load(std::memory_order_relaxed) >> 1 & 0xffff;
+    return static_cast<uint64_t>(id_) << 48 |
+           static_cast<uint64_t>(generation) << 32 |
+           static_cast<uint64_t>(slot->index) << 2 | kSlabWrIdTag;
+  }
+
+  /**
+   * @brief Deliver a work completion whose wr_id names a slot.
+   *
+   * @param wc The work completion.
+   * @param completed_at (Optional) The tick of the completion, if known.
+   * @return void* The coroutine to resume, or nullptr if the completion is
+   * stale or a duplicate.
+   */
+  static void *complete(struct ibv_wc const &wc, uint64_t completed_at = 0) {
+    auto slot = lookup(wc.wr_id);
+    if (slot == nullptr) [[unlikely]] {
+      RDMAPP_LOG_DEBUG("ignored completion for unknown wr_id %lx", wc.wr_id);
+      return nullptr;
+    }
+    auto const generation = static_cast<uint32_t>(wc.wr_id >> 32) & 0xffff;
+    auto const state = slot->state.load(std::memory_order_acquire);
+    if ((state >> 1 & 0xffff) != generation) [[unlikely]] {
+      RDMAPP_LOG_DEBUG("ignored stale completion of slot %u", slot->index);
+      return nullptr;
+    }
+    return complete_slot(*slot, wc, completed_at);
+  }
+
+  /**
+   * @brief Prefetch the slot a work completion will be delivered to.
+   *
+   * @param wc The work completion.
+   */
+  static void prefetch(struct ibv_wc const &wc) {
+    if (is_slab_wr_id(wc.wr_id)) {
+      if (auto slot = lookup(wc.wr_id); slot != nullptr) {
+        __builtin_prefetch(slot, 1);
+      }
+    }
+  }
+
+  ~completion_slab();
+};
+
+} // namespace detail
+} // namespace rdmapp
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <pthread.h>
+
+#include "rdmapp/comp_channel.h"
+#include "rdmapp/cq.h"
+
+#include "rdmapp/detail/noncopyable.h"
+
+namespace rdmapp {
+namespace detail {
+
+/**
+ * @brief Lets a poller thread sleep once it has found no completion for a
+ * spin budget. It arms the completion queues, gives the poller one more poll
+ * to close the race with completions that arrived before arming, and then
+ * blocks in epoll on all their channels at once.
+ *
+ * Waiting is disabled unless every completion queue has a channel and the
+ * budget is finite; idle() is then a single branch.
+ *
+ */
+class cq_waiter : public noncopyable {
+public:
+  static constexpr auto kSpinForever = std::chrono::nanoseconds::max();
+
+private:
+  using channel_list = std::vector<std::shared_ptr<comp_channel>>;
+
+  std::vector<std::shared_ptr<cq>> cqs_;
+  // Published by the poller thread, read by wake() on any thread without a
+  // lock. A list replaced by update_cqs() may still be read by a wake(), so
+  // every list is kept until destruction.
+  std::atomic<channel_list const *> channels_;
+  std::vector<std::unique_ptr<channel_list>> channel_lists_;
+  std::chrono::nanoseconds spin_budget_;
+  std::function<bool()> has_work_;
+  int epoll_fd_;
+  // Written by the poller thread only; wake() reads it to return early.
+  std::atomic<bool> enabled_;
+  bool armed_;
+  bool woken_;
+  uint32_t empty_polls_;
+  std::chrono::steady_clock::time_point idle_since_;
+  std::chrono::steady_clock::time_point woken_at_;
+  std::chrono::steady_clock::time_point started_at_;
+  std::atomic<bool> bound_;
+  pthread_t thread_;
+
+  std::atomic<uint64_t> sleeps_;
+  std::atomic<uint64_t> wakeups_;
+  std::atomic<uint64_t> timeouts_;
+  std::atomic<uint64_t> asleep_ns_;
+  std::atomic<uint64_t> max_asleep_ns_;
+  std::atomic<uint64_t> wake_latency_ns_;
+  std::atomic<uint64_t> max_wake_latency_ns_;
+  std::atomic<uint64_t> woken_completions_;
+
+  void setup();
+  void sleep(std::atomic<bool> const &stopped);
+  void on_empty_poll(std::atomic<bool> const &stopped);
+  void record_wake_latency();
+
+public:
+  /**
+   * @brief Construct a new cq waiter.
+   *
+   * @param cqs The completion queues the poller polls.
+   * @param spin_budget How long to spin without completions before sleeping.
+   * kSpinForever never sleeps.
+   * @param has_work (Optional) Returns true if the poller has work besides
+   * completions, in which case it does not sleep.
+   */
+  cq_waiter(std::vector<std::shared_ptr<cq>> const &cqs,
+            std::chrono::nanoseconds spin_budget,
+            std::function<bool()> has_work = nullptr);
+
+  /**
+   * @brief Record the poller thread, for the CPU time in stats(). Called by
+   * the poller thread once it starts.
+   *
+   */
+  void bind_thread();
+
+  /**
+   * @brief Called by the poller after every round over its completion
+   * queues. Sleeps once the spin budget is used up.
+   *
+   * @param progress Whether the round found any completion or work.
+   * @param stopped The stop flag of the poller. Sleeps end when it is set and
+   * wake() is called, or at the latest after a short timeout.
+   */
+  void idle(bool progress, std::atomic<bool> const &stopped) {
+    if (!enabled_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    if (progress) {
+      if (woken_) [[unlikely]] {
+        record_wake_latency();
+      }
+      armed_ = false;
+      empty_polls_ = 0;
+      return;
+    }
+    on_empty_poll(stopped);
+  }
+
+  /**
+   * @brief Checks if the completion queues are armed, in which case the
+   * poller must poll every one of them before the next idle().
+   *
+   * @return true The completion queues are armed.
+   * @return false They are not.
+   */
+  bool armed() const { return armed_; }
+
+  /**
+   * @brief Replace the completion queues to sleep on. Called by the poller
+   * thread, between two rounds.
+   *
+   * @param cqs The completion queues the poller now polls.
+   */
+  void update_cqs(std::vector<std::shared_ptr<cq>> const &cqs);
+
+  /**
+   * @brief Wake the poller if it is sleeping. Only an atomic load when
+   * waiting is disabled. A wake racing with update_cqs() enabling waiting may
+   * be missed, in which case the sleep ends with its short timeout.
+   *
+   */
+  void wake();
+
+  /**
+   * @brief Get the idle statistics of the poller.
+   *
+   * @return wait_stats The statistics.
+   */
+  wait_stats stats() const;
+
+  ~cq_waiter();
+};
+
+} // namespace detail
+} // namespace rdmapp
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "rdmapp/detail/noncopyable.h"
+#include "rdmapp/detail/spinlock.h"
+
+namespace rdmapp {
+namespace detail {
+
+/**
+ * @brief Get the CPUs of a NUMA node that the process may run on.
+ *
+ * @param node The node, or -1 for all nodes.
+ * @return std::vector<int> The CPUs, in ascending order.
+ */
+std::vector<int> node_cpus(int node);
+
+/**
+ * @brief Get the NUMA node of a CPU.
+ *
+ * @param cpu The CPU.
+ * @return int The node, or -1 if unknown.
+ */
+int cpu_node(int cpu);
+
+/**
+ * @brief Pin the calling thread to a CPU.
+ *
+ * @param cpu The CPU.
+ */
+void pin_thread(int cpu);
+
+/**
+ * @brief Map memory whose pages are placed on a NUMA node. If the node has
+ * no free memory, pages fall back to other nodes.
+ *
+ * @param size The size in bytes.
+ * @param node The node, or -1 for the default policy.
+ * @return void* The memory, aligned to a page.
+ */
+void *alloc_on_node(size_t size, int node);
+
+/**
+ * @brief Unmap memory from alloc_on_node().
+ *
+ * @param ptr The memory.
+ * @param size The size it was allocated with.
+ */
+void free_on_node(void *ptr, size_t size);
+
+/**
+ * @brief Allocates coroutine frames from memory on one NUMA node. Frames
+ * are rounded up to a power of two and recycled through free lists; larger
+ * ones go to the global heap. A frame can be freed from any thread.
+ *
+ * Pools are created with new and given up with release(), as frames of
+ * detached coroutines may outlive their owner: the pool is deleted when
+ * both the owner and the last frame are gone.
+ *
+ */
+class frame_pool : public noncopyable {
+public:
+  static constexpr size_t kMinFrameShift = 6;
+  static constexpr size_t kNrSizeClasses = 8;
+
+private:
+  int node_;
+  spinlock lock_;
+  std::array<void *, kNrSizeClasses> free_lists_;
+  std::vector<void *> chunks_;
+  char *bump_;
+  char *bump_end_;
+  // Live frames, plus one for the owner.
+  std::atomic<size_t> refs_;
+
+  ~frame_pool();
+
+public:
+  /**
+   * @brief Construct a new frame pool. Memory is mapped on first use.
+   *
+   * @param node The NUMA node to place frames on.
+   */
+  explicit frame_pool(int node);
+
+  /**
+   * @brief Allocate a frame.
+   *
+   * @param size_class The size class, its size being 1 << (size_class +
+   * kMinFrameShift).
+   * @return void* The frame.
+   */
+  void *allocate(size_t size_class);
+
+  /**
+   * @brief Give a frame back.
+   *
+   * @param ptr The frame.
+   * @param size_class Its size class.
+   */
+  void deallocate(void *ptr, size_t size_class);
+
+  /**
+   * @brief Get the pool frames of the calling thread are allocated from.
+   *
+   * @return frame_pool*& The pool, nullptr for the global heap.
+   */
+  static frame_pool *&current();
+
+  /**
+   * @brief Give up the pool. Its memory is unmapped once no frame is left.
+   *
+   */
+  void release();
+};
+
+/**
+ * @brief Allocate a coroutine frame from the pool of the calling thread.
+ *
+ * @param size The size of the frame.
+ * @return void* The frame.
+ */
+void *allocate_frame(size_t size);
+
+/**
+ * @brief Free a coroutine frame from allocate_frame(), on any thread.
+ *
+ * @param ptr The frame.
+ */
+void deallocate_frame(void *ptr);
+
+} // namespace detail
+} // namespace rdmapp
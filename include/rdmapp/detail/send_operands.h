@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/mr.h"
+
+namespace rdmapp {
+namespace detail {
+
+/**
+ * @brief The operands of a send work request besides its local buffers. It is
+ * specialized per opcode, so that an awaitable only carries what its
+ * operation needs, and patches them into a work request whose opcode is
+ * already known at compile time.
+ *
+ * @tparam Opcode The opcode of the work request.
+ */
+template <enum ibv_wr_opcode Opcode> struct send_operands;
+
+template <> struct send_operands<IBV_WR_SEND> {
+  void apply(struct ibv_send_wr &) const {}
+};
+
+/**
+ * @brief The remote side of an RDMA read or write.
+ *
+ */
+struct rdma_operands {
+  uint64_t remote_addr;
+  uint32_t rkey;
+
+  rdma_operands(remote_mr const &remote_mr)
+      : remote_addr(reinterpret_cast<uint64_t>(remote_mr.addr())),
+        rkey(remote_mr.rkey()) {
+    assert(remote_mr.addr() != nullptr);
+  }
+
+  void apply(struct ibv_send_wr &send_wr) const {
+    send_wr.wr.rdma.remote_addr = remote_addr;
+    send_wr.wr.rdma.rkey = rkey;
+  }
+};
+
+template <> struct send_operands<IBV_WR_RDMA_WRITE> : rdma_operands {
+  using rdma_operands::rdma_operands;
+};
+
+template <> struct send_operands<IBV_WR_RDMA_READ> : rdma_operands {
+  using rdma_operands::rdma_operands;
+};
+
+template <> struct send_operands<IBV_WR_RDMA_WRITE_WITH_IMM> {
+  // Flattened rather than derived from rdma_operands, so that the immediate
+  // value fits in the tail padding.
+  uint64_t remote_addr;
+  uint32_t rkey;
+  uint32_t imm;
+
+  send_operands(remote_mr const &remote_mr, uint32_t imm)
+      : remote_addr(reinterpret_cast<uint64_t>(remote_mr.addr())),
+        rkey(remote_mr.rkey()), imm(imm) {
+    assert(remote_mr.addr() != nullptr);
+  }
+
+  void apply(struct ibv_send_wr &send_wr) const {
+    send_wr.wr.rdma.remote_addr = remote_addr;
+    send_wr.wr.rdma.rkey = rkey;
+    send_wr.imm_data = imm;
+  }
+};
+
+/**
+ * @brief The remote side and the operand of an atomic operation.
+ *
+ */
+struct atomic_operands {
+  uint64_t remote_addr;
+  uint64_t compare_add;
+  uint32_t rkey;
+
+  atomic_operands(remote_mr const &remote_mr, uint64_t compare_add)
+      : remote_addr(reinterpret_cast<uint64_t>(remote_mr.addr())),
+        compare_add(compare_add), rkey(remote_mr.rkey()) {
+    assert(remote_mr.addr() != nullptr);
+  }
+
+  void apply(struct ibv_send_wr &send_wr) const {
+    send_wr.wr.atomic.remote_addr = remote_addr;
+    send_wr.wr.atomic.compare_add = compare_add;
+    send_wr.wr.atomic.rkey = rkey;
+  }
+};
+
+template <>
+struct send_operands<IBV_WR_ATOMIC_FETCH_AND_ADD> : atomic_operands {
+  using atomic_operands::atomic_operands;
+};
+
+template <>
+struct send_operands<IBV_WR_ATOMIC_CMP_AND_SWP> : atomic_operands {
+  uint64_t swap;
+
+  send_operands(remote_mr const &remote_mr, uint64_t compare, uint64_t swap)
+      : atomic_operands(remote_mr, compare), swap(swap) {}
+
+  void apply(struct ibv_send_wr &send_wr) const {
+    atomic_operands::apply(send_wr);
+    send_wr.wr.atomic.swap = swap;
+  }
+};
+
+} // namespace detail
+} // namespace rdmapp
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+namespace rdmapp {
+namespace detail {
+
+/**
+ * @brief A test-and-test-and-set spinlock for short critical sections on the
+ * posting path. It satisfies Lockable so it can be used with std::lock_guard.
+ *
+ */
+class spinlock {
+  std::atomic<bool> locked_{false};
+
+public:
+  void lock() noexcept {
+    while (locked_.exchange(true, std::memory_order_acquire)) {
+      while (locked_.load(std::memory_order_relaxed)) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  bool try_lock() noexcept {
+    return !locked_.load(std::memory_order_relaxed) &&
+           !locked_.exchange(true, std::memory_order_acquire);
+  }
+
+  void unlock() noexcept { locked_.store(false, std::memory_order_release); }
+};
+
+} // namespace detail
+} // namespace rdmapp
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace rdmapp {
+namespace detail {
+
+/**
+ * @brief Read the time stamp counter. On other architectures than x86 this
+ * is the steady clock in nanoseconds.
+ *
+ * @return uint64_t The current tick, never 0.
+ */
+static inline uint64_t rdtsc() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc() | 1;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+             .count() |
+         1;
+#endif
+}
+
+/**
+ * @brief Get the length of a tick of rdtsc(). It is calibrated against the
+ * steady clock the first time it is called, which takes a few milliseconds.
+ *
+ * @return double The length of a tick in nanoseconds.
+ */
+double tsc_ns_per_tick();
+
+} // namespace detail
+} // namespace rdmapp
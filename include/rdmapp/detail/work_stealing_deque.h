@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "rdmapp/detail/noncopyable.h"
+
+namespace rdmapp {
+namespace detail {
+
+/**
+ * @brief A Chase-Lev work-stealing deque (Le et al., "Correct and Efficient
+ * Work-Stealing for Weak Memory Models"). The owner thread pushes and pops at
+ * the bottom without atomic read-modify-writes except when racing for the
+ * last element, so it runs newest first; other threads steal the oldest from
+ * the top. The buffer grows when full.
+ *
+ * @tparam T A trivially copyable element, usually a pointer.
+ */
+template <class T> class work_stealing_deque : public noncopyable {
+  struct ring {
+    int64_t mask;
+    std::unique_ptr<std::atomic<T>[]> slots;
+
+    explicit ring(size_t capacity)
+        : mask(static_cast<int64_t>(capacity) - 1),
+          slots(new std::atomic<T>[capacity]) {}
+
+    T load(int64_t i) const {
+      return slots[i & mask].load(std::memory_order_relaxed);
+    }
+
+    void store(int64_t i, T value) {
+      slots[i & mask].store(value, std::memory_order_relaxed);
+    }
+  };
+
+  alignas(64) std::atomic<int64_t> top_;
+  alignas(64) std::atomic<int64_t> bottom_;
+  std::atomic<ring *> ring_;
+  // Owned by the owner thread. Outgrown rings are kept until destruction, as
+  // a thief may still be reading from them.
+  std::vector<std::unique_ptr<ring>> rings_;
+
+  ring *grow(ring *old, int64_t top, int64_t bottom) {
+    auto bigger = std::make_unique<ring>(2 * (old->mask + 1));
+    for (auto i = top; i < bottom; ++i) {
+      bigger->store(i, old->load(i));
+    }
+    auto r = bigger.get();
+    rings_.push_back(std::move(bigger));
+    ring_.store(r, std::memory_order_release);
+    return r;
+  }
+
+public:
+  /**
+   * @brief Construct a new work stealing deque.
+   *
+   * @param capacity The initial capacity, rounded up to a power of 2.
+   */
+  explicit work_stealing_deque(size_t capacity = 256) : top_(0), bottom_(0) {
+    size_t pow2 = 2;
+    while (pow2 < capacity) {
+      pow2 *= 2;
+    }
+    rings_.push_back(std::make_unique<ring>(pow2));
+    ring_.store(rings_.back().get(), std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Push an element at the bottom. Owner thread only.
+   *
+   * @param value The element.
+   */
+  void push(T value) {
+    auto const bottom = bottom_.load(std::memory_order_relaxed);
+    auto const top = top_.load(std::memory_order_acquire);
+    auto r = ring_.load(std::memory_order_relaxed);
+    if (bottom - top > r->mask) [[unlikely]] {
+      r = grow(r, top, bottom);
+    }
+    r->store(bottom, value);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Pop the most recently pushed element. Owner thread only.
+   *
+   * @param value Set to the element, if any.
+   * @return true An element was popped.
+   * @return false The deque is empty.
+   */
+  bool pop(T &value) {
+    auto const bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    auto r = ring_.load(std::memory_order_relaxed);
+    bottom_.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto top = top_.load(std::memory_order_relaxed);
+    if (top > bottom) {
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+      return false;
+    }
+    value = r->load(bottom);
+    if (top != bottom) {
+      return true;
+    }
+    // The last element: race the thieves for it.
+    auto const won = top_.compare_exchange_strong(
+        top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+    return won;
+  }
+
+  /**
+   * @brief Steal the least recently pushed element. Any thread.
+   *
+   * @param value Set to the element, if any.
+   * @return true An element was stolen.
+   * @return false The deque is empty or another thread won the element.
+   */
+  bool steal(T &value) {
+    auto top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto const bottom = bottom_.load(std::memory_order_acquire);
+    if (top >= bottom) {
+      return false;
+    }
+    auto r = ring_.load(std::memory_order_acquire);
+    value = r->load(top);
+    return top_.compare_exchange_strong(top, top + 1,
+                                        std::memory_order_seq_cst,
+                                        std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Get the number of elements. Only a hint when called by a thief.
+   *
+   * @return size_t The number of elements.
+   */
+  size_t size() const {
+    auto const bottom = bottom_.load(std::memory_order_relaxed);
+    auto const top = top_.load(std::memory_order_relaxed);
+    return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+  }
+};
+
+} // namespace detail
+} // namespace rdmapp
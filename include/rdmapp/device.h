@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <iterator>
+#include <optional>
 #include <string>
 
 #include <infiniband/verbs.h>
@@ -57,7 +58,10 @@ class device : public noncopyable {
   friend class pd;
   friend class cq;
   friend class qp;
+  friend class ud_qp;
   friend class srq;
+  friend class async_event_poller;
+  friend class comp_channel;
   void open_device(struct ibv_device *target, uint16_t port_num);
 
 public:
@@ -124,6 +128,41 @@ public:
 
   int gid_index() const;
 
+  /**
+   * @brief Get the attributes of the port in use, including its active MTU.
+   *
+   * @return struct ibv_port_attr const& The port attributes.
+   */
+  struct ibv_port_attr const &port_attr() const;
+
+  /**
+   * @brief Get the capabilities of the device, such as its maximum queue
+   * depths and SGE counts.
+   *
+   * @return struct ibv_device_attr const& The device attributes.
+   */
+  struct ibv_device_attr const &device_attr() const;
+
+  /**
+   * @brief Read a counter of the port in use from sysfs, such as
+   * out_of_buffer (receives dropped for lack of a posted buffer) or
+   * rnr_nak_retry_err. Hardware counters are looked up first, then the
+   * standard port counters.
+   *
+   * @param name The name of the counter.
+   * @return std::optional<uint64_t> The value, or nothing if the device does
+   * not expose the counter.
+   */
+  std::optional<uint64_t> port_counter(std::string const &name) const;
+
+  /**
+   * @brief Get the NUMA node the device is attached to, as reported by
+   * sysfs. Pollers and their memory are best placed on that node.
+   *
+   * @return int The node, or -1 if unknown.
+   */
+  int numa_node() const;
+
   static std::string gid_hex_string(union ibv_gid const &gid);
 
   ~device();
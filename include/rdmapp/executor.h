@@ -1,25 +1,95 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <stdexcept>
 #include <thread>
 #include <vector>
 
 #include <infiniband/verbs.h>
 
-#include "rdmapp/detail/blocking_queue.h"
-#include "rdmapp/detail/concurrent_queue.h"
+#include "rdmapp/detail/noncopyable.h"
+#include "rdmapp/detail/spinlock.h"
+#include "rdmapp/detail/work_stealing_deque.h"
 
 namespace rdmapp {
 
+/**
+ * @brief How an executor spreads the completions handed to it by pollers
+ * over its workers.
+ *
+ */
+enum class executor_policy {
+  // Every poller thread cycles through the workers.
+  round_robin,
+  // The completions of a Queue Pair always go to the same worker, so that
+  // its coroutines stay on a warm core.
+  by_qp,
+};
+
+/**
+ * @brief What the workers of an executor did.
+ *
+ */
+struct executor_stats {
+  // Coroutines resumed.
+  uint64_t executed;
+  // Coroutines taken from the LIFO slot of the worker that scheduled them.
+  uint64_t lifo;
+  // Coroutines taken from another worker.
+  uint64_t stolen;
+  // Times a worker went to sleep for lack of work.
+  uint64_t parks;
+};
+
 /**
  * @brief This class is used to execute callbacks of completion entries.
+ * Every worker owns a work-stealing deque fed through its inbox; idle workers
+ * steal from the others, so that pollers and workers never contend on a
+ * single queue head.
  *
  */
-class executor {
-  using work_queue = detail::ConcurrentQueue<void*>;
-  std::vector<std::jthread> workers_;
-  std::shared_ptr<work_queue> work_queue_;
+class executor : public noncopyable {
+  // Consecutive runs from the LIFO slot before the inbox is looked at.
+  static constexpr uint32_t kLifoBudget = 16;
+  // Rounds of stealing attempts before a worker sleeps.
+  static constexpr uint32_t kIdleSpins = 64;
+
+  struct worker {
+    // Popped at the bottom by its owner, stolen from the top by the others.
+    detail::work_stealing_deque<void *> deque;
+    // Owner only: the coroutine scheduled last from this worker, run next.
+    void *lifo_slot;
+    uint32_t lifo_streak;
+    alignas(64) detail::spinlock inbox_lock;
+    std::vector<void *> inbox;
+    std::atomic<bool> has_inbox;
+    // Owner only: swapped with the inbox to drain it without allocating.
+    std::vector<void *> drained;
+    alignas(64) std::atomic<uint64_t> executed;
+    std::atomic<uint64_t> lifo;
+    std::atomic<uint64_t> stolen;
+    std::atomic<uint64_t> parks;
+    std::jthread thread;
+
+    worker()
+        : lifo_slot(nullptr), lifo_streak(0), has_inbox(false), executed(0),
+          lifo(0), stolen(0), parks(0) {}
+  };
+
+  executor_policy policy_;
+  std::vector<std::unique_ptr<worker>> workers_;
+  std::atomic<bool> closed_;
+  alignas(64) std::atomic<uint32_t> epoch_;
+  std::atomic<uint32_t> sleepers_;
   void worker_fn(size_t worker_id);
+  void *next_work(worker &self, size_t worker_id);
+  void *steal(size_t worker_id);
+  bool has_work() const;
+  void enqueue(size_t worker_id, void *h_ptr);
+  void notify();
 
 public:
   class closed_exception : public std::runtime_error {
@@ -33,16 +103,36 @@ public:
    * @brief Construct a new executor object
    *
    * @param nr_worker The number of worker threads to use.
+   * @param policy (Optional) How completions are spread over the workers.
    */
-  executor(size_t nr_worker = 4);
+  executor(size_t nr_worker = 4,
+           executor_policy policy = executor_policy::round_robin);
 
   /**
-   * @brief Process a completion entry.
+   * @brief Process a completion entry. Called from a worker, the coroutine
+   * goes to the LIFO slot of that worker and runs next; otherwise it goes to
+   * the next worker in turn.
    *
-   * @param wc The completion entry to process.
+   * @param h_ptr The address of the coroutine to resume.
    */
   void process_wc(void* h_ptr);
 
+  /**
+   * @brief Process a completion entry of a Queue Pair. Under the by_qp
+   * policy, its worker is chosen by the QPN.
+   *
+   * @param h_ptr The address of the coroutine to resume.
+   * @param qp_num The QPN of the Queue Pair that completed.
+   */
+  void process_wc(void *h_ptr, uint32_t qp_num);
+
+  /**
+   * @brief Get what the workers did so far.
+   *
+   * @return executor_stats The statistics summed over all workers.
+   */
+  executor_stats stats() const;
+
   /**
    * @brief Shutdown the executor.
    *
@@ -71,4 +161,4 @@ public:
   static void destroy_callback(callback_ptr cb);
 };
 
-} // namespace rdmapp
\ No newline at end of file
+} // namespace rdmapp
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "rdmapp/detail/noncopyable.h"
+
+namespace rdmapp {
+
+/**
+ * @brief A copy of a histogram. Buckets are logarithmic with 16 sub-buckets
+ * per power of two, so values are kept within 1/16 of their magnitude.
+ *
+ */
+struct histogram_snapshot {
+  static constexpr uint32_t kSubBucketBits = 4;
+  static constexpr uint32_t kSubBuckets = 1 << kSubBucketBits;
+  static constexpr size_t kBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  std::vector<uint64_t> counts;
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+
+  /**
+   * @brief Get the bucket a value falls into.
+   *
+   * @param value The value.
+   * @return size_t The index of the bucket.
+   */
+  static size_t bucket_of(uint64_t value) {
+    if (value < kSubBuckets) {
+      return value;
+    }
+    auto const exponent = static_cast<uint32_t>(std::bit_width(value)) - 1;
+    auto const shift = exponent - kSubBucketBits;
+    return (shift + 1) * kSubBuckets + ((value >> shift) & (kSubBuckets - 1));
+  }
+
+  /**
+   * @brief Get the smallest value of a bucket.
+   *
+   * @param bucket The index of the bucket.
+   * @return uint64_t The smallest value.
+   */
+  static uint64_t lowest_of(size_t bucket) {
+    if (bucket < 2 * kSubBuckets) {
+      return bucket;
+    }
+    auto const shift = bucket / kSubBuckets - 1;
+    return (kSubBuckets | (bucket % kSubBuckets)) << shift;
+  }
+
+  /**
+   * @brief Get the value below which a fraction of the recorded values fall.
+   *
+   * @param quantile The fraction, between 0 and 1.
+   * @return uint64_t The lowest value of the bucket holding the quantile.
+   */
+  uint64_t percentile(double quantile) const;
+
+  /**
+   * @brief Get the mean of the recorded values.
+   *
+   * @return double The mean, or 0 if nothing was recorded.
+   */
+  double mean() const;
+
+  /**
+   * @brief Get what was recorded since an earlier snapshot of the same
+   * histogram. The maximum is kept as is.
+   *
+   * @param earlier The earlier snapshot.
+   * @return histogram_snapshot The difference.
+   */
+  histogram_snapshot since(histogram_snapshot const &earlier) const;
+};
+
+namespace detail {
+
+/**
+ * @brief A histogram written by a single thread and read by any. Writes are
+ * relaxed loads and stores, without read-modify-write instructions or locks,
+ * so the writer never waits and never bounces a cache line it does not own.
+ *
+ */
+class log_histogram : public noncopyable {
+  std::array<std::atomic<uint64_t>, histogram_snapshot::kBuckets> counts_;
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> max_;
+
+  static void bump(std::atomic<uint64_t> &counter, uint64_t delta) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta,
+                  std::memory_order_relaxed);
+  }
+
+public:
+  log_histogram();
+
+  /**
+   * @brief Record a value. Must only be called by the owning thread.
+   *
+   * @param value The value.
+   */
+  void record(uint64_t value) {
+    bump(counts_[histogram_snapshot::bucket_of(value)], 1);
+    bump(count_, 1);
+    bump(sum_, value);
+    if (value > max_.load(std::memory_order_relaxed)) {
+      max_.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  histogram_snapshot snapshot() const;
+};
+
+} // namespace detail
+} // namespace rdmapp
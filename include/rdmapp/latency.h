@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/histogram.h"
+
+namespace rdmapp {
+
+/**
+ * @brief The latency of the operations of one opcode, split at their
+ * completion. Operations are only timed on Queue Pairs whose completion
+ * queues were created with timestamps.
+ *
+ */
+struct op_latency {
+  enum ibv_wc_opcode opcode;
+  // Nanoseconds from posting to the completion: the NIC and the wire, and
+  // with software timestamps also the time until the completion was polled.
+  histogram_snapshot device_ns;
+  // Nanoseconds from the completion to the resumption of the awaiter: the
+  // poller and executor queueing.
+  histogram_snapshot queueing_ns;
+  // Nanoseconds from posting to the resumption.
+  histogram_snapshot total_ns;
+};
+
+/**
+ * @brief Get the latency breakdown of every opcode timed so far, merged over
+ * all threads. It can be called at any time from any thread.
+ *
+ * @return std::vector<op_latency> The opcodes with at least one sample.
+ */
+std::vector<op_latency> op_latencies();
+
+namespace detail {
+
+/**
+ * @brief Get the opcode of the work completion of a send work request.
+ *
+ * @param opcode The opcode of the work request.
+ * @return enum ibv_wc_opcode The opcode of its work completion.
+ */
+constexpr enum ibv_wc_opcode wc_opcode_of(enum ibv_wr_opcode opcode) {
+  switch (opcode) {
+  case IBV_WR_RDMA_WRITE:
+  case IBV_WR_RDMA_WRITE_WITH_IMM:
+    return IBV_WC_RDMA_WRITE;
+  case IBV_WR_RDMA_READ:
+    return IBV_WC_RDMA_READ;
+  case IBV_WR_ATOMIC_CMP_AND_SWP:
+    return IBV_WC_COMP_SWAP;
+  case IBV_WR_ATOMIC_FETCH_AND_ADD:
+    return IBV_WC_FETCH_ADD;
+  default:
+    return IBV_WC_SEND;
+  }
+}
+
+/**
+ * @brief Record the timestamps of an operation. Called by the awaiter when
+ * it resumes; the samples go to histograms owned by the calling thread.
+ *
+ * @param opcode The opcode of the operation.
+ * @param posted_at The tick it was posted at.
+ * @param completed_at The tick it completed at.
+ * @param resumed_at The tick its awaiter resumed at.
+ */
+void record_op_latency(enum ibv_wc_opcode opcode, uint64_t posted_at,
+                       uint64_t completed_at, uint64_t resumed_at);
+
+} // namespace detail
+} // namespace rdmapp
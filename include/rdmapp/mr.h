@@ -141,21 +141,21 @@ public:
    *
    * @return void* The address of the remote memory region.
    */
-  void *addr();
+  void *addr() const;
 
   /**
    * @brief Get the length of the remote memory region.
    *
    * @return uint32_t The length of the remote memory region.
    */
-  uint32_t length();
+  uint32_t length() const;
 
   /**
    * @brief Get the remote key of the memory region.
    *
    * @return uint32_t The remote key of the memory region.
    */
-  uint32_t rkey();
+  uint32_t rkey() const;
 
   /**
    * @brief Deserialize a remote memory region handle.
@@ -176,4 +176,16 @@ public:
 using local_mr = mr<tags::mr::local>;
 using remote_mr = mr<tags::mr::remote>;
 
+/**
+ * @brief A byte range of a registered local memory region. A span of segments
+ * forms the scatter/gather list of a single work request, so that
+ * non-contiguous buffers can be sent or received without copying.
+ *
+ */
+struct local_mr_segment {
+  local_mr const *mr;
+  size_t offset;
+  size_t length;
+};
+
 } // namespace rdmapp
\ No newline at end of file
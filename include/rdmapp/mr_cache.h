@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/mr.h"
+
+#include "rdmapp/detail/noncopyable.h"
+
+namespace rdmapp {
+
+class pd;
+
+/**
+ * @brief Counters of a memory registration cache.
+ *
+ */
+struct mr_cache_stats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  size_t entries;
+  size_t registered_bytes;
+};
+
+/**
+ * @brief This class caches memory registrations of raw buffers, so that
+ * repeated operations on the same buffers reuse one ibv_mr instead of
+ * registering and deregistering it every time.
+ *
+ * Cached ranges are page aligned and never overlap: a miss that overlaps
+ * cached ranges registers their union and replaces them. Ranges in use are
+ * reference counted. Unused ranges are kept in LRU order and evicted once the
+ * registered bytes exceed the capacity.
+ *
+ * A cached registration keeps pinning the pages it was created for. If a
+ * cached buffer is unmapped and the address range reused, invalidate it first.
+ *
+ */
+class mr_cache : public noncopyable {
+  struct entry {
+    local_mr mr;
+    uintptr_t begin;
+    uintptr_t end;
+    size_t refs;
+    bool indexed;
+    std::list<entry *>::iterator lru_it;
+  };
+
+  struct ibv_pd *pd_;
+  int flags_;
+  size_t capacity_;
+  std::mutex mutex_;
+  std::map<uintptr_t, entry *> index_;
+  std::list<entry *> lru_;
+  uint64_t hits_;
+  uint64_t misses_;
+  uint64_t evictions_;
+  size_t registered_bytes_;
+
+  /**
+   * @brief Removes an entry from the index. It is destroyed right away if
+   * unused, or when its last user releases it. The caller must hold mutex_.
+   *
+   * @param it The index position of the entry.
+   * @return std::map<uintptr_t, entry *>::iterator The next index position.
+   */
+  std::map<uintptr_t, entry *>::iterator
+  unindex_locked(std::map<uintptr_t, entry *>::iterator it);
+
+  /**
+   * @brief Evicts unused entries, least recently used first, until the
+   * registered bytes fit the capacity. The caller must hold mutex_.
+   *
+   */
+  void evict_locked();
+
+  /**
+   * @brief Deregisters and frees an entry. The caller must hold mutex_.
+   *
+   * @param e The entry.
+   */
+  void destroy_locked(entry *e);
+
+  /**
+   * @brief Drops a reference taken by acquire.
+   *
+   * @param e The entry.
+   */
+  void release(entry *e);
+
+public:
+  /**
+   * @brief Construct a new mr cache object.
+   *
+   * @param pd The protection domain to register memory in.
+   * @param capacity The number of registered bytes above which unused
+   * registrations are evicted.
+   * @param flags The access flags of the registrations.
+   */
+  mr_cache(struct ibv_pd *pd, size_t capacity,
+           int flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE |
+                       IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_ATOMIC);
+
+  /**
+   * @brief Get a registration covering a buffer, registering it on a miss.
+   * The registration may start before and end after the buffer.
+   *
+   * @param owner The protection domain owning this cache. The returned handle
+   * keeps it alive.
+   * @param addr The address of the buffer.
+   * @param length The length of the buffer.
+   * @return std::shared_ptr<local_mr> The registration. It is released back to
+   * the cache when the last copy is destroyed.
+   */
+  std::shared_ptr<local_mr> acquire(std::shared_ptr<pd> owner, void *addr,
+                                    size_t length);
+
+  /**
+   * @brief Drop all cached registrations overlapping a range. Registrations
+   * still in use are deregistered once released.
+   *
+   * @param addr The address of the range.
+   * @param length The length of the range.
+   */
+  void invalidate(void *addr, size_t length);
+
+  /**
+   * @brief Get the cache counters.
+   *
+   * @return mr_cache_stats The counters.
+   */
+  mr_cache_stats stats();
+
+  ~mr_cache();
+};
+
+} // namespace rdmapp
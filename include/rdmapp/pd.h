@@ -4,8 +4,10 @@
 
 #include <infiniband/verbs.h>
 
+#include "rdmapp/buffer_pool.h"
 #include "rdmapp/device.h"
 #include "rdmapp/mr.h"
+#include "rdmapp/mr_cache.h"
 
 #include "rdmapp/detail/noncopyable.h"
 
@@ -13,6 +15,36 @@ namespace rdmapp {
 
 class qp;
 
+/**
+ * @brief Creation-time attributes of a Protection Domain.
+ *
+ */
+struct pd_config {
+  /**
+   * @brief If non-zero, registrations of raw buffers made by the Queue Pair
+   * overloads taking a pointer are cached, and unused ones are evicted above
+   * this many registered bytes. See mr_cache for the caveats.
+   *
+   */
+  size_t mr_cache_capacity = 0;
+
+  /**
+   * @brief Outgoing payloads of unregistered memory up to this size are copied
+   * into pre-registered bounce buffers instead of being registered. The
+   * pool holds bounce_buffers_per_class buffers of every power of two up to
+   * the threshold, e.g. about 0.5MB for 1024 bytes and 256 buffers. 0, the
+   * default, disables the bounce buffers.
+   *
+   */
+  size_t bounce_threshold = 0;
+
+  /**
+   * @brief The number of bounce buffers of every size class.
+   *
+   */
+  size_t bounce_buffers_per_class = 256;
+};
+
 /**
  * @brief This class is an abstraction of a Protection Domain.
  *
@@ -20,16 +52,22 @@ class qp;
 class pd : public noncopyable, public std::enable_shared_from_this<pd> {
   std::shared_ptr<device> device_;
   struct ibv_pd *pd_;
+  std::unique_ptr<mr_cache> mr_cache_;
+  std::unique_ptr<buffer_pool> bounce_pool_;
   friend class qp;
+  friend class ud_qp;
   friend class srq;
+  friend class recv_ring;
 
 public:
   /**
    * @brief Construct a new pd object
    *
    * @param device The device to use.
+   * @param config (Optional) The registration cache and bounce buffer
+   * settings.
    */
-  pd(std::shared_ptr<device> device);
+  pd(std::shared_ptr<device> device, pd_config const &config = {});
 
   /**
    * @brief Get the device object pointer.
@@ -50,6 +88,46 @@ public:
                   int flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE |
                               IBV_ACCESS_REMOTE_READ |
                               IBV_ACCESS_REMOTE_ATOMIC);
+
+  /**
+   * @brief Register a raw buffer for a single operation. The registration is
+   * served from the registration cache if it is enabled, in which case it may
+   * cover more than the buffer.
+   *
+   * @param addr The address of the buffer.
+   * @param length The length of the buffer.
+   * @return std::shared_ptr<local_mr> The registration.
+   */
+  std::shared_ptr<local_mr> reg_mr_cached(void *addr, size_t length);
+
+  /**
+   * @brief Copy an outgoing payload into a bounce buffer.
+   *
+   * @param addr The address of the payload.
+   * @param length The length of the payload.
+   * @return buffer_pool::buffer The bounce buffer holding a copy of the
+   * payload. It is empty if the payload is above the bounce threshold or no
+   * buffer is free, in which case the payload has to be registered.
+   */
+  buffer_pool::buffer bounce(void const *addr, size_t length);
+
+  /**
+   * @brief Drop cached registrations overlapping a range, e.g. before the
+   * range is unmapped. Does nothing if the cache is disabled.
+   *
+   * @param addr The address of the range.
+   * @param length The length of the range.
+   */
+  void invalidate_mr_cache(void *addr, size_t length);
+
+  /**
+   * @brief Get the counters of the registration cache. They are all zero if
+   * the cache is disabled.
+   *
+   * @return mr_cache_stats The counters.
+   */
+  mr_cache_stats cache_stats() const;
+
   /**
    * @brief Destroy the pd object and the associated protection domain.
    *
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace rdmapp {
+
+/**
+ * @brief The number of completion entries a poller asks for at a time. A
+ * single size is fixed; with a range, the poller grows the batch while polls
+ * come back full and shrinks it while they come back mostly empty, trading
+ * latency at low load for throughput at high load.
+ *
+ */
+struct poll_batch {
+  size_t min;
+  size_t max;
+
+  poll_batch(size_t size) : min(size), max(size) {}
+  poll_batch(size_t min, size_t max)
+      : min(std::max<size_t>(min, 1)), max(std::max(min, max)) {}
+};
+
+namespace detail {
+
+/**
+ * @brief Sizes the batches of a poller within a poll_batch range.
+ *
+ */
+class batch_sizer {
+  // Polls in a row under a quarter full before the batch shrinks.
+  static constexpr uint32_t kShrinkAfter = 64;
+
+  size_t min_;
+  size_t max_;
+  size_t size_;
+  uint32_t low_streak_;
+
+public:
+  explicit batch_sizer(poll_batch batch)
+      : min_(batch.min), max_(batch.max), size_(batch.min), low_streak_(0) {}
+
+  /**
+   * @brief Get the size of the next batch.
+   *
+   * @return size_t The number of completion entries to poll.
+   */
+  size_t size() const { return size_; }
+
+  /**
+   * @brief Get the largest batch, which buffers must be sized for.
+   *
+   * @return size_t The number of completion entries.
+   */
+  size_t max() const { return max_; }
+
+  /**
+   * @brief Record the result of a poll.
+   *
+   * @param nr_wc The number of completion entries it returned.
+   */
+  void update(size_t nr_wc) {
+    if (nr_wc == size_) {
+      size_ = std::min(size_ * 2, max_);
+      low_streak_ = 0;
+    } else if (nr_wc * 4 < size_) {
+      if (++low_streak_ >= kShrinkAfter) {
+        size_ = std::max(size_ / 2, min_);
+        low_streak_ = 0;
+      }
+    } else {
+      low_streak_ = 0;
+    }
+  }
+};
+
+} // namespace detail
+} // namespace rdmapp
@@ -1,14 +1,22 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 #include <infiniband/verbs.h>
 
 #include "rdmapp/cq.h"
-// #include "rdmapp/detail/concurrent_queue.h"
+#include "rdmapp/cq_scheduler.h"
+#include "rdmapp/poll_batch.h"
+#include "rdmapp/poller_metrics.h"
+
+#include "rdmapp/detail/cq_waiter.h"
+#include "rdmapp/detail/bounded_queue.h"
 
 namespace rdmapp {
 
@@ -17,16 +25,27 @@ namespace rdmapp {
  *
  */
 class poll_executor {
-  using work_queue = detail::ConcurrentQueue<void*>;
-  std::shared_ptr<work_queue> work_queue_;
+  static constexpr size_t kWorkQueueSize = 4096;
+  // Coroutines taken from the work queue at a time.
+  static constexpr size_t kWorkBatch = 32;
+  // Coroutines handed over by any thread, resumed by the worker thread.
+  detail::mpsc_queue<void *> work_queue_;
+  // Coroutines that did not fit in the work queue, resumed after it.
+  std::mutex work_overflow_mutex_;
+  std::vector<void *> work_overflow_;
+  std::atomic<bool> has_work_overflow_;
   std::atomic<bool> listening_work_queue_;
-  std::vector<std::shared_ptr<cq>> send_cqs_;
-  std::vector<std::shared_ptr<cq>> recv_cqs_;
   std::atomic<bool> connected_;
   std::atomic<bool> stopped_;
   std::jthread worker_thread_;
   std::vector<struct ibv_wc> wc_vec_;
+  detail::batch_sizer batch_;
+  cq_scheduler scheduler_;
+  detail::cq_waiter waiter_;
+  detail::poller_metrics metrics_;
   void work();
+  bool resume_work();
+  void flush_sends();
 
 public:
   class closed_exception : public std::runtime_error {
@@ -38,16 +57,70 @@ public:
   void connect_done();
   void enable_listening_work_queue();
   void disable_listening_work_queue();
+  /**
+   * @brief Hand a coroutine over to the worker thread, which resumes it once
+   * listening to the work queue. Never blocks.
+   *
+   * @param h_ptr The address of the coroutine.
+   * @throws closed_exception The executor has stopped.
+   */
   void work_enqueue(void* h_ptr);
   /**
    * @brief Construct a new cq poller object. A new executor will be created.
    *
    * @param cq The completion queue to poll.
-   * @param batch_size The number of completion entries to poll at a time.
+   * @param batch_size The number of completion entries to poll at a time,
+   * or a range to adapt it within (see poll_batch).
+   * @param spin_budget (Optional) How long to spin without completions or
+   * queued work before sleeping on the completion channels of the cqs. Never
+   * sleeps by default or if a cq has no channel.
    */
   poll_executor(std::vector<std::shared_ptr<cq>>& send_cqs, 
                 std::vector<std::shared_ptr<cq>>& recv_cqs,
-                size_t batch_size = 16);
+                poll_batch batch_size = 16,
+                std::chrono::nanoseconds spin_budget =
+                    detail::cq_waiter::kSpinForever);
+
+  /**
+   * @brief Add a completion queue to poll, or change its weight. Takes
+   * effect at the next round, without restarting the executor.
+   *
+   * @param cq The completion queue.
+   * @param weight (Optional) Its share of every round relative to the
+   * others. Completion queues given at construction have weight 1.
+   */
+  void add_cq(std::shared_ptr<cq> cq, uint32_t weight = 1);
+
+  /**
+   * @brief Stop polling a completion queue. Takes effect at the next round.
+   *
+   * @param cq The completion queue.
+   */
+  void remove_cq(std::shared_ptr<cq> const &cq);
+
+  /**
+   * @brief Get how every completion queue was served.
+   *
+   * @return std::vector<std::pair<std::shared_ptr<cq>, cq_service_stats>>
+   * The completion queues with their statistics.
+   */
+  std::vector<std::pair<std::shared_ptr<cq>, cq_service_stats>>
+  cq_stats() const;
+
+  /**
+   * @brief Get how the executor spent its idle time.
+   *
+   * @return wait_stats The statistics.
+   */
+  wait_stats stats() const;
+
+  /**
+   * @brief Get the metrics of the polling loop. Cheap enough to call
+   * periodically, e.g. from a metrics_dumper.
+   *
+   * @return poller_metrics_snapshot The metrics.
+   */
+  poller_metrics_snapshot metrics() const;
 
   ~poll_executor();
 };
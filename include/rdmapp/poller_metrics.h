@@ -0,0 +1,182 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/cq.h"
+#include "rdmapp/histogram.h"
+
+#include "rdmapp/detail/completion.h"
+#include "rdmapp/detail/noncopyable.h"
+
+namespace rdmapp {
+
+/**
+ * @brief The metrics of a poller thread.
+ *
+ */
+struct poller_metrics_snapshot {
+  // Polls that returned no completion.
+  uint64_t empty_polls;
+  // Completions returned by every non-empty poll.
+  histogram_snapshot completions_per_poll;
+  // Empty polls in a row before every non-empty poll.
+  histogram_snapshot empty_poll_streak;
+  // Nanoseconds from the return of a non-empty poll to the first coroutine
+  // resumed or handed to the executor.
+  histogram_snapshot poll_to_resume_ns;
+  // Nanoseconds spent delivering the completions of a non-empty poll.
+  histogram_snapshot dispatch_ns;
+
+  poller_metrics_snapshot since(poller_metrics_snapshot const &earlier) const;
+
+  /**
+   * @brief Format the snapshot as one line.
+   *
+   * @return std::string The line.
+   */
+  std::string to_string() const;
+};
+
+namespace detail {
+
+/**
+ * @brief The metrics a poller thread keeps about its own loop.
+ *
+ */
+class poller_metrics : public noncopyable {
+  using clock = std::chrono::steady_clock;
+
+  uint64_t empty_streak_;
+  std::atomic<uint64_t> empty_polls_;
+  log_histogram completions_per_poll_;
+  log_histogram empty_poll_streak_;
+  log_histogram poll_to_resume_ns_;
+  log_histogram dispatch_ns_;
+
+  static uint64_t to_ns(clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  }
+
+public:
+  poller_metrics();
+
+  /**
+   * @brief Record a poll that returned nothing.
+   *
+   */
+  void record_empty_poll() {
+    ++empty_streak_;
+    empty_polls_.store(empty_polls_.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Record a poll and deliver its completions, timing the delivery.
+   *
+   * @param cq The completion queue the work completions were polled from.
+   * @param wc The work completions.
+   * @param nr_wc The number of work completions, possibly 0.
+   * @param resume Called with the address of every coroutine to resume, and
+   * with its work completion if it accepts one.
+   */
+  template <class Fn>
+  void dispatch(cq &cq, struct ibv_wc *wc, size_t nr_wc, Fn &&resume) {
+    if (nr_wc == 0) {
+      record_empty_poll();
+      return;
+    }
+    auto const polled_at = clock::now();
+    completions_per_poll_.record(nr_wc);
+    empty_poll_streak_.record(empty_streak_);
+    empty_streak_ = 0;
+    bool first = true;
+    detail::dispatch_wcs(
+        cq, wc, nr_wc, [&](void *h_ptr, struct ibv_wc const &wc) {
+          if (first) {
+            poll_to_resume_ns_.record(to_ns(clock::now() - polled_at));
+            first = false;
+          }
+          if constexpr (std::is_invocable_v<Fn &, void *,
+                                            struct ibv_wc const &>) {
+            resume(h_ptr, wc);
+          } else {
+            resume(h_ptr);
+          }
+        });
+    dispatch_ns_.record(to_ns(clock::now() - polled_at));
+  }
+
+  poller_metrics_snapshot snapshot() const;
+};
+
+} // namespace detail
+
+/**
+ * @brief This class prints the metrics of a set of pollers periodically on a
+ * thread of its own, so that pollers never format or write output
+ * themselves. Every line covers the interval since the previous one.
+ *
+ */
+class metrics_dumper : public noncopyable {
+public:
+  using source = std::function<poller_metrics_snapshot()>;
+  using sink = std::function<void(std::string const &line)>;
+
+private:
+  struct entry {
+    std::string name;
+    source get;
+    poller_metrics_snapshot last;
+  };
+
+  std::chrono::milliseconds interval_;
+  sink sink_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopped_;
+  std::vector<entry> entries_;
+  std::jthread dumper_thread_;
+  void dump_loop();
+
+public:
+  /**
+   * @brief Construct a new metrics dumper and start its thread.
+   *
+   * @param interval The time between two dumps.
+   * @param sink (Optional) Receives every line. Lines are logged at the info
+   * level by default.
+   */
+  explicit metrics_dumper(std::chrono::milliseconds interval,
+                          sink sink = nullptr);
+
+  /**
+   * @brief Add a poller to dump.
+   *
+   * @param name The name printed before its metrics.
+   * @param source Returns the current metrics of the poller, e.g. a lambda
+   * calling its metrics(). It must stay valid until the dumper is destroyed.
+   */
+  void add(std::string name, source source);
+
+  /**
+   * @brief Dump all pollers now.
+   *
+   */
+  void dump();
+
+  ~metrics_dumper();
+};
+
+} // namespace rdmapp
@@ -4,8 +4,10 @@
 #include <coroutine>
 #include <cstdint>
 #include <exception>
+#include <functional>
 #include <memory>
 #include <optional>
+#include <span>
 #include <utility>
 #include <vector>
 #include <chrono>
@@ -18,8 +20,11 @@
 #include "rdmapp/pd.h"
 #include "rdmapp/srq.h"
 
+#include "rdmapp/detail/completion_slab.h"
 #include "rdmapp/detail/noncopyable.h"
+#include "rdmapp/detail/send_operands.h"
 #include "rdmapp/detail/serdes.h"
+#include "rdmapp/detail/spinlock.h"
 
 namespace rdmapp {
 
@@ -45,6 +50,108 @@ struct deserialized_qp {
   std::vector<uint8_t> user_data;
 };
 
+/**
+ * @brief Creation-time attributes of a Queue Pair. The defaults match what
+ * earlier versions hardcoded. Queue depths and SGE counts are validated
+ * against the device capabilities, while the path MTU and the RDMA read/atomic
+ * depths are clamped to what the port and device support.
+ *
+ */
+struct qp_config {
+  /**
+   * @brief The largest scatter/gather list the segment overloads accept.
+   *
+   */
+  static constexpr uint32_t kMaxSge = 32;
+
+  /**
+   * @brief The maximum number of outstanding send work requests.
+   *
+   */
+  uint32_t max_send_wr = 128;
+
+  /**
+   * @brief The maximum number of outstanding recv work requests on the Queue
+   * Pair's own RQ. Ignored when an SRQ is used.
+   *
+   */
+  uint32_t max_recv_wr = 128;
+
+  /**
+   * @brief The maximum number of SGEs per send work request.
+   *
+   */
+  uint32_t max_send_sge = 1;
+
+  /**
+   * @brief The maximum number of SGEs per recv work request posted to the
+   * Queue Pair's own RQ. Recv work requests posted to an SRQ are bounded by
+   * the SRQ's own limit instead.
+   *
+   */
+  uint32_t max_recv_sge = 1;
+
+  /**
+   * @brief The maximum inline payload size in bytes. It is also the initial
+   * inline threshold (see qp::set_inline_threshold).
+   *
+   */
+  uint32_t max_inline_data = 64;
+
+  /**
+   * @brief The path MTU. It is clamped to the active MTU of the port.
+   *
+   */
+  enum ibv_mtu path_mtu = IBV_MTU_4096;
+
+  /**
+   * @brief The number of outstanding RDMA reads and atomics this Queue Pair
+   * may initiate. Clamped to the device limit.
+   *
+   */
+  uint8_t max_rd_atomic = 16;
+
+  /**
+   * @brief The number of incoming RDMA reads and atomics this Queue Pair may
+   * serve concurrently. Clamped to the device limit.
+   *
+   */
+  uint8_t max_dest_rd_atomic = 16;
+
+  /**
+   * @brief The local ACK timeout, 4.096 us * 2^timeout. At most 31.
+   *
+   */
+  uint8_t timeout = 14;
+
+  /**
+   * @brief The number of retries on ACK timeout. At most 7.
+   *
+   */
+  uint8_t retry_cnt = 7;
+
+  /**
+   * @brief The number of retries on RNR NAK. At most 7, which means infinite.
+   *
+   */
+  uint8_t rnr_retry = 7;
+
+  /**
+   * @brief The RNR NAK timer code reported to senders. At most 31.
+   *
+   */
+  uint8_t min_rnr_timer = 12;
+
+  /**
+   * @brief Create the Queue Pair with ibv_create_qp_ex and post send work
+   * requests through the ibv_wr_* builders instead of ibv_post_send. This
+   * lets providers write WQEs directly. The awaitables behave the same in
+   * both modes.
+   *
+   */
+  bool extended_verbs = false;
+};
+
 /**
  * @brief This class is an abstraction of an Infiniband Queue Pair.
  *
@@ -52,6 +159,7 @@ struct deserialized_qp {
 class qp : public noncopyable, public std::enable_shared_from_this<qp> {
   static std::atomic<uint32_t> next_sq_psn;
   struct ibv_qp *qp_;
+  struct ibv_qp_ex *qpx_;
   struct ibv_srq *raw_srq_;
   uint32_t sq_psn_;
   void (qp::*post_recv_fn)(struct ibv_recv_wr const &recv_wr,
@@ -62,6 +170,52 @@ class qp : public noncopyable, public std::enable_shared_from_this<qp> {
   std::shared_ptr<cq> send_cq_;
   std::shared_ptr<srq> srq_;
   std::vector<uint8_t> user_data_;
+  qp_config config_;
+  detail::completion_slab completions_;
+
+  struct tracked_send {
+    detail::completion_slot *slot;
+    uint32_t length;
+    // Fire-and-forget sends report their cookie to the sent handler.
+    bool direct;
+    uint64_t cookie;
+  };
+
+  std::atomic<uint32_t> inline_threshold_;
+  detail::spinlock send_lock_;
+  std::vector<struct ibv_send_wr> send_batch_wr_;
+  std::vector<struct ibv_sge> send_batch_sge_;
+  size_t send_batch_len_;
+  size_t send_batch_size_;
+  bool send_batch_scheduled_;
+  size_t signal_interval_;
+  std::vector<tracked_send> send_ring_;
+  uint64_t next_send_seq_;
+  uint64_t retired_send_seq_;
+  size_t unsignaled_;
+  // An unsignaled request is awaited, or reported to the sent handler: the
+  // doorbell batch must end with a signaled one.
+  bool unsignaled_watched_;
+  // Parked send work requests, a ring of max_send_sge SGEs per entry. It is
+  // allocated with the Queue Pair and only grows past max_send_wr of them.
+  std::vector<struct ibv_send_wr> send_overflow_wr_;
+  std::vector<struct ibv_sge> send_overflow_sge_;
+  size_t send_overflow_head_;
+  size_t send_overflow_len_;
+  // Set by the first failed send: the Queue Pair is in the error state and
+  // every later send fails right away.
+  bool send_failed_;
+  std::function<void(uint64_t cookie, enum ibv_wc_status status)>
+      direct_sent_handler_;
+  // Sends that failed without reaching the send queue, handed to the poller
+  // by the next flush_sends() or retire_sends().
+  std::vector<void *> failed_sends_;
+  std::vector<std::pair<uint64_t, enum ibv_wc_status>> failed_direct_sends_;
+  // Pollers flushing this Queue Pair outside of the send CQ's lock, waited
+  // for by cq::cancel_flush().
+  std::atomic<uint32_t> flushers_;
+  bool cqes_reserved_;
+  friend class cq;
 
   /**
    * @brief Creates a new Queue Pair. The Queue Pair will be in the RESET state.
@@ -69,6 +223,13 @@ class qp : public noncopyable, public std::enable_shared_from_this<qp> {
    */
   void create();
 
+  /**
+   * @brief Validates config_ against the device capabilities and clamps the
+   * attributes that have a device-dependent maximum.
+   *
+   */
+  void validate_config();
+
   /**
    * @brief Initializes the Queue Pair. The Queue Pair will be in the INIT
    * state.
@@ -76,97 +237,338 @@ class qp : public noncopyable, public std::enable_shared_from_this<qp> {
    */
   void init();
 
+  /**
+   * @brief Reserve the send and receive depth of the Queue Pair on its
+   * completion queues, so that they cannot overflow.
+   *
+   */
+  void reserve_cqes();
+
+  /**
+   * @brief Release the depth reserved by reserve_cqes().
+   *
+   */
+  void release_cqes();
+
   void destroy();
 
+  /**
+   * @brief Posts a chain of send work requests through the ibv_wr_* builders
+   * of an extended Queue Pair.
+   *
+   * @param send_wr The first work request of the chain.
+   */
+  void post_send_ex(struct ibv_send_wr const &send_wr);
+
+  /**
+   * @brief Submits a send work request built by an awaitable. Depending on the
+   * batching setting it is either posted right away or appended to the send
+   * batch and posted with the next doorbell. Requests small enough are marked
+   * inline. If the send queue has no free slot, the request is parked and
+   * posted once completions free one, so this never fails because the send
+   * queue is full. Once a send has failed, the request fails right away.
+   *
+   * @param send_wr The work request to submit. Its wr_id is the completion
+   * slot of the awaiter, or 0 if nobody awaits it. Its scatter/gather list is
+   * copied, so it may live on the caller's stack.
+   */
+  void submit_send(struct ibv_send_wr &send_wr);
+
+  /**
+   * @brief Detaches the awaiter from a send whose submission failed. The send
+   * ring may still name its slot, which is given back once retired instead of
+   * resuming anything.
+   *
+   * @param slot The completion slot of the send.
+   */
+  void abandon_send(detail::completion_slot *slot);
+
+  /**
+   * @brief Posts or batches a send work request that has been granted a send
+   * queue slot. The caller must hold send_lock_.
+   *
+   * @param send_wr The work request.
+   * @return true The batch was left pending and a flush must be scheduled.
+   */
+  bool enqueue_send_locked(struct ibv_send_wr &send_wr);
+
+  /**
+   * @brief Returns the number of free send queue slots. Work requests count
+   * from the moment they are tracked until their completion is retired. The
+   * caller must hold send_lock_.
+   *
+   * @return size_t The number of work requests that may still be posted.
+   */
+  size_t send_credits_locked() const;
+
+  /**
+   * @brief Posts parked send work requests, oldest first, while the send queue
+   * has free slots. The caller must hold send_lock_.
+   *
+   */
+  void drain_overflow_locked();
+
+  /**
+   * @brief Appends a send work request to the parked ones, growing the ring
+   * if it is full. The caller must hold send_lock_.
+   *
+   * @param send_wr The work request. Its scatter/gather list is copied.
+   */
+  void park_send_locked(struct ibv_send_wr const &send_wr);
+
+  /**
+   * @brief Fails every send that has not completed yet, parked ones included,
+   * with IBV_WC_WR_FLUSH_ERR, and every send submitted afterwards. Called
+   * once a send failed, as the Queue Pair is then in the error state, and on
+   * destroy. The caller must hold send_lock_.
+   *
+   */
+  void abort_sends_locked();
+
+  /**
+   * @brief Completes one send with an error status, as fail_sends_locked()
+   * does. The caller must hold send_lock_.
+   *
+   * @param entry The send.
+   * @param wc The work completion to deliver.
+   */
+  void fail_send_locked(tracked_send const &entry, struct ibv_wc const &wc);
+
+  /**
+   * @brief Describes a send work request for the send ring from the wr_id it
+   * was submitted with.
+   *
+   * @param wr_id The completion slot, the direct cookie tag, or 0.
+   * @param length The total payload length.
+   * @return tracked_send The send ring entry.
+   */
+  static tracked_send make_tracked_send(uint64_t wr_id, uint32_t length);
+
+  /**
+   * @brief Checks whether a send work request can carry its payload inline.
+   *
+   * @param opcode The opcode of the work request.
+   * @param length The total payload length.
+   * @return true The payload is copied into the WQE and needs no lkey.
+   */
+  bool is_inline(enum ibv_wr_opcode opcode, size_t length) const;
+
+  /**
+   * @brief Registers a raw buffer for a send work request, unless its payload
+   * will be posted inline or, for outgoing payloads, fits a bounce buffer.
+   *
+   * @param buffer The local buffer.
+   * @param length The length of the local buffer.
+   * @param opcode The opcode of the work request.
+   * @param bounce Receives the bounce buffer holding a copy of the payload,
+   * if one is used.
+   * @return std::shared_ptr<local_mr> The registered memory region, or nullptr
+   * if the payload is inline or bounced.
+   */
+  std::shared_ptr<local_mr> reg_send_buffer(void *buffer, size_t length,
+                                            enum ibv_wr_opcode opcode,
+                                            buffer_pool::buffer &bounce);
+
+  /**
+   * @brief Throws if a send scatter/gather list is empty or exceeds the
+   * Queue Pair's SGE limit.
+   *
+   * @param segments The segments.
+   */
+  void check_send_segments(std::span<local_mr_segment const> segments) const;
+
+  /**
+   * @brief Posts the send batch as one linked work request chain. The caller
+   * must hold send_lock_.
+   *
+   */
+  void flush_sends_locked();
+
+  /**
+   * @brief Posts a chain of tracked send work requests, the last ones
+   * tracked. If the post fails, the work requests that did not reach the send
+   * queue give back their sequence numbers and fail with IBV_WC_WR_FLUSH_ERR
+   * instead of throwing, as the caller may be a poller, and the Queue Pair is
+   * moved to the error state (see abort_sends_locked()). The caller must hold
+   * send_lock_.
+   *
+   * @param send_wr The first work request of the chain.
+   */
+  void post_tracked_locked(struct ibv_send_wr &send_wr);
+
+  /**
+   * @brief Completes the tracked send work requests from a sequence number
+   * on with an error status. Their awaiters and sent handler calls are queued
+   * in failed_sends_ and failed_direct_sends_. The caller must hold
+   * send_lock_ and give back the sequence numbers.
+   *
+   * @param seq The first sequence number to fail.
+   * @param status The status to complete them with.
+   */
+  void fail_sends_locked(uint64_t seq, enum ibv_wc_status status);
+
+  /**
+   * @brief Moves the failed sends queued by fail_sends_locked() out. The
+   * caller must hold send_lock_.
+   *
+   * @param handles The coroutines to resume are appended to it.
+   * @param direct The cookies and statuses for the sent handler are appended
+   * to it.
+   */
+  void take_failed_sends_locked(
+      std::vector<void *> &handles,
+      std::vector<std::pair<uint64_t, enum ibv_wc_status>> &direct);
+
+  /**
+   * @brief Marks the send batch as scheduled for a flush by the send CQ. The
+   * caller must hold send_lock_ and call cq::schedule_flush() once it is
+   * released if this returns true.
+   *
+   * @return true The flush was not scheduled yet.
+   */
+  bool request_flush_locked();
+
+  /**
+   * @brief Schedules a flush if sends failed outside of a poller, so that the
+   * poller hands them out. The caller must hold send_lock_ and call
+   * cq::schedule_flush() once it is released if this returns true.
+   *
+   * @return true The flush was not scheduled yet.
+   */
+  bool schedule_failed_locked();
+
+  /**
+   * @brief Posts the send batch and hands out the sends that failed, for the
+   * send CQ's poller.
+   *
+   * @param handles The coroutines to resume are appended to it.
+   */
+  void flush_sends(std::vector<void *> &handles);
+
+  /**
+   * @brief Assigns the next sequence number to a send work request, taking a
+   * send queue slot, and decides whether it is signaled. The caller must hold
+   * send_lock_.
+   *
+   * @param send_wr The work request. Its wr_id (the completion slot, or 0) is
+   * replaced with the tracked sequence number.
+   */
+  void track_send(struct ibv_send_wr &send_wr);
+
+  /**
+   * @brief Marks a send work request signaled and resets the unsignaled
+   * counters. The caller must hold send_lock_.
+   *
+   * @param send_wr The work request.
+   */
+  void signal_send(struct ibv_send_wr &send_wr);
+
+  /**
+   * @brief Retires tracked send work requests up to and including the one
+   * that produced the work completion, then posts parked work requests into
+   * the freed slots.
+   *
+   * @param wc The work completion.
+   * @param handles The coroutines to resume are appended to it, oldest first.
+   * @param completed_at The tick of the work completion, or 0.
+   */
+  void retire_sends(struct ibv_wc const &wc, std::vector<void *> &handles,
+                    uint64_t completed_at);
+
 public:
-  class send_awaitable {
-    struct ibv_wc wc_;
-    void *coroutine_addr_;
+  /**
+   * @brief The awaitable of the send operations. It is specialized per
+   * opcode: the opcode of the work request is a compile-time constant, and
+   * only the operands of that opcode are stored.
+   *
+   * @tparam Opcode The opcode of the operation.
+   */
+  template <enum ibv_wr_opcode Opcode> class send_awaitable {
+    detail::completion_slot *slot_ = nullptr;
     std::shared_ptr<qp> qp_;
+    buffer_pool::buffer bounce_;
     std::shared_ptr<local_mr> local_mr_;
     std::exception_ptr exception_;
-    remote_mr remote_mr_;
-    uint64_t compare_add_;
-    uint64_t swap_;
-    uint32_t imm_;
+    void *buffer_ = nullptr;
+    std::span<local_mr_segment const> segments_;
     size_t length_ = -1;
-    const enum ibv_wr_opcode opcode_;
+    [[no_unique_address]] detail::send_operands<Opcode> operands_;
+
+  public:
+    using operands = detail::send_operands<Opcode>;
 
-   public:
-    send_awaitable(std::shared_ptr<qp> qp, void *buffer, size_t length,
-                   enum ibv_wr_opcode opcode);
-    send_awaitable(std::shared_ptr<qp> qp, void *buffer, size_t length,
-                   enum ibv_wr_opcode opcode, remote_mr const &remote_mr);
-    send_awaitable(std::shared_ptr<qp> qp, void *buffer, size_t length,
-                   enum ibv_wr_opcode opcode, remote_mr const &remote_mr,
-                   uint32_t imm);
-    send_awaitable(std::shared_ptr<qp> qp, void *buffer, size_t length,
-                   enum ibv_wr_opcode opcode, remote_mr const &remote_mr,
-                   uint64_t add);
     send_awaitable(std::shared_ptr<qp> qp, void *buffer, size_t length,
-                   enum ibv_wr_opcode opcode, remote_mr const &remote_mr,
-                   uint64_t compare, uint64_t swap);
-    send_awaitable(std::shared_ptr<qp> qp, std::shared_ptr<local_mr> local_mr,
-                   enum ibv_wr_opcode opcode);
-    send_awaitable(std::shared_ptr<qp> qp, std::shared_ptr<local_mr> local_mr,
-                   enum ibv_wr_opcode opcode, remote_mr const &remote_mr);
+                   operands const &operands);
     send_awaitable(std::shared_ptr<qp> qp, std::shared_ptr<local_mr> local_mr,
-                   enum ibv_wr_opcode opcode, remote_mr const &remote_mr,
-                   uint32_t imm);
-    send_awaitable(std::shared_ptr<qp> qp, std::shared_ptr<local_mr> local_mr,
-                   enum ibv_wr_opcode opcode, remote_mr const &remote_mr,
-                   uint64_t add);
-    send_awaitable(std::shared_ptr<qp> qp, std::shared_ptr<local_mr> local_mr,
-                   enum ibv_wr_opcode opcode, remote_mr const &remote_mr,
-                   uint64_t compare, uint64_t swap);
+                   operands const &operands);
+    send_awaitable(std::shared_ptr<qp> qp,
+                   std::span<local_mr_segment const> segments,
+                   operands const &operands);
     bool await_ready() const noexcept;
     bool await_suspend(std::coroutine_handle<> h) noexcept;
     uint32_t await_resume() const;
-    constexpr bool is_rdma() const;
-    constexpr bool is_atomic() const;
   };
 
+  /**
+   * @brief The awaitable of the operations taking raw memory region pointers.
+   * It holds no smart pointer and allocates nothing: the caller keeps the
+   * Queue Pair and the memory regions alive until it is resumed.
+   *
+   */
   class light_send_awaitable {
-    struct ibv_wc wc_;
-    void *coroutine_addr_;
-    qp* qp_;
-    local_mr* local_mr_;
-    remote_mr* remote_mr_;
+    detail::completion_slot *slot_ = nullptr;
+    qp *qp_;
+    local_mr *local_mr_;
+    remote_mr *remote_mr_;
+    std::exception_ptr exception_;
+    uint64_t compare_add_;
+    uint64_t swap_;
+    size_t length_;
     uint32_t imm_;
-    size_t length_ = -1;
+    enum ibv_wr_opcode opcode_;
 
-   public:
-    light_send_awaitable(qp* qp, size_t length, local_mr* local_mr, remote_mr* remote_mr, uint32_t imm);
+  public:
+    light_send_awaitable(qp *qp, local_mr *local_mr, size_t length,
+                         enum ibv_wr_opcode opcode,
+                         remote_mr *remote_mr = nullptr, uint32_t imm = 0,
+                         uint64_t compare_add = 0, uint64_t swap = 0);
     bool await_ready() const noexcept;
     bool await_suspend(std::coroutine_handle<> h) noexcept;
     uint32_t await_resume() const;
   };
 
+  /**
+   * @brief The recv counterpart of light_send_awaitable.
+   *
+   */
   class light_recv_awaitable {
-    struct ibv_wc wc_;
-    void *coroutine_addr_;
-    qp* qp_;
-    local_mr* local_mr_;
-    enum ibv_wr_opcode opcode_;
+    detail::completion_slot *slot_ = nullptr;
+    qp *qp_;
+    local_mr *local_mr_;
+    std::exception_ptr exception_;
 
-   public:
-    light_recv_awaitable(qp* qp, local_mr* local_mr);
+  public:
+    light_recv_awaitable(qp *qp, local_mr *local_mr);
     bool await_ready() const noexcept;
     bool await_suspend(std::coroutine_handle<> h) noexcept;
     std::pair<uint32_t, std::optional<uint32_t>> await_resume() const;
   };
 
   class recv_awaitable {
-    struct ibv_wc wc_;
-    void *coroutine_addr_;
+    detail::completion_slot *slot_ = nullptr;
     std::shared_ptr<qp> qp_;
     std::shared_ptr<local_mr> local_mr_;
     std::exception_ptr exception_;
+    std::span<local_mr_segment const> segments_;
+    void *buffer_ = nullptr;
+    size_t length_ = 0;
     enum ibv_wr_opcode opcode_;
 
    public:
     recv_awaitable(std::shared_ptr<qp> qp, std::shared_ptr<local_mr> local_mr);
     recv_awaitable(std::shared_ptr<qp> qp, void *buffer, size_t length);
+    recv_awaitable(std::shared_ptr<qp> qp,
+                   std::span<local_mr_segment const> segments);
     bool await_ready() const noexcept;
     bool await_suspend(std::coroutine_handle<> h) noexcept;
     std::pair<uint32_t, std::optional<uint32_t>> await_resume() const;
@@ -184,11 +586,12 @@ public:
    * @param cq The completion queue of both send and recv work completions.
    * @param srq (Optional) If set, all recv work requests will be posted to this
    * SRQ.
+   * @param config (Optional) The creation-time attributes.
    */
   qp(const uint16_t remote_lid, const uint32_t remote_qpn,
      const uint32_t remote_psn, const union ibv_gid remote_gid,
      std::shared_ptr<pd> pd, std::shared_ptr<cq> cq,
-     std::shared_ptr<srq> srq = nullptr);
+     std::shared_ptr<srq> srq = nullptr, qp_config const &config = {});
 
   /**
    * @brief Construct a new qp object. The Queue Pair will be created with the
@@ -203,11 +606,13 @@ public:
    * @param send_cq The completion queue of send work completions.
    * @param srq (Optional) If set, all recv work requests will be posted to this
    * SRQ.
+   * @param config (Optional) The creation-time attributes.
    */
   qp(const uint16_t remote_lid, const uint32_t remote_qpn,
      const uint32_t remote_psn, const union ibv_gid remote_gid,
      std::shared_ptr<pd> pd, std::shared_ptr<cq> recv_cq,
-     std::shared_ptr<cq> send_cq, std::shared_ptr<srq> srq = nullptr);
+     std::shared_ptr<cq> send_cq, std::shared_ptr<srq> srq = nullptr,
+     qp_config const &config = {});
 
   /**
    * @brief Construct a new qp object. The constructed Queue Pair will be in
@@ -217,9 +622,10 @@ public:
    * @param cq The completion queue of both send and recv work completions.
    * @param srq (Optional) If set, all recv work requests will be posted to this
    * SRQ.
+   * @param config (Optional) The creation-time attributes.
    */
   qp(std::shared_ptr<pd> pd, std::shared_ptr<cq> cq,
-     std::shared_ptr<srq> srq = nullptr);
+     std::shared_ptr<srq> srq = nullptr, qp_config const &config = {});
 
   /**
    * @brief Construct a new qp object. The constructed Queue Pair will be in
@@ -230,9 +636,11 @@ public:
    * @param send_cq The completion queue of send work completions.
    * @param srq (Optional) If set, all recv work requests will be posted to this
    * SRQ.
+   * @param config (Optional) The creation-time attributes.
    */
   qp(std::shared_ptr<pd> pd, std::shared_ptr<cq> recv_cq,
-     std::shared_ptr<cq> send_cq, std::shared_ptr<srq> srq = nullptr);
+     std::shared_ptr<cq> send_cq, std::shared_ptr<srq> srq = nullptr,
+     qp_config const &config = {});
 
   /**
    * @brief This function is used to post a send work request to the Queue Pair.
@@ -256,33 +664,90 @@ public:
   void post_recv(struct ibv_recv_wr const &recv_wr,
                  struct ibv_recv_wr *&bad_recv_wr) const;
 
+  /**
+   * @brief This function enables doorbell batching for the send queue. Send
+   * work requests issued through the awaitables are accumulated and posted as
+   * one linked chain by a single ibv_post_send, either when the batch is full
+   * or when the send CQ's poller finishes a poll loop iteration. Every
+   * operation is still signaled and resumed individually.
+   *
+   * @param batch_size The maximum number of work requests per doorbell. 0 or 1
+   * disables batching, which is the default.
+   */
+  void set_send_batch_size(size_t batch_size);
+
+  /**
+   * @brief This function posts all batched send work requests immediately.
+   *
+   */
+  void flush_sends();
+
+  /**
+   * @brief This function enables selective signaling. Only every Nth send
+   * work request is signaled, plus the last request of a doorbell batch when
+   * an awaited request, or a direct one while a sent handler is set, would
+   * otherwise be left without a completion. One
+   * completion retires all earlier unsignaled work requests of this Queue
+   * Pair in order, resuming their coroutines and freeing their send queue
+   * slots. Fire-and-forget writes and doorbell batches benefit the most.
+   *
+   * @param interval The signaling interval N. 0 or 1 signals every work
+   * request, which is the default. It is capped at half of the send queue
+   * depth.
+   */
+  void set_signal_interval(size_t interval);
+
+  /**
+   * @brief This function sets the inline threshold. Sends and RDMA writes whose
+   * payload is at most this many bytes are posted with IBV_SEND_INLINE: the
+   * payload is copied into the work request, so the NIC does not DMA-read it
+   * and no lkey is needed. The raw pointer overloads of send, write and
+   * write_with_imm do not register such buffers at all.
+   *
+   * @param threshold The inline threshold in bytes. It is capped at the
+   * maximum inline size granted at creation. 0 disables inlining.
+   */
+  void set_inline_threshold(size_t threshold);
+
+  /**
+   * @brief This function returns the current inline threshold.
+   *
+   * @return size_t The inline threshold in bytes.
+   */
+  size_t inline_threshold() const;
+
   /**
    * @brief This method sends local buffer to remote. The address will be
-   * registered as a memory region first and then deregistered upon completion.
+   * registered as a memory region first and then deregistered upon completion,
+   * unless the length is within the inline threshold or the payload is copied
+   * into a bounce buffer (see pd_config::bounce_threshold).
    *
    * @param buffer Pointer to local buffer. It should be valid until completion.
    * @param length The length of the local buffer.
    * @return send_awaitable A coroutine returning length of the data sent.
    */
-  [[nodiscard]] send_awaitable send(void *buffer, size_t length);
+  [[nodiscard]] send_awaitable<IBV_WR_SEND> send(void *buffer, size_t length);
 
   /**
    * @brief This method writes local buffer to a remote memory region. The local
    * buffer will be registered as a memory region first and then deregistered
-   * upon completion.
+   * upon completion, unless the length is within the inline threshold or the
+   * payload is copied into a bounce buffer (see pd_config::bounce_threshold).
    *
    * @param remote_mr Remote memory region handle.
    * @param buffer Pointer to local buffer. It should be valid until completion.
    * @param length The length of the local buffer.
    * @return send_awaitable A coroutine returning length of the data written.
    */
-  [[nodiscard]] send_awaitable write(remote_mr const &remote_mr, void *buffer,
-                                     size_t length);
+  [[nodiscard]] send_awaitable<IBV_WR_RDMA_WRITE>
+  write(remote_mr const &remote_mr, void *buffer, size_t length);
 
   /**
    * @brief This method writes local buffer to a remote memory region with an
    * immediate value. The local buffer will be registered as a memory region
-   * first and then deregistered upon completion.
+   * first and then deregistered upon completion, unless the length is within
+   * the inline threshold or the payload is copied into a bounce buffer (see
+   * pd_config::bounce_threshold).
    *
    * @param remote_mr Remote memory region handle.
    * @param buffer Pointer to local buffer. It should be valid until completion.
@@ -290,9 +755,9 @@ public:
    * @param imm The immediate value.
    * @return send_awaitable A coroutine returning length of the data written.
    */
-  [[nodiscard]] send_awaitable write_with_imm(remote_mr const &remote_mr,
-                                              void *buffer, size_t length,
-                                              uint32_t imm);
+  [[nodiscard]] send_awaitable<IBV_WR_RDMA_WRITE_WITH_IMM>
+  write_with_imm(remote_mr const &remote_mr, void *buffer, size_t length,
+                 uint32_t imm);
 
   /**
    * @brief This method reads to local buffer from a remote memory region. The
@@ -304,8 +769,8 @@ public:
    * @param length The length of the local buffer.
    * @return send_awaitable A coroutine returning length of the data read.
    */
-  [[nodiscard]] send_awaitable read(remote_mr const &remote_mr, void *buffer,
-                                    size_t length);
+  [[nodiscard]] send_awaitable<IBV_WR_RDMA_READ>
+  read(remote_mr const &remote_mr, void *buffer, size_t length);
 
   /**
    * @brief This method performs an atomic fetch-and-add operation on the
@@ -318,9 +783,9 @@ public:
    * @param add The delta.
    * @return send_awaitable A coroutine returning length of the data sent.
    */
-  [[nodiscard]] send_awaitable fetch_and_add(remote_mr const &remote_mr,
-                                             void *buffer, size_t length,
-                                             uint64_t add);
+  [[nodiscard]] send_awaitable<IBV_WR_ATOMIC_FETCH_AND_ADD>
+  fetch_and_add(remote_mr const &remote_mr, void *buffer, size_t length,
+                uint64_t add);
 
   /**
    * @brief This method performs an atomic compare-and-swap operation on the
@@ -334,10 +799,9 @@ public:
    * @param swap The desired new value.
    * @return send_awaitable A coroutine returning length of the data sent.
    */
-  [[nodiscard]] send_awaitable compare_and_swap(remote_mr const &remote_mr,
-                                                void *buffer, size_t length,
-                                                uint64_t compare,
-                                                uint64_t swap);
+  [[nodiscard]] send_awaitable<IBV_WR_ATOMIC_CMP_AND_SWP>
+  compare_and_swap(remote_mr const &remote_mr, void *buffer, size_t length,
+                   uint64_t compare, uint64_t swap);
 
   /**
    * @brief This method posts a recv request on the queue pair. The buffer will
@@ -358,7 +822,8 @@ public:
    * controlled by a smart pointer.
    * @return send_awaitable A coroutine returning length of the data sent.
    */
-  [[nodiscard]] send_awaitable send(std::shared_ptr<local_mr> local_mr);
+  [[nodiscard]] send_awaitable<IBV_WR_SEND>
+  send(std::shared_ptr<local_mr> local_mr);
 
   /**
    * @brief This function writes a registered local memory region to remote.
@@ -368,8 +833,8 @@ public:
    * controlled by a smart pointer.
    * @return send_awaitable A coroutine returning length of the data written.
    */
-  [[nodiscard]] send_awaitable write(remote_mr const &remote_mr,
-                                     std::shared_ptr<local_mr> local_mr);
+  [[nodiscard]] send_awaitable<IBV_WR_RDMA_WRITE>
+  write(remote_mr const &remote_mr, std::shared_ptr<local_mr> local_mr);
 
   /**
    * @brief This function writes a registered local memory region to remote with
@@ -381,17 +846,143 @@ public:
    * @param imm The immediate value.
    * @return send_awaitable A coroutine returning length of the data sent.
    */
-  [[nodiscard]] send_awaitable
+  [[nodiscard]] send_awaitable<IBV_WR_RDMA_WRITE_WITH_IMM>
   write_with_imm(remote_mr const &remote_mr, std::shared_ptr<local_mr> local_mr,
                  uint32_t imm);
 
+  /**
+   * @brief This function writes a local memory region to remote with an
+   * immediate value, without touching any reference count.
+   *
+   * @param remote_mr Remote memory region handle. It must outlive the
+   * operation.
+   * @param local_mr Registered local memory region. It must outlive the
+   * operation.
+   * @param length The number of bytes to write, or -1 for the whole region.
+   * @param imm The immediate value.
+   * @return light_send_awaitable A coroutine returning length of the data
+   * sent.
+   */
+  [[nodiscard]] light_send_awaitable write_with_imm(remote_mr *remote_mr,
+                                                    local_mr *local_mr,
+                                                    size_t length,
+                                                    uint32_t imm);
+
+  /**
+   * @brief This function sends a local memory region to remote, without
+   * touching any reference count.
+   *
+   * @param local_mr Registered local memory region. It must outlive the
+   * operation.
+   * @param length (Optional) The number of bytes to send, or -1 for the whole
+   * region.
+   * @return light_send_awaitable A coroutine returning length of the data
+   * sent.
+   */
+  [[nodiscard]] light_send_awaitable send(local_mr *local_mr,
+                                          size_t length = -1);
+
+  /**
+   * @brief This function writes a local memory region to remote, without
+   * touching any reference count.
+   *
+   * @param remote_mr Remote memory region handle. It must outlive the
+   * operation.
+   * @param local_mr Registered local memory region. It must outlive the
+   * operation.
+   * @param length (Optional) The number of bytes to write, or -1 for the whole
+   * region.
+   * @return light_send_awaitable A coroutine returning length of the data
+   * sent.
+   */
+  [[nodiscard]] light_send_awaitable write(remote_mr *remote_mr,
+                                           local_mr *local_mr,
+                                           size_t length = -1);
+
+  /**
+   * @brief This function reads from remote into a local memory region,
+   * without touching any reference count.
+   *
+   * @param remote_mr Remote memory region handle. It must outlive the
+   * operation.
+   * @param local_mr Registered local memory region. It must outlive the
+   * operation.
+   * @param length (Optional) The number of bytes to read, or -1 for the whole
+   * region.
+   * @return light_send_awaitable A coroutine returning length of the data
+   * read.
+   */
+  [[nodiscard]] light_send_awaitable read(remote_mr *remote_mr,
+                                          local_mr *local_mr,
+                                          size_t length = -1);
+
+  /**
+   * @brief This function performs an atomic fetch-and-add operation, without
+   * touching any reference count.
+   *
+   * @param remote_mr Remote memory region handle. It must outlive the
+   * operation.
+   * @param local_mr Registered local memory region receiving the old value.
+   * It must outlive the operation.
+   * @param add The delta.
+   * @return light_send_awaitable A coroutine returning length of the data
+   * sent.
+   */
   [[nodiscard]] light_send_awaitable
-  write_with_imm(remote_mr* remote_mr, local_mr* local_mr,
-                size_t length, uint32_t imm);
+  fetch_and_add(remote_mr *remote_mr, local_mr *local_mr, uint64_t add);
+
+  /**
+   * @brief This function performs an atomic compare-and-swap operation,
+   * without touching any reference count.
+   *
+   * @param remote_mr Remote memory region handle. It must outlive the
+   * operation.
+   * @param local_mr Registered local memory region receiving the old value.
+   * It must outlive the operation.
+   * @param compare The expected old value.
+   * @param swap The desired new value.
+   * @return light_send_awaitable A coroutine returning length of the data
+   * sent.
+   */
+  [[nodiscard]] light_send_awaitable compare_and_swap(remote_mr *remote_mr,
+                                                      local_mr *local_mr,
+                                                      uint64_t compare,
+                                                      uint64_t swap);
+
+  /**
+   * @brief This function writes to a remote memory region with an immediate
+   * value without waiting for it. Its completion only frees its send queue
+   * slot, with the signal interval deciding how often one is generated (see
+   * set_signal_interval()), and is reported to the sent handler if one is
+   * set (see on_direct_sent()). While a handler is set, the last request of
+   * every doorbell batch is signaled, so every write is reported without
+   * waiting for a later send.
+   *
+   * @param remote_mr Remote memory region handle. It must outlive the
+   * operation.
+   * @param local_mr Registered local memory region. It must stay untouched
+   * until the write is reported sent.
+   * @param length The length to write, -1 for the whole local region.
+   * @param imm The immediate value.
+   * @param cookie (Optional) Passed to the sent handler, e.g. the index of
+   * the buffer to recycle. Only its lower 62 bits are kept.
+   */
+  void write_with_imm_direct(remote_mr *remote_mr, local_mr *local_mr,
+                             size_t length, uint32_t imm,
+                             uint64_t cookie = 0);
 
-  [[nodiscard]] void
-  write_with_imm_direct(remote_mr* remote_mr, local_mr* local_mr,
-                size_t length, uint32_t imm);
+  /**
+   * @brief Set the handler called when fire-and-forget sends of this Queue
+   * Pair have completed, so that their buffers can be recycled. It is
+   * called on the poller thread, after the send queue slot is freed, and
+   * must not destroy the Queue Pair.
+   *
+   * @param handler Called with the cookie of every completed send and its
+   * status, oldest first. nullptr to remove it.
+   */
+  void on_direct_sent(
+      std::function<void(uint64_t cookie, enum ibv_wc_status status)>
+          handler);
 
   /**
    * @brief This function reads to local memory region from remote.
@@ -401,8 +992,8 @@ public:
    * controlled by a smart pointer.
    * @return send_awaitable A coroutine returning length of the data read.
    */
-  [[nodiscard]] send_awaitable read(remote_mr const &remote_mr,
-                                    std::shared_ptr<local_mr> local_mr);
+  [[nodiscard]] send_awaitable<IBV_WR_RDMA_READ>
+  read(remote_mr const &remote_mr, std::shared_ptr<local_mr> local_mr);
 
   /**
    * @brief This function performs an atomic fetch-and-add operation on the
@@ -414,9 +1005,9 @@ public:
    * @param add The delta.
    * @return send_awaitable A coroutine returning length of the data sent.
    */
-  [[nodiscard]] send_awaitable fetch_and_add(remote_mr const &remote_mr,
-                                             std::shared_ptr<local_mr> local_mr,
-                                             uint64_t add);
+  [[nodiscard]] send_awaitable<IBV_WR_ATOMIC_FETCH_AND_ADD>
+  fetch_and_add(remote_mr const &remote_mr, std::shared_ptr<local_mr> local_mr,
+                uint64_t add);
 
   /**
    * @brief This function performs an atomic compare-and-swap operation on the
@@ -429,7 +1020,7 @@ public:
    * @param swap The desired new value.
    * @return send_awaitable A coroutine returning length of the data sent.
    */
-  [[nodiscard]] send_awaitable
+  [[nodiscard]] send_awaitable<IBV_WR_ATOMIC_CMP_AND_SWP>
   compare_and_swap(remote_mr const &remote_mr,
                    std::shared_ptr<local_mr> local_mr, uint64_t compare,
                    uint64_t swap);
@@ -445,7 +1036,70 @@ public:
    * data, and second indicating the immediate value if any.
    */
   [[nodiscard]] recv_awaitable recv(std::shared_ptr<local_mr> local_mr);
-  [[nodiscard]] light_recv_awaitable recv(local_mr* local_mr);
+
+  /**
+   * @brief This function posts a recv request on the queue pair, without
+   * touching any reference count.
+   *
+   * @param local_mr Registered local memory region. It must outlive the
+   * operation.
+   * @return light_recv_awaitable A coroutine returning the length of received
+   * data and the immediate value if any.
+   */
+  [[nodiscard]] light_recv_awaitable recv(local_mr *local_mr);
+
+  /**
+   * @brief This function sends a scatter/gather list of registered local
+   * memory segments to remote as one message. The NIC gathers the segments,
+   * so no intermediate copy is made.
+   *
+   * @param segments The segments, at most qp_config::max_send_sge of them. The
+   * memory regions must stay valid until completion.
+   * @return send_awaitable A coroutine returning length of the data sent.
+   */
+  [[nodiscard]] send_awaitable<IBV_WR_SEND>
+  send(std::span<local_mr_segment const> segments);
+
+  /**
+   * @brief This function writes a scatter/gather list of registered local
+   * memory segments to a contiguous remote memory region.
+   *
+   * @param remote_mr Remote memory region handle.
+   * @param segments The segments, at most qp_config::max_send_sge of them. The
+   * memory regions must stay valid until completion.
+   * @return send_awaitable A coroutine returning length of the data written.
+   */
+  [[nodiscard]] send_awaitable<IBV_WR_RDMA_WRITE>
+  write(remote_mr const &remote_mr,
+        std::span<local_mr_segment const> segments);
+
+  /**
+   * @brief This function writes a scatter/gather list of registered local
+   * memory segments to a contiguous remote memory region with an immediate
+   * value.
+   *
+   * @param remote_mr Remote memory region handle.
+   * @param segments The segments, at most qp_config::max_send_sge of them. The
+   * memory regions must stay valid until completion.
+   * @param imm The immediate value.
+   * @return send_awaitable A coroutine returning length of the data written.
+   */
+  [[nodiscard]] send_awaitable<IBV_WR_RDMA_WRITE_WITH_IMM>
+  write_with_imm(remote_mr const &remote_mr,
+                 std::span<local_mr_segment const> segments, uint32_t imm);
+
+  /**
+   * @brief This function posts a recv request that scatters the incoming
+   * message over a list of registered local memory segments.
+   *
+   * @param segments The segments, at most qp_config::max_recv_sge of them (or
+   * the SRQ's limit). The memory regions must stay valid until completion.
+   * @return recv_awaitable A coroutine returning std::pair<uint32_t,
+   * std::optional<uint32_t>>, with first indicating the length of received
+   * data, and second indicating the immediate value if any.
+   */
+  [[nodiscard]] recv_awaitable
+  recv(std::span<local_mr_segment const> segments);
 
   /**
    * @brief This function serializes a Queue Pair prepared to be sent to a
@@ -470,6 +1124,14 @@ public:
    * @return std::shared_ptr<pd> Pointer to the PD.
    */
   std::shared_ptr<pd> pd_ptr() const;
+
+  /**
+   * @brief This function provides access to the effective creation-time
+   * attributes of the Queue Pair, after validation and clamping.
+   *
+   * @return qp_config const& The attributes.
+   */
+  qp_config const &config() const;
   ~qp();
 
   /**
@@ -1,12 +1,23 @@
 #pragma once
 
+#include "rdmapp/async_event_poller.h"
+#include "rdmapp/comp_channel.h"
 #include "rdmapp/cq.h"
 #include "rdmapp/cq_poller.h"
+#include "rdmapp/cq_scheduler.h"
 #include "rdmapp/batch_cq_poller.h"
 #include "rdmapp/device.h"
 #include "rdmapp/error.h"
+#include "rdmapp/executor.h"
+#include "rdmapp/histogram.h"
+#include "rdmapp/latency.h"
 #include "rdmapp/pd.h"
+#include "rdmapp/poll_batch.h"
+#include "rdmapp/poller_metrics.h"
 #include "rdmapp/qp.h"
+#include "rdmapp/recv_ring.h"
+#include "rdmapp/sharded_runtime.h"
 #include "rdmapp/srq.h"
+#include "rdmapp/ud_qp.h"
 #include "rdmapp/task.h"
 #include "rdmapp/poll_executor.h"
\ No newline at end of file
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/pd.h"
+#include "rdmapp/qp.h"
+#include "rdmapp/srq.h"
+
+#include "rdmapp/detail/completion_slab.h"
+#include "rdmapp/detail/noncopyable.h"
+#include "rdmapp/detail/spinlock.h"
+
+namespace rdmapp {
+
+struct recv_ring_stats {
+  // Receives completed into the ring.
+  uint64_t completions;
+  // Buffers posted again after their views were released.
+  uint64_t reposts;
+  // Post calls used to repost them.
+  uint64_t repost_batches;
+  // Times the last posted buffer was consumed. Until the next repost every
+  // incoming message is answered with an RNR NAK.
+  uint64_t starvations;
+  // SRQ limit events handled.
+  uint64_t limit_events;
+  // Buffers posted right now.
+  size_t posted;
+  // Buffers the ring aims to keep posted.
+  size_t depth;
+};
+
+/**
+ * @brief This class keeps a number of receive buffers, carved from one
+ * registered region, permanently posted on a Queue Pair or a Shared Receive
+ * Queue. Senders therefore find a posted buffer even while the receiving side
+ * is busy between awaits, instead of being stalled by RNR NAKs.
+ *
+ * Completed buffers are handed out as zero-copy views, oldest first. A buffer
+ * is posted again once its view is released; releases are collected and
+ * reposted in batches with one post call.
+ *
+ * The number of buffers kept posted, the depth, is all of them unless
+ * adapt_depth is enabled. On a Shared Receive Queue the ring also arms the
+ * SRQ limit, and refills and deepens itself when the limit event arrives,
+ * provided an async_event_poller runs on the device. One ring should own the
+ * limit of an SRQ.
+ *
+ * The ring must outlive its views and its pending recv operations. Posted
+ * buffers belong to the device until their Queue Pair stops receiving, so the
+ * ring should not be destroyed before that either.
+ *
+ */
+class recv_ring : public noncopyable {
+public:
+  /**
+   * @brief A received message. The buffer stays out of the ring until the
+   * view is destroyed.
+   *
+   */
+  class view : public noncopyable {
+    recv_ring *ring_;
+    uint32_t index_;
+
+  public:
+    view();
+    view(recv_ring *ring, uint32_t index);
+    view(view &&other);
+    view &operator=(view &&other);
+
+    /**
+     * @brief Get the received data.
+     *
+     * @return void* The start of the data, inside the registered region.
+     */
+    void *data() const;
+
+    /**
+     * @brief Get the length of the received data.
+     *
+     * @return uint32_t The length in bytes.
+     */
+    uint32_t size() const;
+
+    /**
+     * @brief Get the immediate value sent with the message, if any.
+     *
+     * @return std::optional<uint32_t> The immediate value.
+     */
+    std::optional<uint32_t> imm() const;
+
+    /**
+     * @brief Give the buffer back to the ring before the view is destroyed.
+     *
+     */
+    void release();
+
+    ~view();
+  };
+
+  class recv_awaitable {
+    recv_ring *ring_;
+    void *coroutine_addr_;
+    uint32_t index_;
+    friend class recv_ring;
+
+  public:
+    recv_awaitable(recv_ring *ring);
+    bool await_ready() noexcept;
+    bool await_suspend(std::coroutine_handle<> h) noexcept;
+    view await_resume();
+  };
+
+private:
+  std::shared_ptr<qp> qp_;
+  std::shared_ptr<srq> srq_;
+  std::shared_ptr<pd> pd_;
+  size_t buffer_size_;
+  size_t repost_batch_;
+  uint8_t *region_;
+  struct ibv_mr *mr_;
+  detail::completion_slab completions_;
+  std::vector<detail::completion_slot *> slots_;
+  detail::spinlock lock_;
+  std::deque<uint32_t> ready_;
+  std::deque<recv_awaitable *> waiters_;
+  std::vector<uint32_t> released_;
+  std::vector<struct ibv_recv_wr> repost_wr_;
+  std::vector<struct ibv_sge> repost_sge_;
+  recv_ring_stats stats_;
+  size_t min_depth_;
+  std::chrono::steady_clock::duration adapt_period_;
+  std::chrono::steady_clock::time_point last_adapt_;
+  uint64_t completions_at_adapt_;
+  double arrival_rate_;
+  bool limit_armed_;
+
+  recv_ring(std::shared_ptr<qp> qp, std::shared_ptr<srq> srq,
+            std::shared_ptr<pd> pd, size_t nr_buffers, size_t buffer_size,
+            size_t repost_batch);
+
+  /**
+   * @brief Delivers a completed receive to the oldest waiter, or queues it.
+   *
+   * @param slot The completion slot of the buffer.
+   * @return void* The coroutine of the waiter, or nullptr.
+   */
+  static void *on_complete(detail::completion_slot &slot);
+
+  /**
+   * @brief Returns a buffer to the ring and reposts the released buffers
+   * once enough have been collected or the ring runs low.
+   *
+   * @param index The index of the buffer.
+   */
+  void release(uint32_t index);
+
+  /**
+   * @brief Posts released buffers, up to the depth, with one post call. The
+   * caller must hold lock_.
+   *
+   */
+  void repost_locked();
+
+  /**
+   * @brief Resizes the depth from the arrival rate once per period. The
+   * caller must hold lock_.
+   *
+   */
+  void adapt_locked();
+
+  /**
+   * @brief Arms the SRQ limit again if it fired and the ring has refilled
+   * above it. The caller must not hold lock_.
+   *
+   */
+  void arm_limit();
+
+  /**
+   * @brief Refills and deepens the ring. Called on the async event thread.
+   *
+   */
+  void handle_limit_reached();
+
+public:
+  /**
+   * @brief Construct a recv ring on a Queue Pair and post all its buffers.
+   * If the Queue Pair has a Shared Receive Queue, they are posted there.
+   *
+   * @param qp The Queue Pair.
+   * @param nr_buffers The number of buffers. It should not exceed the depth
+   * of the receive queue.
+   * @param buffer_size The size of every buffer.
+   * @param repost_batch (Optional) The number of released buffers reposted
+   * together.
+   */
+  recv_ring(std::shared_ptr<qp> qp, size_t nr_buffers, size_t buffer_size,
+            size_t repost_batch = 16);
+
+  /**
+   * @brief Construct a recv ring on a Shared Receive Queue and post all its
+   * buffers.
+   *
+   * @param srq The Shared Receive Queue.
+   * @param nr_buffers The number of buffers. It should not exceed the depth
+   * of the queue.
+   * @param buffer_size The size of every buffer.
+   * @param repost_batch (Optional) The number of released buffers reposted
+   * together.
+   */
+  recv_ring(std::shared_ptr<srq> srq, size_t nr_buffers, size_t buffer_size,
+            size_t repost_batch = 16);
+
+  /**
+   * @brief Wait for the oldest received message not handed out yet.
+   *
+   * @return recv_awaitable A coroutine returning a view of the message.
+   */
+  [[nodiscard]] recv_awaitable recv();
+
+  /**
+   * @brief Repost all released buffers now, without waiting for a full
+   * batch.
+   *
+   */
+  void flush();
+
+  /**
+   * @brief Let the depth follow the arrival rate: once per period it is set
+   * to cover twice the arrivals of a period, between min_depth and the
+   * number of buffers. It is doubled at once whenever the ring runs dry or
+   * the SRQ limit is reached. Buffers above the depth stay idle.
+   *
+   * @param min_depth The smallest depth.
+   * @param period (Optional) How often the arrival rate is sampled.
+   */
+  void adapt_depth(size_t min_depth, std::chrono::microseconds period =
+                                         std::chrono::milliseconds(1));
+
+  /**
+   * @brief Get the counters of the ring.
+   *
+   * @return recv_ring_stats The counters.
+   */
+  recv_ring_stats stats();
+
+  ~recv_ring();
+};
+
+} // namespace rdmapp
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <latch>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/comp_channel.h"
+#include "rdmapp/cq.h"
+#include "rdmapp/device.h"
+#include "rdmapp/poll_batch.h"
+#include "rdmapp/poller_metrics.h"
+#include "rdmapp/task.h"
+
+#include "rdmapp/detail/cq_waiter.h"
+#include "rdmapp/detail/noncopyable.h"
+#include "rdmapp/detail/numa.h"
+#include "rdmapp/detail/spinlock.h"
+
+namespace rdmapp {
+
+/**
+ * @brief This class runs one completion queue and one poller per core. Every
+ * poller thread is pinned to its core and creates its completion queue,
+ * completion buffer and coroutine frames on the NUMA node of that core, so
+ * that a Queue Pair created on a shard and the coroutines spawned there
+ * stay local to it.
+ *
+ */
+class sharded_runtime : public noncopyable {
+public:
+  /**
+   * @brief A core of the runtime: its completion queue and the pinned thread
+   * polling it. Spawned coroutines run on that thread until they first
+   * suspend and are resumed there on completion.
+   *
+   */
+  class shard : public noncopyable {
+    int cpu_;
+    int node_;
+    detail::batch_sizer batch_;
+    std::chrono::nanoseconds spin_budget_;
+    std::shared_ptr<device> device_;
+    std::shared_ptr<comp_channel> channel_;
+    std::shared_ptr<cq> cq_;
+    detail::frame_pool *frames_;
+    struct ibv_wc *wc_;
+    std::unique_ptr<detail::cq_waiter> waiter_;
+    detail::poller_metrics metrics_;
+    detail::spinlock spawn_lock_;
+    std::deque<std::function<void()>> spawned_;
+    std::atomic<bool> has_spawned_;
+    std::atomic<bool> stopped_;
+    std::exception_ptr exception_;
+    std::jthread thread_;
+    void run(std::latch &ready);
+    void setup();
+    bool run_spawned();
+    friend class sharded_runtime;
+
+  public:
+    /**
+     * @brief Construct a new shard and start its thread. Returns once the
+     * thread has created its completion queue.
+     *
+     * @param device The device to use.
+     * @param cpu The CPU to pin the thread to.
+     * @param num_cqe The number of completion entries of the completion
+     * queue.
+     * @param batch_size The number of completion entries to poll at a time,
+     * or a range to adapt it within.
+     * @param spin_budget How long to spin without completions before
+     * sleeping on the completion channel.
+     */
+    shard(std::shared_ptr<device> device, int cpu, size_t num_cqe,
+          poll_batch batch_size, std::chrono::nanoseconds spin_budget);
+
+    /**
+     * @brief Get the completion queue of the shard. Queue Pairs using it as
+     * their send and recv CQ are served by this shard only.
+     *
+     * @return std::shared_ptr<cq> The completion queue.
+     */
+    std::shared_ptr<cq> cq_ptr() const;
+
+    /**
+     * @brief Get the CPU the shard is pinned to.
+     *
+     * @return int The CPU.
+     */
+    int cpu() const;
+
+    /**
+     * @brief Get the NUMA node of the shard.
+     *
+     * @return int The node, or -1 if unknown.
+     */
+    int node() const;
+
+    /**
+     * @brief Run a function on the shard thread.
+     *
+     * @param fn The function.
+     */
+    void post(std::function<void()> fn);
+
+    /**
+     * @brief Start a coroutine on the shard thread. Its frame, and the frames
+     * of the coroutines it awaits, are allocated on the node of the shard.
+     * The coroutine is detached.
+     *
+     * @param fn Returns the coroutine to start.
+     */
+    void spawn(std::function<task<void>()> fn);
+
+    /**
+     * @brief Get the metrics of the polling loop.
+     *
+     * @return poller_metrics_snapshot The metrics.
+     */
+    poller_metrics_snapshot metrics() const;
+
+    ~shard();
+  };
+
+private:
+  std::shared_ptr<device> device_;
+  std::vector<std::unique_ptr<shard>> shards_;
+
+public:
+  /**
+   * @brief Construct a new sharded runtime.
+   *
+   * @param device The device to use.
+   * @param cpus (Optional) The CPUs to run a shard on, one shard each. By
+   * default, every CPU of the NUMA node of the device, or every CPU if the
+   * node is unknown.
+   * @param num_cqe (Optional) The number of completion entries of every
+   * completion queue.
+   * @param batch_size (Optional) The number of completion entries to poll at
+   * a time, or a range to adapt it within (see poll_batch).
+   * @param spin_budget (Optional) How long a shard spins without completions
+   * or spawned work before sleeping. Never sleeps by default.
+   */
+  sharded_runtime(std::shared_ptr<device> device, std::vector<int> cpus = {},
+                  size_t num_cqe = 1024, poll_batch batch_size = 16,
+                  std::chrono::nanoseconds spin_budget =
+                      detail::cq_waiter::kSpinForever);
+
+  /**
+   * @brief Get the number of shards.
+   *
+   * @return size_t The number of shards.
+   */
+  size_t size() const;
+
+  /**
+   * @brief Get a shard.
+   *
+   * @param i The index of the shard.
+   * @return shard& The shard.
+   */
+  shard &operator[](size_t i);
+
+  /**
+   * @brief Get the shard of the calling thread.
+   *
+   * @return shard* The shard, or nullptr if not called from a shard thread.
+   */
+  static shard *current();
+
+  ~sharded_runtime();
+};
+
+} // namespace rdmapp
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
 
 #include <infiniband/verbs.h>
 
@@ -15,7 +18,21 @@ namespace rdmapp {
 class srq {
   struct ibv_srq *srq_;
   std::shared_ptr<pd> pd_;
+  size_t max_wr_;
+  size_t max_sge_;
+  std::mutex limit_mutex_;
+  std::function<void()> limit_handler_;
   friend class qp;
+  friend class ud_qp;
+  friend class recv_ring;
+  friend class async_event_poller;
+
+  /**
+   * @brief Called by the async event poller when the limit armed with
+   * arm_limit is reached.
+   *
+   */
+  void handle_limit_reached();
 
 public:
   /**
@@ -23,8 +40,43 @@ public:
    *
    * @param pd The protection domain to use.
    * @param max_wr The maximum number of outstanding work requests.
+   * @param max_sge The maximum number of scatter/gather entries per work
+   * request, within [1, min(qp_config::kMaxSge, max_srq_sge of the device)].
+   */
+  srq(std::shared_ptr<pd> pd, size_t max_wr = 1024, size_t max_sge = 1);
+
+  /**
+   * @brief Get the maximum number of scatter/gather entries per work request.
+   *
+   * @return size_t The maximum number of SGEs.
+   */
+  size_t max_sge() const;
+
+  /**
+   * @brief Get the number of work requests the queue can hold, as granted by
+   * the device.
+   *
+   * @return size_t The maximum number of outstanding work requests.
+   */
+  size_t max_wr() const;
+
+  /**
+   * @brief Arm the limit event. Once fewer than limit work requests are
+   * posted, the device raises IBV_EVENT_SRQ_LIMIT_REACHED and the limit is
+   * disarmed until armed again. The event is delivered by an
+   * async_event_poller on the device.
+   *
+   * @param limit The number of posted work requests to warn at.
+   */
+  void arm_limit(uint32_t limit);
+
+  /**
+   * @brief Set the function called on the async event thread when the limit
+   * is reached. It replaces the previous one; nullptr removes it.
+   *
+   * @param handler The handler.
    */
-  srq(std::shared_ptr<pd> pd, size_t max_wr = 1024);
+  void on_limit_reached(std::function<void()> handler);
 
   /**
    * @brief Destroy the srq object and the associated shared receive queue.
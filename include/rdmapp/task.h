@@ -6,6 +6,8 @@
 #include <future>
 #include <utility>
 
+#include "rdmapp/detail/numa.h"
+
 namespace rdmapp {
 
 template <class T> class value_returner {
@@ -57,6 +59,12 @@ template <class T> struct task {
       this->promise_.set_exception(std::current_exception());
     }
     promise_type() : future_(this->promise_.get_future()) {}
+    // Frames come from the NUMA-local pool of the calling thread, if any
+    // (see sharded_runtime::shard::spawn).
+    static void *operator new(size_t size) {
+      return detail::allocate_frame(size);
+    }
+    static void operator delete(void *ptr) { detail::deallocate_frame(ptr); }
     std::future<T> &get_future() { return future_; }
     void set_detached_task(std::coroutine_handle<promise_type> h) {
       this->release_detached_ = h;
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/buffer_pool.h"
+#include "rdmapp/cq.h"
+#include "rdmapp/device.h"
+#include "rdmapp/mr.h"
+#include "rdmapp/pd.h"
+#include "rdmapp/qp.h"
+#include "rdmapp/srq.h"
+
+#include "rdmapp/detail/completion_slab.h"
+#include "rdmapp/detail/noncopyable.h"
+
+namespace rdmapp {
+
+/**
+ * @brief The address of an Unreliable Datagram Queue Pair.
+ *
+ */
+struct ud_address {
+  uint16_t lid;
+  uint32_t qpn;
+  union ibv_gid gid;
+
+  ud_address() = default;
+  ud_address(uint16_t lid, uint32_t qpn, union ibv_gid const &gid);
+
+  /**
+   * @brief Construct an address from a peer header exchanged in the same
+   * format as Reliable Connection Queue Pairs (see ud_qp::serialize).
+   *
+   * @param remote_qp The deserialized peer.
+   */
+  explicit ud_address(deserialized_qp const &remote_qp);
+
+  bool operator==(ud_address const &other) const;
+};
+
+/**
+ * @brief The result of a datagram receive.
+ *
+ */
+struct ud_recv_result {
+  /**
+   * @brief The payload length, excluding the GRH area.
+   *
+   */
+  uint32_t length;
+
+  /**
+   * @brief The sender. Replies can be sent straight to it.
+   *
+   */
+  ud_address source;
+
+  /**
+   * @brief The immediate data, if any.
+   *
+   */
+  std::optional<uint32_t> imm;
+};
+
+/**
+ * @brief This class is an abstraction of an Unreliable Datagram Queue Pair. A
+ * single instance can exchange messages of up to one path MTU with any number
+ * of peers. Address handles are created on first use and cached.
+ *
+ */
+class ud_qp : public noncopyable, public std::enable_shared_from_this<ud_qp> {
+  static std::atomic<uint32_t> next_sq_psn;
+
+  struct ah_hash {
+    size_t operator()(ud_address const &address) const;
+  };
+
+  struct ibv_qp *qp_;
+  std::shared_ptr<pd> pd_;
+  std::shared_ptr<cq> recv_cq_;
+  std::shared_ptr<cq> send_cq_;
+  std::shared_ptr<srq> srq_;
+  qp_config config_;
+  detail::completion_slab completions_;
+  bool cqes_reserved_;
+  uint32_t qkey_;
+  uint32_t sq_psn_;
+  std::vector<uint8_t> user_data_;
+  std::shared_mutex ah_mutex_;
+  std::unordered_map<ud_address, struct ibv_ah *, ah_hash> ah_cache_;
+
+  /**
+   * @brief Creates the Queue Pair and brings it to the RTS state. Datagram
+   * Queue Pairs need no peer to do so.
+   *
+   */
+  void create();
+
+  /**
+   * @brief Reserve the send and receive depth of the Queue Pair on its
+   * completion queues, so that they cannot overflow.
+   *
+   */
+  void reserve_cqes();
+
+  /**
+   * @brief Release the depth reserved by reserve_cqes().
+   *
+   */
+  void release_cqes();
+
+  void destroy();
+
+  /**
+   * @brief Looks up the address handle of a peer, creating it on a miss.
+   *
+   * @param address The peer.
+   * @return struct ibv_ah* The address handle.
+   */
+  struct ibv_ah *ah(ud_address const &address);
+
+public:
+  /**
+   * @brief The size of the Global Routing Header area that precedes every
+   * received payload. Receive buffers must reserve it.
+   *
+   */
+  static constexpr size_t kGrhSize = sizeof(struct ibv_grh);
+
+  /**
+   * @brief The Q_Key used by default. Peers must agree on it.
+   *
+   */
+  static constexpr uint32_t kDefaultQkey = 0x11111111;
+
+  class send_awaitable {
+    detail::completion_slot *slot_ = nullptr;
+    std::shared_ptr<ud_qp> qp_;
+    buffer_pool::buffer bounce_;
+    std::shared_ptr<local_mr> local_mr_;
+    std::exception_ptr exception_;
+    ud_address peer_;
+    void *buffer_;
+    size_t length_;
+    std::optional<uint32_t> imm_;
+
+  public:
+    send_awaitable(std::shared_ptr<ud_qp> qp, ud_address const &peer,
+                   std::shared_ptr<local_mr> local_mr, size_t length,
+                   std::optional<uint32_t> imm);
+    send_awaitable(std::shared_ptr<ud_qp> qp, ud_address const &peer,
+                   void *buffer, size_t length, std::optional<uint32_t> imm);
+    bool await_ready() const noexcept;
+    bool await_suspend(std::coroutine_handle<> h) noexcept;
+    uint32_t await_resume() const;
+  };
+
+  class recv_awaitable {
+    detail::completion_slot *slot_ = nullptr;
+    std::shared_ptr<ud_qp> qp_;
+    std::shared_ptr<local_mr> local_mr_;
+    std::exception_ptr exception_;
+
+  public:
+    recv_awaitable(std::shared_ptr<ud_qp> qp,
+                   std::shared_ptr<local_mr> local_mr);
+    bool await_ready() const noexcept;
+    bool await_suspend(std::coroutine_handle<> h) noexcept;
+    ud_recv_result await_resume() const;
+  };
+
+  /**
+   * @brief Construct a new Unreliable Datagram Queue Pair. It is ready to
+   * send and receive once constructed.
+   *
+   * @param pd The protection domain of the new Queue Pair.
+   * @param cq The completion queue of both send and recv work completions.
+   * @param srq (Optional) If set, all recv work requests will be posted to this
+   * SRQ.
+   * @param config (Optional) The creation-time attributes. SGE counts above 1
+   * and the RDMA read/atomic settings do not apply to datagrams.
+   * @param qkey (Optional) The Q_Key of the Queue Pair.
+   */
+  ud_qp(std::shared_ptr<pd> pd, std::shared_ptr<cq> cq,
+        std::shared_ptr<srq> srq = nullptr, qp_config const &config = {},
+        uint32_t qkey = kDefaultQkey);
+
+  /**
+   * @brief Construct a new Unreliable Datagram Queue Pair. It is ready to
+   * send and receive once constructed.
+   *
+   * @param pd The protection domain of the new Queue Pair.
+   * @param recv_cq The completion queue of recv work completions.
+   * @param send_cq The completion queue of send work completions.
+   * @param srq (Optional) If set, all recv work requests will be posted to this
+   * SRQ.
+   * @param config (Optional) The creation-time attributes. SGE counts above 1
+   * and the RDMA read/atomic settings do not apply to datagrams.
+   * @param qkey (Optional) The Q_Key of the Queue Pair.
+   */
+  ud_qp(std::shared_ptr<pd> pd, std::shared_ptr<cq> recv_cq,
+        std::shared_ptr<cq> send_cq, std::shared_ptr<srq> srq = nullptr,
+        qp_config const &config = {}, uint32_t qkey = kDefaultQkey);
+
+  /**
+   * @brief This function sends a datagram to a peer.
+   *
+   * @param peer The destination.
+   * @param local_mr Registered memory region holding the payload, at most one
+   * path MTU long.
+   * @return send_awaitable A coroutine returning length of the data sent.
+   */
+  [[nodiscard]] send_awaitable send(ud_address const &peer,
+                                    std::shared_ptr<local_mr> local_mr);
+
+  /**
+   * @brief This function sends a datagram with immediate data to a peer.
+   *
+   * @param peer The destination.
+   * @param local_mr Registered memory region holding the payload, at most one
+   * path MTU long.
+   * @param imm The immediate data.
+   * @return send_awaitable A coroutine returning length of the data sent.
+   */
+  [[nodiscard]] send_awaitable send_with_imm(ud_address const &peer,
+                                             std::shared_ptr<local_mr> local_mr,
+                                             uint32_t imm);
+
+  /**
+   * @brief This function sends a datagram to a peer from a raw buffer. The
+   * buffer is posted inline if it fits, copied into a bounce buffer if it is
+   * small enough, and registered for the duration of the send otherwise.
+   *
+   * @param peer The destination.
+   * @param buffer The payload, at most one path MTU long.
+   * @param length The length of the payload.
+   * @return send_awaitable A coroutine returning length of the data sent.
+   */
+  [[nodiscard]] send_awaitable send(ud_address const &peer, void *buffer,
+                                    size_t length);
+
+  /**
+   * @brief This function posts a recv request for a datagram. The first
+   * kGrhSize bytes of the memory region receive the Global Routing Header and
+   * the payload follows it.
+   *
+   * @param local_mr Registered memory region, at least kGrhSize bytes plus the
+   * largest expected payload.
+   * @return recv_awaitable A coroutine returning the payload length, the
+   * sender and the immediate data if any.
+   */
+  [[nodiscard]] recv_awaitable recv(std::shared_ptr<local_mr> local_mr);
+
+  /**
+   * @brief This function serializes the address of the Queue Pair in the same
+   * format as qp::serialize, so that peers can read it with
+   * deserialized_qp::deserialize.
+   *
+   * @return std::vector<uint8_t> The serialized address.
+   */
+  std::vector<uint8_t> serialize() const;
+
+  /**
+   * @brief This function returns the address of the Queue Pair.
+   *
+   * @return ud_address The address.
+   */
+  ud_address address() const;
+
+  /**
+   * @brief This function provides access to the extra user data sent along
+   * with the serialized address.
+   *
+   * @return std::vector<uint8_t>& The user data.
+   */
+  std::vector<uint8_t> &user_data();
+
+  /**
+   * @brief This function returns the number of cached address handles.
+   *
+   * @return size_t The number of peers an address handle was created for.
+   */
+  size_t ah_cache_size();
+
+  /**
+   * @brief This function returns the maximum datagram payload, which is the
+   * path MTU.
+   *
+   * @return size_t The maximum payload in bytes.
+   */
+  size_t max_message_size() const;
+
+  std::shared_ptr<pd> pd_ptr() const;
+
+  ~ud_qp();
+};
+
+} // namespace rdmapp
@@ -0,0 +1,92 @@
+#include "rdmapp/async_event_poller.h"
+
+#include <cerrno>
+#include <exception>
+#include <memory>
+
+#include <fcntl.h>
+#include <poll.h>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/error.h"
+#include "rdmapp/srq.h"
+
+#include "rdmapp/detail/debug.h"
+
+namespace rdmapp {
+
+// How long the thread sleeps in poll before checking whether it is stopped.
+static constexpr int kPollTimeoutMs = 100;
+
+async_event_poller::async_event_poller(std::shared_ptr<device> device)
+    : device_(device), stopped_(false) {
+  // Non-blocking, so that the thread never hangs in ibv_get_async_event when
+  // asked to stop.
+  auto const fd = device_->ctx_->async_fd;
+  auto const flags = ::fcntl(fd, F_GETFL);
+  check_errno(flags, "failed to get async fd flags");
+  check_errno(::fcntl(fd, F_SETFL, flags | O_NONBLOCK),
+              "failed to make async fd non-blocking");
+  poller_thread_ = std::jthread(&async_event_poller::worker, this);
+}
+
+async_event_poller::~async_event_poller() {
+  stopped_ = true;
+  poller_thread_.join();
+}
+
+void async_event_poller::process_event(struct ibv_async_event const &event) {
+  switch (event.event_type) {
+  case IBV_EVENT_SRQ_LIMIT_REACHED: {
+    auto srq = static_cast<rdmapp::srq *>(event.element.srq->srq_context);
+    try {
+      srq->handle_limit_reached();
+    } catch (std::exception const &e) {
+      RDMAPP_LOG_ERROR("srq limit handler failed: %s", e.what());
+    }
+    break;
+  }
+  case IBV_EVENT_SRQ_ERR:
+  case IBV_EVENT_QP_FATAL:
+  case IBV_EVENT_QP_REQ_ERR:
+  case IBV_EVENT_QP_ACCESS_ERR:
+  case IBV_EVENT_CQ_ERR:
+  case IBV_EVENT_DEVICE_FATAL:
+  case IBV_EVENT_PORT_ERR:
+    RDMAPP_LOG_ERROR("async event: %s",
+                     ::ibv_event_type_str(event.event_type));
+    break;
+  default:
+    RDMAPP_LOG_DEBUG("async event: %s",
+                     ::ibv_event_type_str(event.event_type));
+    break;
+  }
+}
+
+void async_event_poller::worker() {
+  struct pollfd pfd = {};
+  pfd.fd = device_->ctx_->async_fd;
+  pfd.events = POLLIN;
+  while (!stopped_) {
+    auto const rc = ::poll(&pfd, 1, kPollTimeoutMs);
+    if (rc < 0) [[unlikely]] {
+      if (errno == EINTR) {
+        continue;
+      }
+      RDMAPP_LOG_ERROR("async event poller stopped: poll failed (errno=%d)",
+                       errno);
+      return;
+    }
+    if (rc == 0) {
+      continue;
+    }
+    struct ibv_async_event event;
+    while (::ibv_get_async_event(device_->ctx_, &event) == 0) {
+      process_event(event);
+      ::ibv_ack_async_event(&event);
+    }
+  }
+}
+
+} // namespace rdmapp
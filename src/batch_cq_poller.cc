@@ -6,32 +6,61 @@
 #include <coroutine>
 #include <iostream>
 #include <thread>
+#include <utility>
+#include <vector>
 #include <infiniband/verbs.h>
 
 #include "rdmapp/executor.h"
 
+#include "rdmapp/detail/completion.h"
 #include "rdmapp/detail/debug.h"
 
 namespace rdmapp {
 
-batch_cq_poller::batch_cq_poller(std::vector<std::shared_ptr<cq>>& cqs, bool is_recv, size_t batch_size)
-    : batch_cq_poller(cqs, is_recv, std::make_shared<executor>(), batch_size) {}
-
-batch_cq_poller::batch_cq_poller(std::vector<std::shared_ptr<cq>>& cqs, bool is_recv, std::shared_ptr<executor> executor,
-                     size_t batch_size)
-    : cqs_(cqs), stopped_(false), connected_(false), executor_(executor), wc_vec_(batch_size) {
-  if (is_recv) {
-    poller_thread_ = std::jthread(&batch_cq_poller::recv_worker, this);
-  } else {
-    poller_thread_ = std::jthread(&batch_cq_poller::send_worker, this);
-  } 
+batch_cq_poller::batch_cq_poller(std::vector<std::shared_ptr<cq>>& cqs, bool is_recv, poll_batch batch_size,
+                                 std::chrono::nanoseconds spin_budget)
+    : batch_cq_poller(cqs, is_recv, std::make_shared<executor>(), batch_size,
+                      spin_budget) {}
+
+batch_cq_poller::batch_cq_poller(std::vector<std::shared_ptr<cq>>& cqs, bool, std::shared_ptr<executor> executor,
+                     poll_batch batch_size, std::chrono::nanoseconds spin_budget)
+    : stopped_(false), connected_(false), executor_(executor), wc_vec_(batch_size.max),
+      batch_(batch_size), scheduler_(batch_size.max),
+      waiter_(cqs, spin_budget) {
+  for (auto &cq : cqs) {
+    scheduler_.add(cq);
+  }
+  scheduler_.apply();
+  poller_thread_ = std::jthread(&batch_cq_poller::worker, this);
 }
 
 batch_cq_poller::~batch_cq_poller() {
   stopped_ = true;
+  waiter_.wake();
   poller_thread_.join();
 }
 
+wait_stats batch_cq_poller::stats() const { return waiter_.stats(); }
+
+poller_metrics_snapshot batch_cq_poller::metrics() const {
+  return metrics_.snapshot();
+}
+
+void batch_cq_poller::add_cq(std::shared_ptr<cq> cq, uint32_t weight) {
+  scheduler_.add(std::move(cq), weight);
+  waiter_.wake();
+}
+
+void batch_cq_poller::remove_cq(std::shared_ptr<cq> const &cq) {
+  scheduler_.remove(cq);
+  waiter_.wake();
+}
+
+std::vector<std::pair<std::shared_ptr<cq>, cq_service_stats>>
+batch_cq_poller::cq_stats() const {
+  return scheduler_.stats();
+}
+
 void batch_cq_poller::connect_done() {
   connected_ = true;
 }
@@ -39,18 +68,16 @@ void batch_cq_poller::connect_done() {
 void batch_cq_poller::connect_loop() {
   while (!connected_) {
     try {
-      for (auto &cq_ : cqs_) {
+      for (auto &cq_ : scheduler_.cqs()) {
         auto nr_wc = cq_->poll(wc_vec_);
         if (nr_wc != 0) {
-          for (size_t i = 0; i < nr_wc; ++i) {
-            auto &wc = wc_vec_[i];
-            struct ibv_wc *wc_ptr = reinterpret_cast<struct ibv_wc *>(wc.wr_id);
-            *wc_ptr = wc;
-            std::coroutine_handle<> h = std::coroutine_handle<>::from_address(
-                *reinterpret_cast<void **>(wc_ptr + 1));
-            h.resume();
-          }
+          detail::dispatch_wcs(*cq_, wc_vec_.data(), nr_wc, [](void *h_ptr) {
+            std::coroutine_handle<>::from_address(h_ptr).resume();
+          });
         }
+        detail::flush_sends(*cq_, [](void *h_ptr) {
+          std::coroutine_handle<>::from_address(h_ptr).resume();
+        });
       }
     } catch (...) {
       stopped_ = true;
@@ -59,50 +86,40 @@ void batch_cq_poller::connect_loop() {
   }
 }
 
-void batch_cq_poller::recv_worker() {
-  connect_loop();
-  auto st = std::chrono::high_resolution_clock::now();
-  auto st2 = std::chrono::high_resolution_clock::now();
-  int tot = 0;
-  while (!stopped_) {
-    try {
-      for (auto &cq_ : cqs_) {
-        auto nr_wc = cq_->poll(wc_vec_);
-        tot++;
-        if (nr_wc != 0) {
-          auto et = std::chrono::high_resolution_clock::now();
-          auto elapsed1 = std::chrono::duration_cast<std::chrono::nanoseconds>(st2 - st);
-          auto elapsed2 = std::chrono::duration_cast<std::chrono::nanoseconds>(et - st2);
-          std::cout << nr_wc << " " << tot << " " << elapsed1.count() << " " << elapsed2.count() << "\n";
-          tot = 0;
-          st = et;
-          for (size_t i = 0; i < nr_wc; ++i) {
-            auto &wc = wc_vec_[i];
-            struct ibv_wc *wc_ptr = reinterpret_cast<struct ibv_wc *>(wc.wr_id);
-            *wc_ptr = wc;
-            auto h_ptr = *reinterpret_cast<void **>(wc_ptr + 1);
-            executor_->process_wc(h_ptr);
-          }
-          st2 = std::chrono::high_resolution_clock::now();
+bool batch_cq_poller::poll_round() {
+  if (scheduler_.sync()) {
+    waiter_.update_cqs(scheduler_.cqs());
+  }
+  auto const batch = batch_.size();
+  auto const progress = scheduler_.round(
+      waiter_.armed(), batch, [&](cq &cq, size_t max) {
+        auto nr_wc = cq.poll(wc_vec_.data(), max);
+        if (max == batch) {
+          batch_.update(nr_wc);
         }
-      }
-    } catch (...) {
-      std::cout << "recv cq_poller stopped" << std::endl;
-      stopped_ = true;
-      return;
-    }
+        metrics_.dispatch(cq, wc_vec_.data(), nr_wc,
+                          [this](void *h_ptr, struct ibv_wc const &wc) {
+                            executor_->process_wc(h_ptr, wc.qp_num);
+                          });
+        return nr_wc;
+      });
+  for (auto &cq : scheduler_.cqs()) {
+    detail::flush_sends(*cq, [this](void *h_ptr) {
+      executor_->process_wc(h_ptr);
+    });
   }
+  return progress;
 }
 
-void batch_cq_poller::send_worker() {
+void batch_cq_poller::worker() {
+  waiter_.bind_thread();
   connect_loop();
   while (!stopped_) {
     try {
-      for (auto &cq_ : cqs_) {
-        auto nr_wc = cq_->poll(wc_vec_);
-      }
+      auto const progress = poll_round();
+      waiter_.idle(progress, stopped_);
     } catch (...) {
-      std::cout << "send cq_poller stopped" << std::endl;
+      std::cout << "cq_poller stopped" << std::endl;
       stopped_ = true;
       return;
     }
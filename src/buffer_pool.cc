@@ -0,0 +1,224 @@
+#include "rdmapp/buffer_pool.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <utility>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/error.h"
+
+#include "rdmapp/detail/debug.h"
+
+namespace rdmapp {
+
+namespace {
+
+// The live pools and the free cache indices, shared by all pools.
+struct cache_registry {
+  std::mutex mutex;
+  std::vector<buffer_pool *> pools;
+  std::vector<size_t> free_indices;
+  size_t next_index = 0;
+};
+
+} // namespace
+
+static cache_registry &registry() {
+  static cache_registry registry;
+  return registry;
+}
+
+buffer_pool::cache_index::cache_index() {
+  auto &r = registry();
+  std::lock_guard lock(r.mutex);
+  if (!r.free_indices.empty()) {
+    value = r.free_indices.back();
+    r.free_indices.pop_back();
+  } else {
+    value = r.next_index++;
+  }
+}
+
+buffer_pool::cache_index::~cache_index() {
+  if (value >= kMaxThreadCaches) {
+    // Only indices of real caches are given back, so that the next threads
+    // get those first.
+    return;
+  }
+  auto &r = registry();
+  std::lock_guard lock(r.mutex);
+  for (auto pool : r.pools) {
+    pool->flush_cache(value);
+  }
+  r.free_indices.push_back(value);
+}
+
+static inline uint32_t size_class_of(size_t size) {
+  return std::bit_width(
+             (std::max(size, buffer_pool::kMinBufferSize) - 1) /
+             buffer_pool::kMinBufferSize);
+}
+
+buffer_pool::buffer::buffer() : pool_(nullptr), addr_(nullptr), size_class_(0) {}
+
+buffer_pool::buffer::buffer(buffer_pool *pool, void *addr, uint32_t size_class)
+    : pool_(pool), addr_(addr), size_class_(size_class) {}
+
+buffer_pool::buffer::buffer(buffer &&other)
+    : pool_(std::exchange(other.pool_, nullptr)),
+      addr_(std::exchange(other.addr_, nullptr)),
+      size_class_(other.size_class_) {}
+
+buffer_pool::buffer &buffer_pool::buffer::operator=(buffer &&other) {
+  if (this != &other) {
+    if (pool_ != nullptr) {
+      pool_->release(addr_, size_class_);
+    }
+    pool_ = std::exchange(other.pool_, nullptr);
+    addr_ = std::exchange(other.addr_, nullptr);
+    size_class_ = other.size_class_;
+  }
+  return *this;
+}
+
+buffer_pool::buffer::~buffer() {
+  if (pool_ != nullptr) {
+    pool_->release(addr_, size_class_);
+  }
+}
+
+void *buffer_pool::buffer::addr() const { return addr_; }
+
+uint32_t buffer_pool::buffer::lkey() const { return pool_->mr_->lkey; }
+
+buffer_pool::buffer::operator bool() const { return pool_ != nullptr; }
+
+buffer_pool::buffer_pool(struct ibv_pd *pd, size_t max_size,
+                         size_t buffers_per_class)
+    : mr_(nullptr), region_(nullptr),
+      max_size_(std::bit_ceil(std::max(max_size, kMinBufferSize))),
+      nr_classes_(size_class_of(max_size_) + 1), caches_() {
+  if (nr_classes_ > kMaxClasses) [[unlikely]] {
+    throw_with("buffer pool size classes exceed %lu bytes",
+               kMinBufferSize << (kMaxClasses - 1));
+  }
+  size_t region_size = 0;
+  for (uint32_t i = 0; i < nr_classes_; ++i) {
+    region_size += (kMinBufferSize << i) * buffers_per_class;
+  }
+  region_size = (region_size + 4095) & ~static_cast<size_t>(4095);
+  region_ = static_cast<uint8_t *>(std::aligned_alloc(4096, region_size));
+  check_ptr(region_, "failed to allocate buffer pool");
+  mr_ = ::ibv_reg_mr(pd, region_, region_size, IBV_ACCESS_LOCAL_WRITE);
+  if (mr_ == nullptr) [[unlikely]] {
+    std::free(region_);
+    check_ptr(mr_, "failed to reg buffer pool");
+  }
+  auto block = region_;
+  for (uint32_t i = 0; i < nr_classes_; ++i) {
+    free_[i].reserve(buffers_per_class);
+    for (size_t j = 0; j < buffers_per_class; ++j) {
+      free_[i].push_back(block);
+      block += kMinBufferSize << i;
+    }
+  }
+  {
+    auto &r = registry();
+    std::lock_guard lock(r.mutex);
+    r.pools.push_back(this);
+  }
+  RDMAPP_LOG_DEBUG("created buffer pool of %lu bytes, classes up to %lu bytes",
+                   region_size, max_size_);
+}
+
+buffer_pool::thread_cache *buffer_pool::local_cache() {
+  static thread_local cache_index const index;
+  if (index.value >= kMaxThreadCaches) [[unlikely]] {
+    return nullptr;
+  }
+  return &caches_[index.value];
+}
+
+void buffer_pool::flush_cache(size_t index) {
+  auto &cache = caches_[index];
+  std::lock_guard lock(mutex_);
+  for (uint32_t i = 0; i < nr_classes_; ++i) {
+    free_[i].insert(free_[i].end(), cache.blocks[i],
+                    cache.blocks[i] + cache.count[i]);
+    cache.count[i] = 0;
+  }
+}
+
+buffer_pool::buffer buffer_pool::acquire(size_t size) {
+  if (size > max_size_) {
+    return buffer();
+  }
+  auto const size_class = size_class_of(size);
+  auto cache = local_cache();
+  if (cache == nullptr) [[unlikely]] {
+    std::lock_guard lock(mutex_);
+    if (free_[size_class].empty()) {
+      return buffer();
+    }
+    auto addr = free_[size_class].back();
+    free_[size_class].pop_back();
+    return buffer(this, addr, size_class);
+  }
+  auto &count = cache->count[size_class];
+  if (count == 0) {
+    // Refill half of the cache at once to amortize the lock.
+    std::lock_guard lock(mutex_);
+    auto &free = free_[size_class];
+    auto const nr = std::min(free.size(), kThreadCacheDepth / 2);
+    std::copy(free.end() - nr, free.end(), cache->blocks[size_class]);
+    free.resize(free.size() - nr);
+    count = nr;
+    if (count == 0) {
+      return buffer();
+    }
+  }
+  return buffer(this, cache->blocks[size_class][--count], size_class);
+}
+
+void buffer_pool::release(void *addr, uint32_t size_class) {
+  auto cache = local_cache();
+  if (cache == nullptr) [[unlikely]] {
+    std::lock_guard lock(mutex_);
+    free_[size_class].push_back(addr);
+    return;
+  }
+  auto &count = cache->count[size_class];
+  if (count == kThreadCacheDepth) {
+    // Buffers freed by a poller thread flow back to the shared lists.
+    std::lock_guard lock(mutex_);
+    auto const nr = kThreadCacheDepth / 2;
+    count -= nr;
+    free_[size_class].insert(free_[size_class].end(),
+                             cache->blocks[size_class] + count,
+                             cache->blocks[size_class] + count + nr);
+  }
+  cache->blocks[size_class][count++] = addr;
+}
+
+size_t buffer_pool::max_size() const { return max_size_; }
+
+buffer_pool::~buffer_pool() {
+  {
+    auto &r = registry();
+    std::lock_guard lock(r.mutex);
+    std::erase(r.pools, this);
+  }
+  if (mr_ != nullptr) {
+    if (auto rc = ::ibv_dereg_mr(mr_); rc != 0) [[unlikely]] {
+      RDMAPP_LOG_ERROR("failed to dereg buffer pool mr %p",
+                       reinterpret_cast<void *>(mr_));
+    }
+  }
+  std::free(region_);
+}
+
+} // namespace rdmapp
@@ -0,0 +1,73 @@
+#include "rdmapp/comp_channel.h"
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/cq.h"
+#include "rdmapp/error.h"
+
+#include "rdmapp/detail/debug.h"
+
+namespace rdmapp {
+
+comp_channel::comp_channel(std::shared_ptr<device> device)
+    : device_(device), channel_(nullptr), wake_fd_(-1), sleepers_(0) {
+  channel_ = ::ibv_create_comp_channel(device_->ctx_);
+  check_ptr(channel_, "failed to create comp channel");
+  // Non-blocking, so that draining stops once no event is left.
+  auto const flags = ::fcntl(channel_->fd, F_GETFL);
+  if (flags < 0 || ::fcntl(channel_->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+      [[unlikely]] {
+    auto const saved_errno = errno;
+    ::ibv_destroy_comp_channel(channel_);
+    errno = saved_errno;
+    check_errno(-1, "failed to make comp channel non-blocking");
+  }
+  wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_ < 0) [[unlikely]] {
+    auto const saved_errno = errno;
+    ::ibv_destroy_comp_channel(channel_);
+    errno = saved_errno;
+    check_errno(-1, "failed to create comp channel eventfd");
+  }
+  RDMAPP_LOG_TRACE("created comp channel fd=%d", channel_->fd);
+}
+
+int comp_channel::fd() const { return channel_->fd; }
+
+void comp_channel::wake() {
+  uint64_t const one = 1;
+  if (::write(wake_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN)
+      [[unlikely]] {
+    RDMAPP_LOG_ERROR("failed to wake comp channel: %s", strerror(errno));
+  }
+}
+
+void comp_channel::drain() {
+  struct ibv_cq *ev_cq = nullptr;
+  void *ev_ctx = nullptr;
+  while (::ibv_get_cq_event(channel_, &ev_cq, &ev_ctx) == 0) {
+    static_cast<cq *>(ev_ctx)->ack_event();
+  }
+  uint64_t count = 0;
+  while (::read(wake_fd_, &count, sizeof(count)) > 0) {
+  }
+}
+
+comp_channel::~comp_channel() {
+  ::close(wake_fd_);
+  if (auto rc = ::ibv_destroy_comp_channel(channel_); rc != 0) [[unlikely]] {
+    RDMAPP_LOG_ERROR("failed to destroy comp channel: %s", strerror(rc));
+  } else {
+    RDMAPP_LOG_TRACE("destroyed comp channel");
+  }
+}
+
+} // namespace rdmapp
@@ -0,0 +1,138 @@
+#include "rdmapp/detail/completion_slab.h"
+
+#include <algorithm>
+#include <bit>
+#include <deque>
+#include <mutex>
+
+#include "rdmapp/error.h"
+
+#include "rdmapp/detail/debug.h"
+
+namespace rdmapp {
+namespace detail {
+
+std::atomic<completion_slab::record *>
+    completion_slab::registry[kMaxSlabs] = {};
+
+// Destroyed slabs leave their id here, oldest first. An id is only reused
+// once this many others were freed after it, so that the completions still
+// in flight for it are long gone by then.
+static constexpr size_t kIdQuarantine = 64;
+
+static std::mutex slab_ids_mutex;
+static std::deque<uint32_t> free_slab_ids;
+static uint32_t next_slab_id = 0;
+
+static uint32_t allocate_slab_id() {
+  std::lock_guard lock(slab_ids_mutex);
+  if (free_slab_ids.size() > kIdQuarantine ||
+      (next_slab_id == completion_slab::kMaxSlabs && !free_slab_ids.empty())) {
+    auto const id = free_slab_ids.front();
+    free_slab_ids.pop_front();
+    return id;
+  }
+  if (next_slab_id == completion_slab::kMaxSlabs) [[unlikely]] {
+    throw_with("too many completion slabs, at most %lu",
+               completion_slab::kMaxSlabs);
+  }
+  return next_slab_id++;
+}
+
+completion_slab::completion_slab(size_t chunk_size)
+    : id_(allocate_slab_id()), timed_(false) {
+  record_ = registry[id_].load(std::memory_order_acquire);
+  if (record_ == nullptr) {
+    record_ = new record();
+    record_->chunk_shift =
+        std::bit_width(std::bit_ceil(std::max<size_t>(chunk_size, 64))) - 1;
+    record_->nr_chunks = 0;
+    registry[id_].store(record_, std::memory_order_release);
+  }
+  chunk_shift_ = record_->chunk_shift;
+  auto const nr_slots = static_cast<uint32_t>(record_->nr_chunks
+                                              << chunk_shift_);
+  if (nr_slots == 0) {
+    grow_locked();
+    return;
+  }
+  // Adopted slots keep their generation.
+  free_.reserve(nr_slots);
+  for (uint32_t i = nr_slots; i-- > 0;) {
+    free_.push_back(i);
+  }
+}
+
+void completion_slab::grow_locked() {
+  if (record_->nr_chunks == kMaxChunks) [[unlikely]] {
+    throw_with("completion slab exhausted with %lu slots",
+               kMaxChunks << chunk_shift_);
+  }
+  auto const chunk_size = static_cast<uint32_t>(1) << chunk_shift_;
+  auto chunk = new completion_slot[chunk_size];
+  auto const base =
+      static_cast<uint32_t>(record_->nr_chunks << chunk_shift_);
+  free_.reserve(free_.size() + chunk_size);
+  // Pushed in reverse so that the lowest indices are handed out first.
+  for (uint32_t i = chunk_size; i-- > 0;) {
+    chunk[i].coroutine_addr = nullptr;
+    chunk[i].handler = nullptr;
+    chunk[i].posted_at = 0;
+    chunk[i].state.store(0, std::memory_order_relaxed);
+    chunk[i].index = base + i;
+    free_.push_back(base + i);
+  }
+  record_->chunks[record_->nr_chunks++].store(chunk,
+                                              std::memory_order_release);
+  RDMAPP_LOG_TRACE("completion slab %u grew to %lu slots", id_,
+                   record_->nr_chunks << chunk_shift_);
+}
+
+completion_slot *completion_slab::acquire(void *coroutine_addr,
+                                          completion_handler handler) {
+  std::lock_guard lock(lock_);
+  if (free_.empty()) [[unlikely]] {
+    grow_locked();
+  }
+  auto s = slot(free_.back());
+  free_.pop_back();
+  s->coroutine_addr = coroutine_addr;
+  s->handler = handler;
+  s->posted_at = timed_ ? rdtsc() : 0;
+  s->state.store(s->state.load(std::memory_order_relaxed) | 1,
+                 std::memory_order_release);
+  return s;
+}
+
+void completion_slab::release(completion_slot *slot) {
+  // Bump the generation and clear the pending bit at once.
+  auto const state = slot->state.load(std::memory_order_relaxed);
+  slot->state.store((state | 1) + 1, std::memory_order_release);
+  slot->coroutine_addr = nullptr;
+  std::lock_guard lock(lock_);
+  free_.push_back(slot->index);
+}
+
+completion_slab::~completion_slab() {
+  auto const nr_slots = record_->nr_chunks << chunk_shift_;
+  if (free_.size() != nr_slots) [[unlikely]] {
+    RDMAPP_LOG_ERROR("completion slab %u destroyed with %lu pending slots", id_,
+                     nr_slots - free_.size());
+  }
+  // Move every pending slot to a new generation, so that its late
+  // completions are dropped. The chunks stay with the id (see record).
+  for (uint32_t i = 0; i < nr_slots; ++i) {
+    auto s = slot(i);
+    auto const state = s->state.load(std::memory_order_relaxed);
+    if (state & 1) {
+      s->state.store((state | 1) + 1, std::memory_order_release);
+    }
+    s->coroutine_addr = nullptr;
+    s->handler = nullptr;
+  }
+  std::lock_guard lock(slab_ids_mutex);
+  free_slab_ids.push_back(id_);
+}
+
+} // namespace detail
+} // namespace rdmapp
@@ -1,45 +1,330 @@
 #include "rdmapp/cq.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <cstdio>
 #include <cstring>
+#include <mutex>
+#include <shared_mutex>
 #include <stdexcept>
+#include <thread>
 #include <vector>
 
 #include <infiniband/verbs.h>
 
 #include "rdmapp/error.h"
+#include "rdmapp/qp.h"
 
 #include "rdmapp/detail/debug.h"
 
 namespace rdmapp {
 
-cq::cq(std::shared_ptr<device> device, size_t nr_cqe) : device_(device) {
-  cq_ = ::ibv_create_cq(device->ctx_, nr_cqe, this, nullptr, 0);
-  check_ptr(cq_, "failed to create cq");
+// Completion events acknowledged at once.
+static constexpr uint32_t kEventAckBatch = 64;
+
+// Completion timestamps are converted with a clock pairing at most this old.
+static constexpr std::chrono::milliseconds kCalibrationPeriod(10);
+
+cq::cq(std::shared_ptr<device> device, size_t nr_cqe,
+       std::shared_ptr<comp_channel> channel, bool timestamps)
+    : device_(device), channel_(channel), cq_(nullptr), cq_ex_(nullptr),
+      timestamps_(timestamp_source::none), poll_tick_(0),
+      hca_mask_(device->device_attr_ex_.completion_timestamp_mask),
+      hca_ref_(0), tick_ref_(0), ticks_per_hca_cycle_(0),
+      unacked_events_(0), has_pending_flush_(false), backlog_(0),
+      backlog_high_watermark_(0),
+      overflow_policy_(cq_overflow_policy::grow), reserved_(0),
+      reserved_high_watermark_(0), resizes_(0), refused_(0) {
+  auto const hca_khz = device->device_attr_ex_.hca_core_clock;
+  if (timestamps && hca_mask_ != 0 && hca_khz != 0 && calibrate()) {
+    struct ibv_cq_init_attr_ex cq_attr = {};
+    cq_attr.cqe = nr_cqe;
+    cq_attr.cq_context = this;
+    cq_attr.channel = channel_ ? channel_->channel_ : nullptr;
+    cq_attr.wc_flags =
+        static_cast<uint64_t>(IBV_WC_STANDARD_FLAGS) |
+        static_cast<uint64_t>(IBV_WC_EX_WITH_COMPLETION_TIMESTAMP);
+    cq_ex_ = ::ibv_create_cq_ex(device->ctx_, &cq_attr);
+    if (cq_ex_ != nullptr) {
+      cq_ = ::ibv_cq_ex_to_cq(cq_ex_);
+      timestamps_ = timestamp_source::hardware;
+      ticks_per_hca_cycle_ = 1e6 / hca_khz / detail::tsc_ns_per_tick();
+    } else {
+      RDMAPP_LOG_DEBUG("no completion timestamps: %s", strerror(errno));
+    }
+  }
+  if (cq_ == nullptr) {
+    cq_ = ::ibv_create_cq(device->ctx_, nr_cqe, this,
+                          channel_ ? channel_->channel_ : nullptr, 0);
+    check_ptr(cq_, "failed to create cq");
+    if (timestamps) {
+      timestamps_ = timestamp_source::software;
+      detail::tsc_ns_per_tick();
+    }
+  }
   RDMAPP_LOG_TRACE("created cq: %p", reinterpret_cast<void *>(cq_));
 }
 
-bool cq::poll(struct ibv_wc &wc) {
-  if (auto rc = ::ibv_poll_cq(cq_, 1, &wc); rc < 0) [[unlikely]] {
-    check_rc(-rc, "failed to poll cq");
-  } else if (rc == 0) {
+timestamp_source cq::timestamps() const { return timestamps_; }
+
+bool cq::calibrate() {
+  struct ibv_values_ex values = {};
+  values.comp_mask = IBV_VALUES_MASK_RAW_CLOCK;
+  auto const tick = detail::rdtsc();
+  if (::ibv_query_rt_values_ex(device_->ctx_, &values) != 0 ||
+      !(values.comp_mask & IBV_VALUES_MASK_RAW_CLOCK)) [[unlikely]] {
     return false;
-  } else {
-    return true;
   }
-  return false;
+  hca_ref_ = (values.raw_clock.tv_sec * 1000000000ULL +
+              values.raw_clock.tv_nsec) &
+             hca_mask_;
+  tick_ref_ = tick;
+  return true;
+}
+
+size_t cq::poll_ex(struct ibv_wc *wc, int count) {
+  auto const tick = detail::rdtsc();
+  if ((tick - tick_ref_) * detail::tsc_ns_per_tick() >
+      std::chrono::nanoseconds(kCalibrationPeriod).count()) [[unlikely]] {
+    calibrate();
+  }
+  struct ibv_poll_cq_attr attr = {};
+  if (auto rc = ::ibv_start_poll(cq_ex_, &attr); rc == ENOENT) {
+    return 0;
+  } else if (rc != 0) [[unlikely]] {
+    throw_with("failed to poll cq: %s (rc=%d)", strerror(rc), rc);
+  }
+  if (completed_at_.size() < static_cast<size_t>(count)) {
+    completed_at_.resize(count);
+  }
+  int nr = 0;
+  int rc = 0;
+  do {
+    auto &entry = wc[nr];
+    entry.wr_id = cq_ex_->wr_id;
+    entry.status = cq_ex_->status;
+    entry.vendor_err = ::ibv_wc_read_vendor_err(cq_ex_);
+    entry.qp_num = ::ibv_wc_read_qp_num(cq_ex_);
+    if (entry.status == IBV_WC_SUCCESS) [[likely]] {
+      entry.opcode = ::ibv_wc_read_opcode(cq_ex_);
+      entry.byte_len = ::ibv_wc_read_byte_len(cq_ex_);
+      entry.wc_flags = ::ibv_wc_read_wc_flags(cq_ex_);
+      entry.imm_data = (entry.wc_flags & IBV_WC_WITH_IMM)
+                           ? ::ibv_wc_read_imm_data(cq_ex_)
+                           : 0;
+      entry.src_qp = ::ibv_wc_read_src_qp(cq_ex_);
+      entry.slid = ::ibv_wc_read_slid(cq_ex_);
+      entry.sl = ::ibv_wc_read_sl(cq_ex_);
+      entry.dlid_path_bits = ::ibv_wc_read_dlid_path_bits(cq_ex_);
+      entry.pkey_index = 0;
+    }
+    // The device clock wraps at its mask: a difference above half of it is
+    // a completion stamped before the pairing.
+    auto delta = (::ibv_wc_read_completion_ts(cq_ex_) - hca_ref_) & hca_mask_;
+    auto const cycles = delta > hca_mask_ / 2
+                            ? -static_cast<double>(hca_mask_ - delta + 1)
+                            : static_cast<double>(delta);
+    completed_at_[nr] = tick_ref_ + static_cast<int64_t>(
+                                        cycles * ticks_per_hca_cycle_);
+    ++nr;
+  } while (nr < count && (rc = ::ibv_next_poll(cq_ex_)) == 0);
+  ::ibv_end_poll(cq_ex_);
+  if (rc != 0 && rc != ENOENT) [[unlikely]] {
+    throw_with("failed to poll cq: %s (rc=%d)", strerror(rc), rc);
+  }
+  return nr;
+}
+
+std::shared_ptr<comp_channel> cq::channel() const { return channel_; }
+
+void cq::moderate(uint16_t count, uint16_t period_us) {
+  auto const &caps = device_->device_attr_ex_.cq_mod_caps;
+  if (caps.max_cq_count == 0 || caps.max_cq_period == 0) [[unlikely]] {
+    throw_with("cq moderation is not supported by the device");
+  }
+  if (count > caps.max_cq_count || period_us > caps.max_cq_period)
+      [[unlikely]] {
+    throw_with("cq moderation must be within count=%u period=%uus",
+               caps.max_cq_count, caps.max_cq_period);
+  }
+  struct ibv_modify_cq_attr attr = {};
+  attr.attr_mask = IBV_CQ_ATTR_MODERATE;
+  attr.moderate.cq_count = count;
+  attr.moderate.cq_period = period_us;
+  check_rc(::ibv_modify_cq(cq_, &attr), "failed to moderate cq");
+  RDMAPP_LOG_DEBUG("moderated cq %p: count=%u period=%uus",
+                   reinterpret_cast<void *>(cq_), count, period_us);
+}
+
+void cq::set_overflow_policy(cq_overflow_policy policy) {
+  std::lock_guard lock(depth_mutex_);
+  overflow_policy_ = policy;
 }
 
+void cq::reserve(size_t nr_cqe, void const *shared) {
+  std::lock_guard lock(depth_mutex_);
+  if (shared != nullptr) {
+    if (auto it = shared_refs_.find(shared); it != shared_refs_.end()) {
+      ++it->second;
+      return;
+    }
+  }
+  auto const reserved = reserved_ + nr_cqe;
+  auto const capacity = static_cast<size_t>(cq_->cqe);
+  if (reserved > capacity && overflow_policy_ != cq_overflow_policy::ignore) {
+    auto const max_cqe =
+        static_cast<size_t>(device_->device_attr_ex_.orig_attr.max_cqe);
+    if (overflow_policy_ == cq_overflow_policy::refuse ||
+        reserved > max_cqe) [[unlikely]] {
+      ++refused_;
+      throw_with("cq %p cannot fit %zu more entries: %zu of %zu reserved",
+                 reinterpret_cast<void *>(cq_), nr_cqe, reserved_, capacity);
+    }
+    // Grow geometrically, so that Queue Pairs connecting one by one resize
+    // the completion queue a logarithmic number of times.
+    auto const nr = std::min(std::max(reserved, capacity * 2), max_cqe);
+    if (auto rc = ::ibv_resize_cq(cq_, nr); rc != 0) [[unlikely]] {
+      ++refused_;
+      throw_with("failed to resize cq %p to %zu entries: %s",
+                 reinterpret_cast<void *>(cq_), nr, strerror(rc));
+    }
+    ++resizes_;
+    RDMAPP_LOG_DEBUG("resized cq %p from %zu to %d entries",
+                     reinterpret_cast<void *>(cq_), capacity, cq_->cqe);
+  }
+  if (shared != nullptr) {
+    shared_refs_[shared] = 1;
+  }
+  reserved_ = reserved;
+  reserved_high_watermark_ = std::max(reserved_high_watermark_, reserved_);
+}
+
+void cq::unreserve(size_t nr_cqe, void const *shared) {
+  std::lock_guard lock(depth_mutex_);
+  if (shared != nullptr) {
+    auto it = shared_refs_.find(shared);
+    if (it == shared_refs_.end() || --it->second != 0) {
+      return;
+    }
+    shared_refs_.erase(it);
+  }
+  reserved_ -= std::min(reserved_, nr_cqe);
+}
+
+cq_depth_stats cq::depth_stats() const {
+  std::lock_guard lock(depth_mutex_);
+  cq_depth_stats stats = {};
+  stats.capacity = cq_->cqe;
+  stats.reserved = reserved_;
+  stats.reserved_high_watermark = reserved_high_watermark_;
+  stats.backlog_high_watermark =
+      backlog_high_watermark_.load(std::memory_order_relaxed);
+  stats.resizes = resizes_;
+  stats.refused = refused_;
+  return stats;
+}
+
+void cq::req_notify() {
+  check_rc(::ibv_req_notify_cq(cq_, 0), "failed to arm cq");
+}
+
+bool cq::has_pending_flush() const {
+  return has_pending_flush_.load(std::memory_order_seq_cst);
+}
+
+void cq::ack_event() {
+  auto const nr = unacked_events_.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (nr >= kEventAckBatch) {
+    unacked_events_.fetch_sub(nr, std::memory_order_relaxed);
+    ::ibv_ack_cq_events(cq_, nr);
+  }
+}
+
+bool cq::poll(struct ibv_wc &wc) { return poll(&wc, 1) != 0; }
+
 size_t cq::poll(std::vector<struct ibv_wc> &wc_vec) {
   return poll(&wc_vec[0], wc_vec.size());
 }
 
+void cq::schedule_flush(qp *qp) {
+  std::lock_guard lock(pending_flush_lock_);
+  pending_flush_.push_back(qp);
+  // Sequentially consistent, pairing with the check of a poller about to
+  // sleep, so that either the poller sees the flush or it is woken.
+  has_pending_flush_.store(true, std::memory_order_seq_cst);
+  if (channel_) {
+    channel_->wake_sleepers();
+  }
+}
+
+void cq::cancel_flush(qp *qp) {
+  {
+    std::lock_guard lock(pending_flush_lock_);
+    std::erase(pending_flush_, qp);
+    has_pending_flush_.store(!pending_flush_.empty(),
+                             std::memory_order_release);
+  }
+  // A poller that took it off the list before may still be flushing it.
+  while (qp->flushers_.load(std::memory_order_acquire) != 0) {
+    std::this_thread::yield();
+  }
+}
+
+void cq::flush_sends(std::vector<void *> &handles) {
+  if (!has_pending_flush_.load(std::memory_order_acquire)) {
+    return;
+  }
+  // The Queue Pairs are flushed outside of the lock: their sent handlers may
+  // post again, which schedules another flush. Each one is pinned while
+  // still on the list so that cancel_flush() waits for it.
+  thread_local std::vector<qp *> flushing;
+  {
+    std::lock_guard lock(pending_flush_lock_);
+    has_pending_flush_.store(false, std::memory_order_relaxed);
+    flushing.swap(pending_flush_);
+    for (auto qp : flushing) {
+      qp->flushers_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  for (auto qp : flushing) {
+    qp->flush_sends(handles);
+    qp->flushers_.fetch_sub(1, std::memory_order_release);
+  }
+  flushing.clear();
+}
+
+void cq::attach(uint32_t qp_num, qp *qp) {
+  std::unique_lock lock(qps_mutex_);
+  qps_[qp_num] = qp;
+}
+
+void cq::detach(uint32_t qp_num) {
+  std::unique_lock lock(qps_mutex_);
+  qps_.erase(qp_num);
+}
+
+void cq::retire_sends(struct ibv_wc const &wc, std::vector<void *> &handles,
+                      uint64_t completed_at) {
+  std::shared_lock lock(qps_mutex_);
+  if (auto it = qps_.find(wc.qp_num); it != qps_.end()) [[likely]] {
+    it->second->retire_sends(wc, handles, completed_at);
+  } else {
+    RDMAPP_LOG_DEBUG("dropped send completion of unknown qpn=%u", wc.qp_num);
+  }
+}
+
 cq::~cq() {
   if (cq_ == nullptr) [[unlikely]] {
     return;
   }
 
+  // Destroying a completion queue waits for all its events to be
+  // acknowledged.
+  if (auto nr = unacked_events_.load(std::memory_order_relaxed); nr != 0) {
+    ::ibv_ack_cq_events(cq_, nr);
+  }
   if (auto rc = ::ibv_destroy_cq(cq_); rc != 0) [[unlikely]] {
     RDMAPP_LOG_ERROR("failed to destroy cq %p: %s",
                      reinterpret_cast<void *>(cq_), strerror(errno));
@@ -9,81 +9,59 @@
 
 #include "rdmapp/executor.h"
 
+#include "rdmapp/detail/completion.h"
 #include "rdmapp/detail/debug.h"
 
 namespace rdmapp {
 
-cq_poller::cq_poller(std::shared_ptr<cq> cq, bool is_recv, size_t batch_size)
-    : cq_poller(cq, is_recv, std::make_shared<executor>(), batch_size) {}
+cq_poller::cq_poller(std::shared_ptr<cq> cq, bool is_recv, poll_batch batch_size,
+                     std::chrono::nanoseconds spin_budget)
+    : cq_poller(cq, is_recv, std::make_shared<executor>(), batch_size,
+                spin_budget) {}
 
-cq_poller::cq_poller(std::shared_ptr<cq> cq, bool is_recv, std::shared_ptr<executor> executor,
-                     size_t batch_size)
-    : cq_(cq), stopped_(false), executor_(executor), wc_vec_(batch_size) {
-  if (is_recv) {
-    poller_thread_ = std::jthread(&cq_poller::recv_worker, this);
-  } else {
-    poller_thread_ = std::jthread(&cq_poller::send_worker, this);
-  } 
+cq_poller::cq_poller(std::shared_ptr<cq> cq, bool, std::shared_ptr<executor> executor,
+                     poll_batch batch_size, std::chrono::nanoseconds spin_budget)
+    : cq_(cq), stopped_(false), executor_(executor), wc_vec_(batch_size.max),
+      batch_(batch_size),
+      waiter_({cq}, spin_budget) {
+  poller_thread_ = std::jthread(&cq_poller::worker, this);
 }
 
 cq_poller::~cq_poller() {
   stopped_ = true;
+  waiter_.wake();
   poller_thread_.join();
 }
 
-void cq_poller::recv_worker() {
-  auto st = std::chrono::high_resolution_clock::now();
-  auto st2 = std::chrono::high_resolution_clock::now();
-  int tot = 0;
-  while (!stopped_) {
-    try {
-      auto nr_wc = cq_->poll(wc_vec_);
-      tot++;
-      if (nr_wc != 0) {
-        auto et = std::chrono::high_resolution_clock::now();
-        auto elapsed1 = std::chrono::duration_cast<std::chrono::nanoseconds>(st2 - st);
-        auto elapsed2 = std::chrono::duration_cast<std::chrono::nanoseconds>(et - st2);
-        std::cout << nr_wc << " " << tot << " " << elapsed1.count() << " " << elapsed2.count() << "\n";
-        tot = 0;
-        st = et;
-        for (size_t i = 0; i < nr_wc; ++i) {
-          auto &wc = wc_vec_[i];
-          struct ibv_wc *wc_ptr = reinterpret_cast<struct ibv_wc *>(wc.wr_id);
-          *wc_ptr = wc;
-          auto h_ptr = *reinterpret_cast<void **>(wc_ptr + 1);
-          executor_->process_wc(h_ptr);
-        }
-        st2 = std::chrono::high_resolution_clock::now();
-      }
-    } catch (...) {
-      std::cout << "recv cq_poller stopped" << std::endl;
-      stopped_ = true;
-      return;
-    }
-  }
+wait_stats cq_poller::stats() const { return waiter_.stats(); }
+
+poller_metrics_snapshot cq_poller::metrics() const {
+  return metrics_.snapshot();
+}
+
+size_t cq_poller::poll_once() {
+  auto nr_wc = cq_->poll(wc_vec_.data(), batch_.size());
+  batch_.update(nr_wc);
+  // Send and recv completions take the same path: awaited ones resume their
+  // coroutine, fire-and-forget ones only retire their send queue slots.
+  metrics_.dispatch(*cq_, wc_vec_.data(), nr_wc,
+                    [this](void *h_ptr, struct ibv_wc const &wc) {
+                      executor_->process_wc(h_ptr, wc.qp_num);
+                    });
+  detail::flush_sends(*cq_, [this](void *h_ptr) {
+    executor_->process_wc(h_ptr);
+  });
+  return nr_wc;
 }
 
-void cq_poller::send_worker() {
+void cq_poller::worker() {
+  waiter_.bind_thread();
   while (!stopped_) {
     try {
-      auto nr_wc = cq_->poll(wc_vec_);
-      if (nr_wc != 0) {
-        for (size_t i = 0; i < nr_wc; ++i) {
-          auto &wc = wc_vec_[i];
-          if (wc.opcode == IBV_WR_RDMA_WRITE_WITH_IMM) {
-            // when send done, all op is write_with_imm, this thread can keep sleeping
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            continue;
-          }
-          // only process "send"
-          struct ibv_wc *wc_ptr = reinterpret_cast<struct ibv_wc *>(wc.wr_id);
-          *wc_ptr = wc;
-          auto h_ptr = *reinterpret_cast<void **>(wc_ptr + 1);
-          executor_->process_wc(h_ptr);
-        }
-      }
+      auto nr_wc = poll_once();
+      waiter_.idle(nr_wc != 0, stopped_);
     } catch (...) {
-      std::cout << "send cq_poller stopped" << std::endl;
+      std::cout << "cq_poller stopped" << std::endl;
       stopped_ = true;
       return;
     }
@@ -0,0 +1,70 @@
+#include "rdmapp/cq_scheduler.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "rdmapp/detail/tsc.h"
+
+namespace rdmapp {
+
+cq_scheduler::cq_scheduler(size_t quantum)
+    : quantum_(std::max<size_t>(quantum, 1)), changed_(false) {}
+
+void cq_scheduler::add(std::shared_ptr<cq> cq, uint32_t weight) {
+  weight = std::max<uint32_t>(weight, 1);
+  std::lock_guard lock(mutex_);
+  auto it = std::find_if(pending_.begin(), pending_.end(),
+                         [&](auto const &e) { return e->queue == cq; });
+  if (it != pending_.end()) {
+    (*it)->weight.store(weight, std::memory_order_relaxed);
+    return;
+  }
+  pending_.push_back(std::make_shared<entry>(std::move(cq), weight));
+  changed_.store(true, std::memory_order_release);
+}
+
+void cq_scheduler::remove(std::shared_ptr<cq> const &cq) {
+  std::lock_guard lock(mutex_);
+  auto const erased =
+      std::erase_if(pending_, [&](auto const &e) { return e->queue == cq; });
+  if (erased != 0) {
+    changed_.store(true, std::memory_order_release);
+  }
+}
+
+bool cq_scheduler::apply() {
+  std::lock_guard lock(mutex_);
+  if (!changed_.exchange(false, std::memory_order_acquire)) {
+    return false;
+  }
+  entries_ = pending_;
+  cqs_.clear();
+  for (auto const &e : entries_) {
+    cqs_.push_back(e->queue);
+  }
+  return true;
+}
+
+std::vector<std::pair<std::shared_ptr<cq>, cq_service_stats>>
+cq_scheduler::stats() const {
+  auto const ns_per_tick = detail::tsc_ns_per_tick();
+  std::vector<std::pair<std::shared_ptr<cq>, cq_service_stats>> stats;
+  std::lock_guard lock(mutex_);
+  for (auto const &e : pending_) {
+    cq_service_stats s = {};
+    s.weight = e->weight.load(std::memory_order_relaxed);
+    s.polls = e->polls.load(std::memory_order_relaxed);
+    s.empty_polls = e->empty_polls.load(std::memory_order_relaxed);
+    s.skipped_rounds = e->skipped_rounds.load(std::memory_order_relaxed);
+    s.completions = e->completions.load(std::memory_order_relaxed);
+    s.service_ns = e->service_ticks.load(std::memory_order_relaxed) *
+                   ns_per_tick;
+    stats.emplace_back(e->queue, s);
+  }
+  return stats;
+}
+
+} // namespace rdmapp
@@ -0,0 +1,226 @@
+#include "rdmapp/detail/cq_waiter.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "rdmapp/error.h"
+
+#include "rdmapp/detail/debug.h"
+
+namespace rdmapp {
+namespace detail {
+
+// Empty polls between two reads of the clock while spinning.
+static constexpr uint32_t kClockInterval = 64;
+// Sleeps are bounded, so that a stopped poller exits even if nobody wakes it.
+static constexpr int kSleepTimeoutMs = 100;
+static constexpr int kMaxEvents = 16;
+
+static uint64_t to_ns(std::chrono::steady_clock::duration d) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+static void update_max(std::atomic<uint64_t> &max, uint64_t value) {
+  if (value > max.load(std::memory_order_relaxed)) {
+    max.store(value, std::memory_order_relaxed);
+  }
+}
+
+cq_waiter::cq_waiter(std::vector<std::shared_ptr<cq>> const &cqs,
+                     std::chrono::nanoseconds spin_budget,
+                     std::function<bool()> has_work)
+    : cqs_(cqs), channels_(nullptr), spin_budget_(spin_budget), has_work_(std::move(has_work)),
+      epoll_fd_(-1), enabled_(false), armed_(false), woken_(false),
+      empty_polls_(0), started_at_(std::chrono::steady_clock::now()),
+      bound_(false), thread_(), sleeps_(0), wakeups_(0), timeouts_(0),
+      asleep_ns_(0), max_asleep_ns_(0), wake_latency_ns_(0),
+      max_wake_latency_ns_(0), woken_completions_(0) {
+  setup();
+}
+
+void cq_waiter::setup() {
+  if (spin_budget_ == kSpinForever || cqs_.empty()) {
+    return;
+  }
+  auto channels = std::make_unique<channel_list>();
+  for (auto &cq : cqs_) {
+    auto channel = cq->channel();
+    if (channel == nullptr) {
+      RDMAPP_LOG_DEBUG("cq %p has no comp channel, poller will not sleep",
+                       reinterpret_cast<void *>(cq.get()));
+      return;
+    }
+    if (std::find(channels->begin(), channels->end(), channel) ==
+        channels->end()) {
+      channels->push_back(channel);
+    }
+  }
+  epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+  check_errno(epoll_fd_, "failed to create epoll fd");
+  for (auto &channel : *channels) {
+    for (auto fd : {channel->fd(), channel->wake_fd_}) {
+      struct epoll_event event = {};
+      event.events = EPOLLIN;
+      event.data.ptr = channel.get();
+      if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) [[unlikely]] {
+        auto const saved_errno = errno;
+        ::close(epoll_fd_);
+        epoll_fd_ = -1;
+        errno = saved_errno;
+        check_errno(-1, "failed to add comp channel to epoll");
+      }
+    }
+  }
+  channels_.store(channels.get(), std::memory_order_release);
+  channel_lists_.push_back(std::move(channels));
+  enabled_.store(true, std::memory_order_release);
+}
+
+void cq_waiter::update_cqs(std::vector<std::shared_ptr<cq>> const &cqs) {
+  if (epoll_fd_ >= 0) {
+    ::close(epoll_fd_);
+    epoll_fd_ = -1;
+  }
+  enabled_.store(false, std::memory_order_relaxed);
+  channels_.store(nullptr, std::memory_order_release);
+  armed_ = false;
+  empty_polls_ = 0;
+  cqs_ = cqs;
+  setup();
+}
+
+void cq_waiter::bind_thread() {
+  thread_ = ::pthread_self();
+  started_at_ = std::chrono::steady_clock::now();
+  bound_.store(true, std::memory_order_release);
+}
+
+void cq_waiter::record_wake_latency() {
+  auto const latency = to_ns(std::chrono::steady_clock::now() - woken_at_);
+  wake_latency_ns_.fetch_add(latency, std::memory_order_relaxed);
+  update_max(max_wake_latency_ns_, latency);
+  woken_completions_.fetch_add(1, std::memory_order_relaxed);
+  woken_ = false;
+}
+
+void cq_waiter::on_empty_poll(std::atomic<bool> const &stopped) {
+  // Only the first of a streak of empty polls and every kClockInterval-th
+  // read the clock.
+  auto const nr = ++empty_polls_;
+  if (nr == 1) {
+    idle_since_ = std::chrono::steady_clock::now();
+    return;
+  }
+  if (nr % kClockInterval != 0) {
+    return;
+  }
+  if (std::chrono::steady_clock::now() - idle_since_ < spin_budget_) {
+    return;
+  }
+  if (!armed_) {
+    // Completions that arrived before arming raise no event, so the poller
+    // polls again before sleeping.
+    for (auto &cq : cqs_) {
+      cq->req_notify();
+    }
+    armed_ = true;
+    return;
+  }
+  sleep(stopped);
+}
+
+void cq_waiter::sleep(std::atomic<bool> const &stopped) {
+  auto const &channels = *channels_.load(std::memory_order_relaxed);
+  for (auto &channel : channels) {
+    channel->sleepers_.fetch_add(1, std::memory_order_seq_cst);
+  }
+  // Checked after announcing the sleep: whoever queues a flush or work, or
+  // stops the poller, after this point sees the sleeper and wakes it.
+  auto const must_stay =
+      stopped.load() ||
+      std::any_of(cqs_.begin(), cqs_.end(),
+                  [](auto &cq) { return cq->has_pending_flush(); }) ||
+      (has_work_ && has_work_());
+  int nr_events = 0;
+  struct epoll_event events[kMaxEvents];
+  if (!must_stay) {
+    auto const start = std::chrono::steady_clock::now();
+    nr_events = ::epoll_wait(epoll_fd_, events, kMaxEvents, kSleepTimeoutMs);
+    auto const end = std::chrono::steady_clock::now();
+    auto const asleep = to_ns(end - start);
+    sleeps_.fetch_add(1, std::memory_order_relaxed);
+    asleep_ns_.fetch_add(asleep, std::memory_order_relaxed);
+    update_max(max_asleep_ns_, asleep);
+    if (nr_events > 0) {
+      wakeups_.fetch_add(1, std::memory_order_relaxed);
+      woken_ = true;
+      woken_at_ = end;
+    } else if (nr_events == 0) {
+      timeouts_.fetch_add(1, std::memory_order_relaxed);
+    } else if (errno != EINTR) [[unlikely]] {
+      RDMAPP_LOG_ERROR("failed to wait for comp channels: %s",
+                       strerror(errno));
+    }
+  }
+  for (auto &channel : channels) {
+    channel->sleepers_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  for (int i = 0; i < nr_events; ++i) {
+    static_cast<comp_channel *>(events[i].data.ptr)->drain();
+  }
+  // The events consumed the notifications; a later sleep arms again. The
+  // idle streak goes on, so that a timeout goes right back to sleep.
+  armed_ = false;
+}
+
+void cq_waiter::wake() {
+  if (!enabled_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  // Pairs with the announcement in sleep().
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  auto channels = channels_.load(std::memory_order_acquire);
+  if (channels == nullptr) [[unlikely]] {
+    return;
+  }
+  for (auto &channel : *channels) {
+    channel->wake_sleepers();
+  }
+}
+
+wait_stats cq_waiter::stats() const {
+  wait_stats stats = {};
+  stats.sleeps = sleeps_.load(std::memory_order_relaxed);
+  stats.wakeups = wakeups_.load(std::memory_order_relaxed);
+  stats.timeouts = timeouts_.load(std::memory_order_relaxed);
+  stats.asleep_ns = asleep_ns_.load(std::memory_order_relaxed);
+  stats.max_asleep_ns = max_asleep_ns_.load(std::memory_order_relaxed);
+  stats.wake_latency_ns = wake_latency_ns_.load(std::memory_order_relaxed);
+  stats.max_wake_latency_ns =
+      max_wake_latency_ns_.load(std::memory_order_relaxed);
+  stats.woken_completions = woken_completions_.load(std::memory_order_relaxed);
+  if (bound_.load(std::memory_order_acquire)) {
+    clockid_t clock_id;
+    struct timespec ts;
+    if (::pthread_getcpuclockid(thread_, &clock_id) == 0 &&
+        ::clock_gettime(clock_id, &ts) == 0) {
+      stats.cpu_ns = static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+    stats.wall_ns = to_ns(std::chrono::steady_clock::now() - started_at_);
+  }
+  return stats;
+}
+
+cq_waiter::~cq_waiter() {
+  if (epoll_fd_ >= 0) {
+    ::close(epoll_fd_);
+  }
+}
+
+} // namespace detail
+} // namespace rdmapp
@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <fstream>
 #include <stdexcept>
 
 #include <infiniband/verbs.h>
@@ -150,6 +151,37 @@ bool device::is_fetch_and_add_supported() const {
 
 int device::gid_index() const { return gid_index_; }
 
+struct ibv_port_attr const &device::port_attr() const { return port_attr_; }
+
+struct ibv_device_attr const &device::device_attr() const {
+  return device_attr_ex_.orig_attr;
+}
+
+std::optional<uint64_t> device::port_counter(std::string const &name) const {
+  for (auto dir : {"hw_counters", "counters"}) {
+    auto const path = std::string("/sys/class/infiniband/") +
+                      ::ibv_get_device_name(device_) + "/ports/" +
+                      std::to_string(port_num_) + "/" + dir + "/" + name;
+    std::ifstream file(path);
+    uint64_t value = 0;
+    if (file >> value) {
+      return value;
+    }
+  }
+  return std::nullopt;
+}
+
+int device::numa_node() const {
+  auto const path = std::string("/sys/class/infiniband/") +
+                    ::ibv_get_device_name(device_) + "/device/numa_node";
+  std::ifstream file(path);
+  int node = -1;
+  if (!(file >> node)) {
+    return -1;
+  }
+  return node;
+}
+
 std::string device::gid_hex_string(union ibv_gid const &gid) {
   std::string gid_str;
   char buf[16] = {0};
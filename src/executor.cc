@@ -1,70 +1,245 @@
 #include "rdmapp/executor.h"
-#include <chrono>
+
+#include <algorithm>
+#include <atomic>
 #include <coroutine>
-#include <iostream>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
 
-#include "rdmapp/detail/blocking_queue.h"
 #include "rdmapp/detail/debug.h"
 
 namespace rdmapp {
 
-executor::executor(size_t nr_worker) {
-  work_queue_ = std::make_shared<work_queue>(4096);
+// The executor and worker of the calling thread, if it is a worker.
+static thread_local executor *current_executor = nullptr;
+static thread_local size_t current_worker = 0;
+
+// Per thread, so that pollers spreading work round robin do not share a
+// counter.
+static thread_local size_t next_worker =
+    std::hash<std::thread::id>{}(std::this_thread::get_id());
+static thread_local uint64_t steal_seed =
+    std::hash<std::thread::id>{}(std::this_thread::get_id()) | 1;
+
+static inline size_t random_worker(size_t nr_worker) {
+  // xorshift64
+  steal_seed ^= steal_seed << 13;
+  steal_seed ^= steal_seed >> 7;
+  steal_seed ^= steal_seed << 17;
+  return steal_seed % nr_worker;
+}
+
+static inline void bump(std::atomic<uint64_t> &counter) {
+  counter.store(counter.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+}
+
+executor::executor(size_t nr_worker, executor_policy policy)
+    : policy_(policy), closed_(false), epoch_(0), sleepers_(0) {
+  nr_worker = std::max<size_t>(nr_worker, 1);
+  // Every worker exists before any thread starts, as workers steal from each
+  // other.
   for (size_t i = 0; i < nr_worker; ++i) {
-    workers_.emplace_back(&executor::worker_fn, this, i);
-    std::cout << "executor worker " << i << " started\n";
+    workers_.push_back(std::make_unique<worker>());
+  }
+  for (size_t i = 0; i < nr_worker; ++i) {
+    workers_[i]->thread = std::jthread(&executor::worker_fn, this, i);
+    RDMAPP_LOG_DEBUG("executor worker %lu started", i);
+  }
+}
+
+void *executor::next_work(worker &self, size_t worker_id) {
+  if (self.lifo_slot != nullptr) {
+    auto h_ptr = self.lifo_slot;
+    self.lifo_slot = nullptr;
+    if (self.lifo_streak < kLifoBudget) {
+      ++self.lifo_streak;
+      bump(self.lifo);
+      return h_ptr;
+    }
+    // A coroutine rescheduling itself forever must not starve the rest: it
+    // goes to the deque, where it can also be stolen.
+    self.deque.push(h_ptr);
+  }
+  self.lifo_streak = 0;
+  if (self.has_inbox.load(std::memory_order_acquire)) {
+    auto &inbox = self.drained;
+    {
+      std::lock_guard lock(self.inbox_lock);
+      inbox.swap(self.inbox);
+      self.has_inbox.store(false, std::memory_order_relaxed);
+    }
+    // Pushed newest first, so that the owner pops the oldest first.
+    for (auto it = inbox.rbegin(); it != inbox.rend(); ++it) {
+      self.deque.push(*it);
+    }
+    if (inbox.size() > 1) {
+      notify();
+    }
+    inbox.clear();
+  }
+  // Popped from the bottom without a CAS. Old entries are not starved: the
+  // LIFO slot budget sends a rescheduling coroutine behind the inbox, and
+  // thieves take from the top.
+  void *h_ptr = nullptr;
+  if (self.deque.pop(h_ptr)) {
+    return h_ptr;
+  }
+  return steal(worker_id);
+}
+
+void *executor::steal(size_t worker_id) {
+  auto const nr_worker = workers_.size();
+  if (nr_worker == 1) {
+    return nullptr;
+  }
+  auto const start = random_worker(nr_worker);
+  void *h_ptr = nullptr;
+  for (size_t i = 0; i < nr_worker; ++i) {
+    auto const victim = (start + i) % nr_worker;
+    if (victim != worker_id && workers_[victim]->deque.steal(h_ptr)) {
+      bump(workers_[worker_id]->stolen);
+      return h_ptr;
+    }
+  }
+  // A worker busy resuming a long coroutine has not drained its inbox yet.
+  for (size_t i = 0; i < nr_worker; ++i) {
+    auto &victim = *workers_[(start + i) % nr_worker];
+    if (&victim == workers_[worker_id].get() ||
+        !victim.has_inbox.load(std::memory_order_relaxed) ||
+        !victim.inbox_lock.try_lock()) {
+      continue;
+    }
+    if (!victim.inbox.empty()) {
+      h_ptr = victim.inbox.back();
+      victim.inbox.pop_back();
+    }
+    victim.has_inbox.store(!victim.inbox.empty(), std::memory_order_relaxed);
+    victim.inbox_lock.unlock();
+    if (h_ptr != nullptr) {
+      bump(workers_[worker_id]->stolen);
+      return h_ptr;
+    }
+  }
+  return nullptr;
+}
+
+bool executor::has_work() const {
+  for (auto const &w : workers_) {
+    if (w->has_inbox.load(std::memory_order_relaxed) || w->deque.size() != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void executor::notify() {
+  // Pairs with the fence of a worker about to sleep: either it sees the new
+  // work or we see it sleeping.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleepers_.load(std::memory_order_relaxed) != 0) {
+    epoch_.fetch_add(1, std::memory_order_seq_cst);
+    epoch_.notify_all();
   }
 }
 
 void executor::worker_fn(size_t worker_id) {
-  void* h_ptr;
-  try {
-    while (true) {
-      while (!work_queue_->pop(h_ptr)) {
-        if (work_queue_->is_closed()) [[unlikely]] {
-          throw closed_exception();
-        }
-        std::this_thread::yield();
-      }
-      std::coroutine_handle<> h = std::coroutine_handle<>::from_address(h_ptr);
-      // auto st = std::chrono::high_resolution_clock::now();
-      h.resume();
-      // auto et = std::chrono::high_resolution_clock::now();
-      // auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(et - st);
-      // std::cout << "process_wc " << elapsed.count() << " ns\n";
+  current_executor = this;
+  current_worker = worker_id;
+  auto &self = *workers_[worker_id];
+  uint32_t idle = 0;
+  while (!closed_.load(std::memory_order_acquire)) {
+    if (auto h_ptr = next_work(self, worker_id); h_ptr != nullptr) {
+      idle = 0;
+      std::coroutine_handle<>::from_address(h_ptr).resume();
+      bump(self.executed);
+      continue;
     }
-  } catch (...) {
-    RDMAPP_LOG_DEBUG("executor worker %lu exited", worker_id);
+    if (++idle < kIdleSpins) {
+      std::this_thread::yield();
+      continue;
+    }
+    idle = 0;
+    sleepers_.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto const epoch = epoch_.load(std::memory_order_seq_cst);
+    if (!has_work() && !closed_.load(std::memory_order_acquire)) {
+      bump(self.parks);
+      epoch_.wait(epoch, std::memory_order_seq_cst);
+    }
+    sleepers_.fetch_sub(1, std::memory_order_relaxed);
   }
+  RDMAPP_LOG_DEBUG("executor worker %lu exited", worker_id);
+}
+
+void executor::enqueue(size_t worker_id, void *h_ptr) {
+  auto &w = *workers_[worker_id];
+  {
+    std::lock_guard lock(w.inbox_lock);
+    w.inbox.push_back(h_ptr);
+    w.has_inbox.store(true, std::memory_order_release);
+  }
+  notify();
 }
 
 void executor::process_wc(void* h_ptr) {
-  while (!work_queue_->push(h_ptr)) {
-    if (work_queue_->is_closed()) [[unlikely]] {
-      std::cout << "work queue closed" << std::endl;
-      throw closed_exception();
+  if (closed_.load(std::memory_order_acquire)) [[unlikely]] {
+    throw closed_exception();
+  }
+  if (current_executor == this) {
+    auto &self = *workers_[current_worker];
+    if (self.lifo_slot != nullptr) {
+      self.deque.push(self.lifo_slot);
+      notify();
     }
+    self.lifo_slot = h_ptr;
+    return;
+  }
+  enqueue(next_worker++ % workers_.size(), h_ptr);
+}
+
+void executor::process_wc(void *h_ptr, uint32_t qp_num) {
+  if (policy_ != executor_policy::by_qp || current_executor == this) {
+    process_wc(h_ptr);
+    return;
   }
-  // struct ibv_wc *wc_ptr = reinterpret_cast<struct ibv_wc *>(wc.wr_id);
-  // *wc_ptr = wc;
-  // std::coroutine_handle<> h = std::coroutine_handle<>::from_address(
-  //     *reinterpret_cast<void **>(wc_ptr + 1));
-  // // auto st = std::chrono::high_resolution_clock::now();
-  // h.resume();
-  // auto et = std::chrono::high_resolution_clock::now();
-  // auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(et - st);
-  // std::cout << "process_wc " << elapsed.count() << " ns\n";
+  if (closed_.load(std::memory_order_acquire)) [[unlikely]] {
+    throw closed_exception();
+  }
+  // Fibonacci hashing, as consecutive QPNs are common; the high bits of the
+  // product pick the worker.
+  auto const hash = static_cast<uint32_t>(qp_num * 2654435769U);
+  enqueue((static_cast<uint64_t>(hash) * workers_.size()) >> 32, h_ptr);
+}
+
+executor_stats executor::stats() const {
+  executor_stats stats = {};
+  for (auto const &w : workers_) {
+    stats.executed += w->executed.load(std::memory_order_relaxed);
+    stats.lifo += w->lifo.load(std::memory_order_relaxed);
+    stats.stolen += w->stolen.load(std::memory_order_relaxed);
+    stats.parks += w->parks.load(std::memory_order_relaxed);
+  }
+  return stats;
 }
 
-void executor::shutdown() { work_queue_->close(); }
+void executor::shutdown() {
+  closed_.store(true, std::memory_order_release);
+  epoch_.fetch_add(1, std::memory_order_seq_cst);
+  epoch_.notify_all();
+}
 
 void executor::destroy_callback(callback_ptr cb) { delete cb; }
 
 executor::~executor() {
   shutdown();
-  for (auto &&worker : workers_) {
-    worker.join();
+  for (auto &&w : workers_) {
+    if (w->thread.joinable()) {
+      w->thread.join();
+    }
   }
 }
 
-} // namespace rdmapp
\ No newline at end of file
+} // namespace rdmapp
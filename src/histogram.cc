@@ -0,0 +1,63 @@
+#include "rdmapp/histogram.h"
+
+#include <algorithm>
+
+namespace rdmapp {
+
+uint64_t histogram_snapshot::percentile(double quantile) const {
+  if (count == 0) {
+    return 0;
+  }
+  auto const rank = static_cast<uint64_t>(quantile * (count - 1));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    seen += counts[i];
+    if (seen > rank) {
+      return std::min(lowest_of(i), max);
+    }
+  }
+  return max;
+}
+
+double histogram_snapshot::mean() const {
+  return count == 0 ? 0 : static_cast<double>(sum) / count;
+}
+
+histogram_snapshot
+histogram_snapshot::since(histogram_snapshot const &earlier) const {
+  auto diff = *this;
+  if (earlier.counts.size() != counts.size()) {
+    return diff;
+  }
+  for (size_t i = 0; i < counts.size(); ++i) {
+    diff.counts[i] -= earlier.counts[i];
+  }
+  diff.count -= earlier.count;
+  diff.sum -= earlier.sum;
+  return diff;
+}
+
+namespace detail {
+
+log_histogram::log_histogram() : count_(0), sum_(0), max_(0) {
+  for (auto &count : counts_) {
+    count.store(0, std::memory_order_relaxed);
+  }
+}
+
+histogram_snapshot log_histogram::snapshot() const {
+  histogram_snapshot snapshot;
+  snapshot.counts.resize(counts_.size());
+  for (size_t i = 0; i < counts_.size(); ++i) {
+    snapshot.counts[i] = counts_[i].load(std::memory_order_relaxed);
+  }
+  // Read racily with the writer, so the totals may be off by the values
+  // recorded meanwhile.
+  snapshot.count = count_.load(std::memory_order_relaxed);
+  snapshot.sum = sum_.load(std::memory_order_relaxed);
+  snapshot.max = max_.load(std::memory_order_relaxed);
+  return snapshot;
+}
+
+} // namespace detail
+} // namespace rdmapp
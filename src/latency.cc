@@ -0,0 +1,142 @@
+#include "rdmapp/latency.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include "rdmapp/detail/tsc.h"
+
+namespace rdmapp {
+namespace detail {
+
+double tsc_ns_per_tick() {
+#if defined(__x86_64__) || defined(__i386__)
+  static double const ns_per_tick = []() {
+    using clock = std::chrono::steady_clock;
+    auto const start = clock::now();
+    auto const start_tick = rdtsc();
+    while (clock::now() - start < std::chrono::milliseconds(5)) {
+    }
+    auto const elapsed = clock::now() - start;
+    auto const ticks = rdtsc() - start_tick;
+    return static_cast<double>(
+               std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                   .count()) /
+           ticks;
+  }();
+  return ns_per_tick;
+#else
+  return 1.0;
+#endif
+}
+
+static constexpr std::array<enum ibv_wc_opcode, 7> kTimedOpcodes = {
+    IBV_WC_SEND,      IBV_WC_RDMA_WRITE, IBV_WC_RDMA_READ,
+    IBV_WC_COMP_SWAP, IBV_WC_FETCH_ADD,  IBV_WC_RECV,
+    IBV_WC_RECV_RDMA_WITH_IMM,
+};
+
+static int timed_opcode_index(enum ibv_wc_opcode opcode) {
+  auto it = std::find(kTimedOpcodes.begin(), kTimedOpcodes.end(), opcode);
+  return it == kTimedOpcodes.end() ? -1 : it - kTimedOpcodes.begin();
+}
+
+namespace {
+
+enum phase { kDevice, kQueueing, kTotal, kNrPhases };
+
+/**
+ * @brief The histograms of one thread. They are never freed, so that the
+ * samples of a thread that exited stay in the totals; the next thread to
+ * record takes them over instead, so there are only as many as threads ever
+ * recorded at the same time.
+ *
+ */
+struct thread_histograms {
+  log_histogram histograms[kTimedOpcodes.size()][kNrPhases];
+};
+
+std::mutex registry_mutex;
+std::vector<thread_histograms *> registry;
+// The histograms of threads that exited.
+std::vector<thread_histograms *> unowned;
+
+struct histograms_owner {
+  thread_histograms *histograms;
+
+  histograms_owner() {
+    std::lock_guard lock(registry_mutex);
+    if (!unowned.empty()) {
+      histograms = unowned.back();
+      unowned.pop_back();
+      return;
+    }
+    histograms = new thread_histograms();
+    registry.push_back(histograms);
+  }
+
+  ~histograms_owner() {
+    std::lock_guard lock(registry_mutex);
+    unowned.push_back(histograms);
+  }
+};
+
+thread_histograms &local_histograms() {
+  thread_local histograms_owner owner;
+  return *owner.histograms;
+}
+
+void merge(histogram_snapshot &total, histogram_snapshot const &other) {
+  if (total.counts.empty()) {
+    total = other;
+    return;
+  }
+  for (size_t i = 0; i < total.counts.size(); ++i) {
+    total.counts[i] += other.counts[i];
+  }
+  total.count += other.count;
+  total.sum += other.sum;
+  total.max = std::max(total.max, other.max);
+}
+
+} // namespace
+
+void record_op_latency(enum ibv_wc_opcode opcode, uint64_t posted_at,
+                       uint64_t completed_at, uint64_t resumed_at) {
+  auto const index = timed_opcode_index(opcode);
+  if (index < 0 || resumed_at < posted_at) [[unlikely]] {
+    return;
+  }
+  auto const ns_per_tick = tsc_ns_per_tick();
+  // Hardware timestamps are converted to ticks and may land slightly before
+  // the post or after the resumption.
+  completed_at = std::clamp(completed_at, posted_at, resumed_at);
+  auto &histograms = local_histograms().histograms[index];
+  histograms[kDevice].record((completed_at - posted_at) * ns_per_tick);
+  histograms[kQueueing].record((resumed_at - completed_at) * ns_per_tick);
+  histograms[kTotal].record((resumed_at - posted_at) * ns_per_tick);
+}
+
+} // namespace detail
+
+std::vector<op_latency> op_latencies() {
+  std::vector<op_latency> latencies;
+  std::lock_guard lock(detail::registry_mutex);
+  for (size_t i = 0; i < detail::kTimedOpcodes.size(); ++i) {
+    op_latency latency{detail::kTimedOpcodes[i], {}, {}, {}};
+    for (auto histograms : detail::registry) {
+      auto &phases = histograms->histograms[i];
+      detail::merge(latency.device_ns, phases[detail::kDevice].snapshot());
+      detail::merge(latency.queueing_ns, phases[detail::kQueueing].snapshot());
+      detail::merge(latency.total_ns, phases[detail::kTotal].snapshot());
+    }
+    if (latency.total_ns.count != 0) {
+      latencies.push_back(std::move(latency));
+    }
+  }
+  return latencies;
+}
+
+} // namespace rdmapp
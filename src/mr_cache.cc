@@ -0,0 +1,143 @@
+#include "rdmapp/mr_cache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unistd.h>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/error.h"
+
+#include "rdmapp/detail/debug.h"
+
+namespace rdmapp {
+
+static inline uintptr_t page_size() {
+  static uintptr_t const size = ::sysconf(_SC_PAGESIZE);
+  return size;
+}
+
+mr_cache::mr_cache(struct ibv_pd *pd, size_t capacity, int flags)
+    : pd_(pd), flags_(flags), capacity_(capacity), hits_(0), misses_(0),
+      evictions_(0), registered_bytes_(0) {}
+
+std::shared_ptr<local_mr> mr_cache::acquire(std::shared_ptr<pd> owner,
+                                            void *addr, size_t length) {
+  auto const addr_begin = reinterpret_cast<uintptr_t>(addr);
+  auto const addr_end = addr_begin + length;
+  entry *e = nullptr;
+  std::lock_guard lock(mutex_);
+  auto it = index_.upper_bound(addr_begin);
+  if (it != index_.begin()) {
+    auto prev = std::prev(it);
+    if (prev->second->end >= addr_end) {
+      e = prev->second;
+    }
+  }
+  if (e != nullptr) [[likely]] {
+    ++hits_;
+    if (e->refs++ == 0) {
+      lru_.erase(e->lru_it);
+    }
+  } else {
+    ++misses_;
+    auto begin = addr_begin & ~(page_size() - 1);
+    auto end = (addr_end + page_size() - 1) & ~(page_size() - 1);
+    // Merge every cached range the new one overlaps, so that ranges stay
+    // disjoint and a sorted map is enough to find the one covering a buffer.
+    it = index_.upper_bound(begin);
+    if (it != index_.begin() && std::prev(it)->second->end > begin) {
+      --it;
+    }
+    while (it != index_.end() && it->second->begin < end) {
+      begin = std::min(begin, it->second->begin);
+      end = std::max(end, it->second->end);
+      it = unindex_locked(it);
+    }
+    auto mr = ::ibv_reg_mr(pd_, reinterpret_cast<void *>(begin), end - begin,
+                           flags_);
+    check_ptr(mr, "failed to reg cached mr");
+    e = new entry{local_mr(nullptr, mr), begin, end, 1, true, lru_.end()};
+    index_.emplace(begin, e);
+    registered_bytes_ += end - begin;
+    RDMAPP_LOG_TRACE("cached mr %p [%p, %p)", reinterpret_cast<void *>(mr),
+                     reinterpret_cast<void *>(begin),
+                     reinterpret_cast<void *>(end));
+    evict_locked();
+  }
+  return std::shared_ptr<local_mr>(
+      &e->mr, [this, owner = std::move(owner), e](local_mr *) { release(e); });
+}
+
+void mr_cache::release(entry *e) {
+  std::lock_guard lock(mutex_);
+  if (--e->refs != 0) {
+    return;
+  }
+  if (!e->indexed) {
+    destroy_locked(e);
+    return;
+  }
+  e->lru_it = lru_.insert(lru_.end(), e);
+  evict_locked();
+}
+
+std::map<uintptr_t, mr_cache::entry *>::iterator
+mr_cache::unindex_locked(std::map<uintptr_t, entry *>::iterator it) {
+  auto e = it->second;
+  e->indexed = false;
+  if (e->refs == 0) {
+    lru_.erase(e->lru_it);
+    destroy_locked(e);
+  }
+  return index_.erase(it);
+}
+
+void mr_cache::evict_locked() {
+  while (registered_bytes_ > capacity_ && !lru_.empty()) {
+    auto e = lru_.front();
+    lru_.pop_front();
+    index_.erase(e->begin);
+    destroy_locked(e);
+    ++evictions_;
+  }
+}
+
+void mr_cache::destroy_locked(entry *e) {
+  registered_bytes_ -= e->end - e->begin;
+  delete e;
+}
+
+void mr_cache::invalidate(void *addr, size_t length) {
+  auto const begin = reinterpret_cast<uintptr_t>(addr);
+  auto const end = begin + length;
+  std::lock_guard lock(mutex_);
+  auto it = index_.upper_bound(begin);
+  if (it != index_.begin() && std::prev(it)->second->end > begin) {
+    --it;
+  }
+  while (it != index_.end() && it->second->begin < end) {
+    it = unindex_locked(it);
+  }
+}
+
+mr_cache_stats mr_cache::stats() {
+  std::lock_guard lock(mutex_);
+  return mr_cache_stats{hits_, misses_, evictions_, index_.size(),
+                        registered_bytes_};
+}
+
+mr_cache::~mr_cache() {
+  for (auto &[begin, e] : index_) {
+    if (e->refs != 0) [[unlikely]] {
+      RDMAPP_LOG_ERROR("cached mr [%p, %p) destroyed while in use",
+                       reinterpret_cast<void *>(e->begin),
+                       reinterpret_cast<void *>(e->end));
+    }
+    delete e;
+  }
+}
+
+} // namespace rdmapp
@@ -0,0 +1,225 @@
+#include "rdmapp/detail/numa.h"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "rdmapp/error.h"
+
+#include "rdmapp/detail/debug.h"
+
+namespace rdmapp {
+namespace detail {
+
+// The MPOL_PREFERRED memory policy of mbind(2).
+static constexpr int kMpolPreferred = 1;
+
+// Memory mapped at once by a frame pool.
+static constexpr size_t kFrameChunkSize = 256 << 10;
+
+/**
+ * @brief Prepended to every frame, so that it can be freed without knowing
+ * its pool or size.
+ *
+ */
+struct alignas(16) frame_header {
+  frame_pool *pool;
+  size_t size_class;
+};
+
+static std::vector<int> allowed_cpus() {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  check_rc(::sched_getaffinity(0, sizeof(set), &set) == 0 ? 0 : errno,
+           "failed to get cpu affinity");
+  std::vector<int> cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &set)) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+static std::vector<int> parse_cpu_list(std::string const &list) {
+  std::vector<int> cpus;
+  std::stringstream stream(list);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    if (range.empty()) {
+      continue;
+    }
+    auto const dash = range.find('-');
+    auto const first = std::stoi(range.substr(0, dash));
+    auto const last =
+        dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+std::vector<int> node_cpus(int node) {
+  auto cpus = allowed_cpus();
+  if (node < 0) {
+    return cpus;
+  }
+  std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) +
+                     "/cpulist");
+  std::string list;
+  if (!std::getline(file, list)) {
+    return {};
+  }
+  auto const node_cpus = parse_cpu_list(list);
+  std::erase_if(cpus, [&](int cpu) {
+    return std::find(node_cpus.begin(), node_cpus.end(), cpu) ==
+           node_cpus.end();
+  });
+  return cpus;
+}
+
+int cpu_node(int cpu) {
+  std::error_code ec;
+  std::filesystem::directory_iterator it(
+      "/sys/devices/system/cpu/cpu" + std::to_string(cpu), ec);
+  for (; !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+    auto const name = it->path().filename().string();
+    if (name.starts_with("node") && name.size() > 4) {
+      return std::stoi(name.substr(4));
+    }
+  }
+  return -1;
+}
+
+void pin_thread(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  check_rc(::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set),
+           "failed to pin thread");
+}
+
+void *alloc_on_node(size_t size, int node) {
+  auto ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) [[unlikely]] {
+    throw_with("failed to map %lu bytes: %s", size, strerror(errno));
+  }
+  if (node >= 0) {
+    unsigned long mask[16] = {};
+    if (static_cast<size_t>(node) < sizeof(mask) * 8) {
+      mask[node / 64] = 1UL << (node % 64);
+      // A failure only loses the placement.
+      if (::syscall(SYS_mbind, ptr, size, kMpolPreferred, mask,
+                    sizeof(mask) * 8, 0) != 0) {
+        RDMAPP_LOG_DEBUG("failed to bind memory to node %d: %s", node,
+                         strerror(errno));
+      }
+    }
+  }
+  return ptr;
+}
+
+void free_on_node(void *ptr, size_t size) {
+  if (ptr != nullptr && ::munmap(ptr, size) != 0) [[unlikely]] {
+    RDMAPP_LOG_ERROR("failed to unmap %p: %s", ptr, strerror(errno));
+  }
+}
+
+frame_pool::frame_pool(int node)
+    : node_(node), free_lists_{}, bump_(nullptr), bump_end_(nullptr),
+      refs_(1) {}
+
+void *frame_pool::allocate(size_t size_class) {
+  auto const size = size_t{1} << (size_class + kMinFrameShift);
+  refs_.fetch_add(1, std::memory_order_relaxed);
+  std::lock_guard lock(lock_);
+  if (auto frame = free_lists_[size_class]; frame != nullptr) {
+    free_lists_[size_class] = *reinterpret_cast<void **>(frame);
+    return frame;
+  }
+  if (bump_ == nullptr || static_cast<size_t>(bump_end_ - bump_) < size) {
+    try {
+      bump_ = static_cast<char *>(alloc_on_node(kFrameChunkSize, node_));
+    } catch (...) {
+      refs_.fetch_sub(1, std::memory_order_relaxed);
+      throw;
+    }
+    bump_end_ = bump_ + kFrameChunkSize;
+    chunks_.push_back(bump_);
+  }
+  auto frame = bump_;
+  bump_ += size;
+  return frame;
+}
+
+void frame_pool::deallocate(void *ptr, size_t size_class) {
+  {
+    std::lock_guard lock(lock_);
+    *reinterpret_cast<void **>(ptr) = free_lists_[size_class];
+    free_lists_[size_class] = ptr;
+  }
+  release();
+}
+
+frame_pool *&frame_pool::current() {
+  thread_local frame_pool *pool = nullptr;
+  return pool;
+}
+
+void frame_pool::release() {
+  if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete this;
+  }
+}
+
+frame_pool::~frame_pool() {
+  for (auto chunk : chunks_) {
+    free_on_node(chunk, kFrameChunkSize);
+  }
+}
+
+void *allocate_frame(size_t size) {
+  auto const total = size + sizeof(frame_header);
+  auto const shift = std::max<size_t>(std::bit_width(total - 1),
+                                      frame_pool::kMinFrameShift);
+  auto const size_class = shift - frame_pool::kMinFrameShift;
+  auto pool = frame_pool::current();
+  frame_header *header;
+  if (pool != nullptr && size_class < frame_pool::kNrSizeClasses) [[likely]] {
+    header = static_cast<frame_header *>(pool->allocate(size_class));
+  } else {
+    header = static_cast<frame_header *>(::operator new(total));
+    pool = nullptr;
+  }
+  header->pool = pool;
+  header->size_class = size_class;
+  return header + 1;
+}
+
+void deallocate_frame(void *ptr) {
+  auto header = static_cast<frame_header *>(ptr) - 1;
+  if (header->pool != nullptr) {
+    header->pool->deallocate(header, header->size_class);
+  } else {
+    ::operator delete(header);
+  }
+}
+
+} // namespace detail
+} // namespace rdmapp
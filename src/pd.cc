@@ -13,9 +13,17 @@
 
 namespace rdmapp {
 
-pd::pd(std::shared_ptr<rdmapp::device> device) : device_(device) {
+pd::pd(std::shared_ptr<rdmapp::device> device, pd_config const &config)
+    : device_(device) {
   pd_ = ::ibv_alloc_pd(device->ctx_);
   check_ptr(pd_, "failed to alloc pd");
+  if (config.mr_cache_capacity > 0) {
+    mr_cache_ = std::make_unique<mr_cache>(pd_, config.mr_cache_capacity);
+  }
+  if (config.bounce_threshold > 0 && config.bounce_buffers_per_class > 0) {
+    bounce_pool_ = std::make_unique<buffer_pool>(
+        pd_, config.bounce_threshold, config.bounce_buffers_per_class);
+  }
   RDMAPP_LOG_TRACE("alloc pd %p", reinterpret_cast<void *>(pd_));
 }
 
@@ -27,10 +35,44 @@ local_mr pd::reg_mr(void *buffer, size_t length, int flags) {
   return rdmapp::local_mr(this->shared_from_this(), mr);
 }
 
+std::shared_ptr<local_mr> pd::reg_mr_cached(void *buffer, size_t length) {
+  if (mr_cache_ == nullptr) {
+    return std::make_shared<local_mr>(reg_mr(buffer, length));
+  }
+  return mr_cache_->acquire(this->shared_from_this(), buffer, length);
+}
+
+buffer_pool::buffer pd::bounce(void const *addr, size_t length) {
+  if (bounce_pool_ == nullptr) {
+    return buffer_pool::buffer();
+  }
+  auto buffer = bounce_pool_->acquire(length);
+  if (buffer) {
+    std::memcpy(buffer.addr(), addr, length);
+  }
+  return buffer;
+}
+
+void pd::invalidate_mr_cache(void *addr, size_t length) {
+  if (mr_cache_ != nullptr) {
+    mr_cache_->invalidate(addr, length);
+  }
+}
+
+mr_cache_stats pd::cache_stats() const {
+  if (mr_cache_ == nullptr) {
+    return {};
+  }
+  return mr_cache_->stats();
+}
+
 pd::~pd() {
   if (pd_ == nullptr) [[unlikely]] {
     return;
   }
+  // Cached registrations must go before the protection domain.
+  mr_cache_.reset();
+  bounce_pool_.reset();
   if (auto rc = ::ibv_dealloc_pd(pd_); rc != 0) [[unlikely]] {
     RDMAPP_LOG_ERROR("failed to dealloc pd %p: %s",
                      reinterpret_cast<void *>(pd_), strerror(errno));
@@ -10,24 +10,56 @@
 
 #include "rdmapp/poll_executor.h"
 
+#include "rdmapp/detail/completion.h"
 #include "rdmapp/detail/debug.h"
 
 namespace rdmapp {
 
+static inline void resume(void *h_ptr) {
+  std::coroutine_handle<>::from_address(h_ptr).resume();
+}
+
+static std::vector<std::shared_ptr<cq>>
+all_cqs(std::vector<std::shared_ptr<cq>> const &send_cqs,
+        std::vector<std::shared_ptr<cq>> const &recv_cqs) {
+  auto cqs = send_cqs;
+  cqs.insert(cqs.end(), recv_cqs.begin(), recv_cqs.end());
+  return cqs;
+}
+
 poll_executor::poll_executor(std::vector<std::shared_ptr<cq>>& send_cqs,
                              std::vector<std::shared_ptr<cq>>& recv_cqs,
-                             size_t batch_size)
-    : send_cqs_(send_cqs), recv_cqs_(recv_cqs), stopped_(false), connected_(false), wc_vec_(batch_size) {
-  work_queue_ = std::make_shared<work_queue>(4096);
+                             poll_batch batch_size,
+                             std::chrono::nanoseconds spin_budget)
+    : work_queue_(kWorkQueueSize), has_work_overflow_(false),
+      stopped_(false), connected_(false),
+      wc_vec_(batch_size.max),
+      batch_(batch_size), scheduler_(batch_size.max),
+      waiter_(all_cqs(send_cqs, recv_cqs), spin_budget, [this]() {
+        return listening_work_queue_.load(std::memory_order_relaxed) &&
+               (!work_queue_.empty() ||
+                has_work_overflow_.load(std::memory_order_relaxed));
+      }) {
+  for (auto &cq : all_cqs(send_cqs, recv_cqs)) {
+    scheduler_.add(cq);
+  }
+  scheduler_.apply();
   listening_work_queue_ = false;
   worker_thread_ = std::jthread(&poll_executor::work, this);
 }
 
 poll_executor::~poll_executor() {
   stopped_ = true;
+  waiter_.wake();
   worker_thread_.join();
 }
 
+wait_stats poll_executor::stats() const { return waiter_.stats(); }
+
+poller_metrics_snapshot poll_executor::metrics() const {
+  return metrics_.snapshot();
+}
+
 void poll_executor::connect_done() {
   connected_ = true;
 }
@@ -41,38 +73,80 @@ void poll_executor::disable_listening_work_queue() {
 }
 
 void poll_executor::work_enqueue(void* h_ptr) {
-  work_queue_->push(h_ptr);
+  if (stopped_) [[unlikely]] {
+    throw closed_exception();
+  }
+  // Only the worker thread drains the queue, and maybe not for a while (or it
+  // may be the caller): a full queue spills over instead of waiting. Once it
+  // has, the rest follows until the worker takes the overflow, to keep the
+  // order.
+  if (has_work_overflow_.load(std::memory_order_acquire) ||
+      !work_queue_.push(h_ptr)) [[unlikely]] {
+    std::lock_guard lock(work_overflow_mutex_);
+    work_overflow_.push_back(h_ptr);
+    has_work_overflow_.store(true, std::memory_order_release);
+  }
+  waiter_.wake();
+}
+
+bool poll_executor::resume_work() {
+  // A single batch per round, so that coroutines scheduling themselves again
+  // cannot starve the cqs.
+  void *h_ptrs[kWorkBatch];
+  auto const nr = work_queue_.pop_n(h_ptrs, kWorkBatch);
+  for (size_t i = 0; i < nr; ++i) {
+    std::coroutine_handle<>::from_address(h_ptrs[i]).resume();
+  }
+  if (nr == kWorkBatch ||
+      !has_work_overflow_.load(std::memory_order_acquire)) [[likely]] {
+    return nr != 0;
+  }
+  // The queue is empty: the overflow is next. Whatever is enqueued while it
+  // runs waits for the next round.
+  thread_local std::vector<void *> overflow;
+  {
+    std::lock_guard lock(work_overflow_mutex_);
+    overflow.swap(work_overflow_);
+    has_work_overflow_.store(false, std::memory_order_release);
+  }
+  for (auto h_ptr : overflow) {
+    std::coroutine_handle<>::from_address(h_ptr).resume();
+  }
+  overflow.clear();
+  return true;
+}
+
+void poll_executor::add_cq(std::shared_ptr<cq> cq, uint32_t weight) {
+  scheduler_.add(std::move(cq), weight);
+  waiter_.wake();
+}
+
+void poll_executor::remove_cq(std::shared_ptr<cq> const &cq) {
+  scheduler_.remove(cq);
+  waiter_.wake();
+}
+
+std::vector<std::pair<std::shared_ptr<cq>, cq_service_stats>>
+poll_executor::cq_stats() const {
+  return scheduler_.stats();
+}
+
+void poll_executor::flush_sends() {
+  for (auto &cq_ : scheduler_.cqs()) {
+    detail::flush_sends(*cq_, resume);
+  }
 }
 
 void poll_executor::connect_loop() {
   while (!connected_) {
     try {
-      for (auto &cq_ : send_cqs_) {
+      for (auto &cq_ : scheduler_.cqs()) {
         auto nr_wc = cq_->poll(wc_vec_);
         if (nr_wc != 0) {
-          for (size_t i = 0; i < nr_wc; ++i) {
-            auto &wc = wc_vec_[i];
-            struct ibv_wc *wc_ptr = reinterpret_cast<struct ibv_wc *>(wc.wr_id);
-            *wc_ptr = wc;
-            std::coroutine_handle<> h = std::coroutine_handle<>::from_address(
-                *reinterpret_cast<void **>(wc_ptr + 1));
-            h.resume();
-          }
-        }
-      }
-      for (auto &cq_ : recv_cqs_) {
-        auto nr_wc = cq_->poll(wc_vec_);
-        if (nr_wc != 0) {
-          for (size_t i = 0; i < nr_wc; ++i) {
-            auto &wc = wc_vec_[i];
-            struct ibv_wc *wc_ptr = reinterpret_cast<struct ibv_wc *>(wc.wr_id);
-            *wc_ptr = wc;
-            std::coroutine_handle<> h = std::coroutine_handle<>::from_address(
-                *reinterpret_cast<void **>(wc_ptr + 1));
-            h.resume();
-          }
+          detail::dispatch_wcs(*cq_, wc_vec_.data(), nr_wc, resume);
         }
       }
+      flush_sends();
     } catch (...) {
       stopped_ = true;
       return;
@@ -81,35 +155,29 @@ void poll_executor::connect_loop() {
 }
 
 void poll_executor::work() {
+  waiter_.bind_thread();
   connect_loop();
   while (!stopped_) {
     try {
-      for (auto &cq_ : recv_cqs_) {
-        auto nr_wc = cq_->poll(wc_vec_);
-        if (nr_wc != 0) {
-          for (size_t i = 0; i < nr_wc; ++i) {
-            auto &wc = wc_vec_[i];
-            struct ibv_wc *wc_ptr = reinterpret_cast<struct ibv_wc *>(wc.wr_id);
-            *wc_ptr = wc;
-            std::coroutine_handle<> h = std::coroutine_handle<>::from_address(
-                *reinterpret_cast<void **>(wc_ptr + 1));
-            h.resume();
-          }
-        }
-      }
-      for (auto &cq_ : send_cqs_) {
-        auto nr_wc = cq_->poll(wc_vec_);
+      if (scheduler_.sync()) {
+        waiter_.update_cqs(scheduler_.cqs());
       }
+      auto const batch = batch_.size();
+      bool progress = scheduler_.round(
+          waiter_.armed(), batch, [&](cq &cq, size_t max) {
+            auto nr_wc = cq.poll(wc_vec_.data(), max);
+            if (max == batch) {
+              batch_.update(nr_wc);
+            }
+            metrics_.dispatch(cq, wc_vec_.data(), nr_wc, resume);
+            return nr_wc;
+          });
       // process the work queue from the other threads
       if (listening_work_queue_.load(std::memory_order_relaxed)) {
-        void* h_ptr;
-        if (!work_queue_->empty()) {
-          while (work_queue_->pop(h_ptr)) {
-            std::coroutine_handle<> h = std::coroutine_handle<>::from_address(h_ptr);
-            h.resume();
-          }
-        }
+        progress |= resume_work();
       }
+      flush_sends();
+      waiter_.idle(progress, stopped_);
     } catch (...) {
       std::cout << "poll_executor stopped" << std::endl;
       stopped_ = true;
@@ -0,0 +1,101 @@
+#include "rdmapp/poller_metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "rdmapp/detail/debug.h"
+
+namespace rdmapp {
+
+poller_metrics_snapshot
+poller_metrics_snapshot::since(poller_metrics_snapshot const &earlier) const {
+  poller_metrics_snapshot diff;
+  diff.empty_polls = empty_polls - earlier.empty_polls;
+  diff.completions_per_poll =
+      completions_per_poll.since(earlier.completions_per_poll);
+  diff.empty_poll_streak = empty_poll_streak.since(earlier.empty_poll_streak);
+  diff.poll_to_resume_ns = poll_to_resume_ns.since(earlier.poll_to_resume_ns);
+  diff.dispatch_ns = dispatch_ns.since(earlier.dispatch_ns);
+  return diff;
+}
+
+std::string poller_metrics_snapshot::to_string() const {
+  char buffer[512];
+  ::snprintf(buffer, sizeof(buffer),
+             "polls=%lu empty=%lu wc/poll mean=%.2f p50=%lu max=%lu "
+             "streak p50=%lu p99=%lu resume_ns p50=%lu p99=%lu max=%lu "
+             "dispatch_ns p50=%lu p99=%lu max=%lu",
+             completions_per_poll.count + empty_polls, empty_polls,
+             completions_per_poll.mean(), completions_per_poll.percentile(0.5),
+             completions_per_poll.max, empty_poll_streak.percentile(0.5),
+             empty_poll_streak.percentile(0.99),
+             poll_to_resume_ns.percentile(0.5),
+             poll_to_resume_ns.percentile(0.99), poll_to_resume_ns.max,
+             dispatch_ns.percentile(0.5), dispatch_ns.percentile(0.99),
+             dispatch_ns.max);
+  return buffer;
+}
+
+namespace detail {
+
+poller_metrics::poller_metrics() : empty_streak_(0), empty_polls_(0) {}
+
+poller_metrics_snapshot poller_metrics::snapshot() const {
+  poller_metrics_snapshot snapshot;
+  snapshot.empty_polls = empty_polls_.load(std::memory_order_relaxed);
+  snapshot.completions_per_poll = completions_per_poll_.snapshot();
+  snapshot.empty_poll_streak = empty_poll_streak_.snapshot();
+  snapshot.poll_to_resume_ns = poll_to_resume_ns_.snapshot();
+  snapshot.dispatch_ns = dispatch_ns_.snapshot();
+  return snapshot;
+}
+
+} // namespace detail
+
+metrics_dumper::metrics_dumper(std::chrono::milliseconds interval, sink sink)
+    : interval_(interval), sink_(std::move(sink)), stopped_(false) {
+  if (!sink_) {
+    sink_ = [](std::string const &line) {
+      RDMAPP_LOG_INFO("%s", line.c_str());
+    };
+  }
+  dumper_thread_ = std::jthread(&metrics_dumper::dump_loop, this);
+}
+
+void metrics_dumper::add(std::string name, source source) {
+  std::lock_guard lock(mutex_);
+  auto last = source();
+  entries_.push_back({std::move(name), std::move(source), std::move(last)});
+}
+
+void metrics_dumper::dump() {
+  std::lock_guard lock(mutex_);
+  for (auto &entry : entries_) {
+    auto current = entry.get();
+    sink_(entry.name + ": " + current.since(entry.last).to_string());
+    entry.last = std::move(current);
+  }
+}
+
+void metrics_dumper::dump_loop() {
+  std::unique_lock lock(mutex_);
+  while (!cv_.wait_for(lock, interval_, [this]() { return stopped_; })) {
+    lock.unlock();
+    dump();
+    lock.lock();
+  }
+}
+
+metrics_dumper::~metrics_dumper() {
+  {
+    std::lock_guard lock(mutex_);
+    stopped_ = true;
+  }
+  cv_.notify_all();
+  dumper_thread_.join();
+}
+
+} // namespace rdmapp
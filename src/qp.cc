@@ -1,6 +1,7 @@
 #include "rdmapp/qp.h"
 
 #include <algorithm>
+#include <bit>
 #include <arpa/inet.h>
 #include <cassert>
 #include <cerrno>
@@ -29,6 +30,7 @@
 #include "rdmapp/pd.h"
 #include "rdmapp/srq.h"
 
+#include "rdmapp/detail/completion.h"
 #include "rdmapp/detail/debug.h"
 #include "rdmapp/detail/serdes.h"
 
@@ -37,24 +39,36 @@ namespace rdmapp {
 std::atomic<uint32_t> qp::next_sq_psn = 1;
 qp::qp(uint16_t remote_lid, uint32_t remote_qpn, uint32_t remote_psn,
        union ibv_gid remote_gid, std::shared_ptr<pd> pd, std::shared_ptr<cq> cq,
-       std::shared_ptr<srq> srq)
-    : qp(remote_lid, remote_qpn, remote_psn, remote_gid, pd, cq, cq, srq) {}
+       std::shared_ptr<srq> srq, qp_config const &config)
+    : qp(remote_lid, remote_qpn, remote_psn, remote_gid, pd, cq, cq, srq,
+         config) {}
 qp::qp(uint16_t remote_lid, uint32_t remote_qpn, uint32_t remote_psn,
        union ibv_gid remote_gid, std::shared_ptr<pd> pd,
        std::shared_ptr<cq> recv_cq, std::shared_ptr<cq> send_cq,
-       std::shared_ptr<srq> srq)
-    : qp(pd, recv_cq, send_cq, srq) {
+       std::shared_ptr<srq> srq, qp_config const &config)
+    : qp(pd, recv_cq, send_cq, srq, config) {
   rtr(remote_lid, remote_qpn, remote_psn, remote_gid);
   rts();
 }
 
 qp::qp(std::shared_ptr<rdmapp::pd> pd, std::shared_ptr<cq> cq,
-       std::shared_ptr<srq> srq)
-    : qp(pd, cq, cq, srq) {}
+       std::shared_ptr<srq> srq, qp_config const &config)
+    : qp(pd, cq, cq, srq, config) {}
 
 qp::qp(std::shared_ptr<rdmapp::pd> pd, std::shared_ptr<cq> recv_cq,
-       std::shared_ptr<cq> send_cq, std::shared_ptr<srq> srq)
-    : qp_(nullptr), pd_(pd), recv_cq_(recv_cq), send_cq_(send_cq), srq_(srq) {
+       std::shared_ptr<cq> send_cq, std::shared_ptr<srq> srq,
+       qp_config const &config)
+    : qp_(nullptr), qpx_(nullptr), pd_(pd), recv_cq_(recv_cq), send_cq_(send_cq), srq_(srq),
+      config_(config),
+      completions_(config.max_send_wr + config.max_recv_wr),
+      inline_threshold_(0), send_batch_len_(0), send_batch_size_(0),
+      send_batch_scheduled_(false), signal_interval_(0), next_send_seq_(0),
+      retired_send_seq_(0), unsignaled_(0), unsignaled_watched_(false),
+      send_overflow_head_(0), send_overflow_len_(0), send_failed_(false),
+      flushers_(0), cqes_reserved_(false) {
+  completions_.set_timed(
+      recv_cq_->timestamps() != timestamp_source::none ||
+      send_cq_->timestamps() != timestamp_source::none);
   create();
   init();
 }
@@ -63,6 +77,8 @@ std::vector<uint8_t> &qp::user_data() { return user_data_; }
 
 std::shared_ptr<pd> qp::pd_ptr() const { return pd_; }
 
+qp_config const &qp::config() const { return config_; }
+
 std::vector<uint8_t> qp::serialize() const {
   std::vector<uint8_t> buffer;
   auto it = std::back_inserter(buffer);
@@ -81,10 +97,12 @@ void qp::create() {
   qp_init_attr.qp_type = IBV_QPT_RC;
   qp_init_attr.recv_cq = recv_cq_->cq_;
   qp_init_attr.send_cq = send_cq_->cq_;
-  qp_init_attr.cap.max_recv_sge = 1;
-  qp_init_attr.cap.max_send_sge = 1;
-  qp_init_attr.cap.max_recv_wr = 128;
-  qp_init_attr.cap.max_send_wr = 128;
+  validate_config();
+  qp_init_attr.cap.max_recv_sge = config_.max_recv_sge;
+  qp_init_attr.cap.max_send_sge = config_.max_send_sge;
+  qp_init_attr.cap.max_recv_wr = config_.max_recv_wr;
+  qp_init_attr.cap.max_send_wr = config_.max_send_wr;
+  qp_init_attr.cap.max_inline_data = config_.max_inline_data;
   qp_init_attr.sq_sig_all = 0;
   qp_init_attr.qp_context = this;
 
@@ -96,14 +114,92 @@ void qp::create() {
     post_recv_fn = &qp::post_recv_rq;
   }
 
-  qp_ = ::ibv_create_qp(pd_->pd_, &qp_init_attr);
-  check_ptr(qp_, "failed to create qp");
+  if (config_.extended_verbs) {
+    struct ibv_qp_init_attr_ex qp_init_attr_ex = {};
+    ::bzero(&qp_init_attr_ex, sizeof(qp_init_attr_ex));
+    qp_init_attr_ex.qp_context = qp_init_attr.qp_context;
+    qp_init_attr_ex.send_cq = qp_init_attr.send_cq;
+    qp_init_attr_ex.recv_cq = qp_init_attr.recv_cq;
+    qp_init_attr_ex.srq = qp_init_attr.srq;
+    qp_init_attr_ex.cap = qp_init_attr.cap;
+    qp_init_attr_ex.qp_type = qp_init_attr.qp_type;
+    qp_init_attr_ex.sq_sig_all = qp_init_attr.sq_sig_all;
+    qp_init_attr_ex.comp_mask =
+        IBV_QP_INIT_ATTR_PD | IBV_QP_INIT_ATTR_SEND_OPS_FLAGS;
+    qp_init_attr_ex.pd = pd_->pd_;
+    qp_init_attr_ex.send_ops_flags =
+        IBV_QP_EX_WITH_SEND | IBV_QP_EX_WITH_SEND_WITH_IMM |
+        IBV_QP_EX_WITH_RDMA_WRITE | IBV_QP_EX_WITH_RDMA_WRITE_WITH_IMM |
+        IBV_QP_EX_WITH_RDMA_READ | IBV_QP_EX_WITH_ATOMIC_CMP_AND_SWP |
+        IBV_QP_EX_WITH_ATOMIC_FETCH_AND_ADD;
+    qp_ = ::ibv_create_qp_ex(pd_->device_->ctx_, &qp_init_attr_ex);
+    check_ptr(qp_, "failed to create extended qp");
+    qpx_ = ::ibv_qp_to_qp_ex(qp_);
+    if (qpx_ == nullptr) [[unlikely]] {
+      ::ibv_destroy_qp(qp_);
+      qp_ = nullptr;
+      throw_with("extended verbs are not supported by the device");
+    }
+    qp_init_attr.cap = qp_init_attr_ex.cap;
+  } else {
+    qp_ = ::ibv_create_qp(pd_->pd_, &qp_init_attr);
+    check_ptr(qp_, "failed to create qp");
+  }
   sq_psn_ = next_sq_psn.fetch_add(1);
+  config_.max_send_wr = qp_init_attr.cap.max_send_wr;
+  config_.max_recv_wr = qp_init_attr.cap.max_recv_wr;
+  config_.max_inline_data = qp_init_attr.cap.max_inline_data;
+  inline_threshold_.store(config_.max_inline_data, std::memory_order_relaxed);
+  try {
+    reserve_cqes();
+  } catch (...) {
+    ::ibv_destroy_qp(qp_);
+    qp_ = nullptr;
+    qpx_ = nullptr;
+    throw;
+  }
+  send_ring_.resize(std::bit_ceil(2 * config_.max_send_wr));
+  send_overflow_wr_.resize(std::bit_ceil(config_.max_send_wr));
+  send_overflow_sge_.resize(send_overflow_wr_.size() * config_.max_send_sge);
+  send_cq_->attach(qp_->qp_num, this);
   RDMAPP_LOG_TRACE("created qp %p lid=%u qpn=%u psn=%u",
                    reinterpret_cast<void *>(qp_), pd_->device_ptr()->lid(),
                    qp_->qp_num, sq_psn_);
 }
 
+void qp::validate_config() {
+  auto const &device_attr = pd_->device_ptr()->device_attr();
+  auto const &port_attr = pd_->device_ptr()->port_attr();
+  uint32_t const max_wr = device_attr.max_qp_wr;
+  uint32_t const max_sge = std::min<uint32_t>(
+      qp_config::kMaxSge, static_cast<uint32_t>(device_attr.max_sge));
+  if (config_.max_send_wr == 0 || config_.max_send_wr > max_wr ||
+      config_.max_recv_wr == 0 || config_.max_recv_wr > max_wr) [[unlikely]] {
+    throw_with("wr limits must be within [1, %u]", max_wr);
+  }
+  if (config_.max_send_sge == 0 || config_.max_send_sge > max_sge ||
+      config_.max_recv_sge == 0 || config_.max_recv_sge > max_sge)
+      [[unlikely]] {
+    throw_with("sge limits must be within [1, %u]", max_sge);
+  }
+  if (config_.timeout > 31 || config_.min_rnr_timer > 31) [[unlikely]] {
+    throw_with("timeout and min_rnr_timer must be within [0, 31]");
+  }
+  if (config_.retry_cnt > 7 || config_.rnr_retry > 7) [[unlikely]] {
+    throw_with("retry_cnt and rnr_retry must be within [0, 7]");
+  }
+  if (config_.path_mtu > port_attr.active_mtu) {
+    RDMAPP_LOG_DEBUG("clamping path mtu %d to active mtu %d",
+                     static_cast<int>(config_.path_mtu),
+                     static_cast<int>(port_attr.active_mtu));
+    config_.path_mtu = port_attr.active_mtu;
+  }
+  config_.max_rd_atomic = static_cast<uint8_t>(std::min<int>(
+      config_.max_rd_atomic, device_attr.max_qp_init_rd_atom));
+  config_.max_dest_rd_atomic = static_cast<uint8_t>(
+      std::min<int>(config_.max_dest_rd_atomic, device_attr.max_qp_rd_atom));
+}
+
 void qp::init() {
   struct ibv_qp_attr qp_attr = {};
   ::bzero(&qp_attr, sizeof(qp_attr));
@@ -119,7 +215,6 @@ void qp::init() {
              "failed to transition qp to init state");
   } catch (const std::exception &e) {
     RDMAPP_LOG_ERROR("%s", e.what());
-    qp_ = nullptr;
     destroy();
     throw;
   }
@@ -130,11 +225,11 @@ void qp::rtr(uint16_t remote_lid, uint32_t remote_qpn, uint32_t remote_psn,
   struct ibv_qp_attr qp_attr = {};
   ::bzero(&qp_attr, sizeof(qp_attr));
   qp_attr.qp_state = IBV_QPS_RTR;
-  qp_attr.path_mtu = IBV_MTU_4096;
+  qp_attr.path_mtu = config_.path_mtu;
   qp_attr.dest_qp_num = remote_qpn;
   qp_attr.rq_psn = remote_psn;
-  qp_attr.max_dest_rd_atomic = 16;
-  qp_attr.min_rnr_timer = 12;
+  qp_attr.max_dest_rd_atomic = config_.max_dest_rd_atomic;
+  qp_attr.min_rnr_timer = config_.min_rnr_timer;
   qp_attr.ah_attr.is_global = 1;
   qp_attr.ah_attr.grh.dgid = remote_gid;
   qp_attr.ah_attr.grh.sgid_index = pd_->device_->gid_index_;
@@ -153,7 +248,6 @@ void qp::rtr(uint16_t remote_lid, uint32_t remote_qpn, uint32_t remote_psn,
              "failed to transition qp to rtr state");
   } catch (const std::exception &e) {
     RDMAPP_LOG_ERROR("%s", e.what());
-    qp_ = nullptr;
     destroy();
     throw;
   }
@@ -163,10 +257,10 @@ void qp::rts() {
   struct ibv_qp_attr qp_attr = {};
   ::bzero(&qp_attr, sizeof(qp_attr));
   qp_attr.qp_state = IBV_QPS_RTS;
-  qp_attr.timeout = 14;
-  qp_attr.retry_cnt = 7;
-  qp_attr.rnr_retry = 7;
-  qp_attr.max_rd_atomic = 16;
+  qp_attr.timeout = config_.timeout;
+  qp_attr.retry_cnt = config_.retry_cnt;
+  qp_attr.rnr_retry = config_.rnr_retry;
+  qp_attr.max_rd_atomic = config_.max_rd_atomic;
   qp_attr.sq_psn = sq_psn_;
 
   try {
@@ -177,7 +271,6 @@ void qp::rts() {
              "failed to transition qp to rts state");
   } catch (std::exception const &e) {
     RDMAPP_LOG_ERROR("%s", e.what());
-    qp_ = nullptr;
     destroy();
     throw;
   }
@@ -188,11 +281,523 @@ void qp::post_send(struct ibv_send_wr const &send_wr,
   // RDMAPP_LOG_TRACE("post send wr_id=%p addr=%p",
   //                  reinterpret_cast<void *>(send_wr.wr_id),
   //                  reinterpret_cast<void *>(send_wr.sg_list->addr));
+  if (qpx_ != nullptr) {
+    bad_send_wr = nullptr;
+    post_send_ex(send_wr);
+    return;
+  }
   check_rc(::ibv_post_send(qp_, const_cast<struct ibv_send_wr *>(&send_wr),
                            &bad_send_wr),
            "failed to post send");
 }
 
+void qp::post_send_ex(struct ibv_send_wr const &send_wr) {
+  ::ibv_wr_start(qpx_);
+  for (auto wr = &send_wr; wr != nullptr; wr = wr->next) {
+    qpx_->wr_id = wr->wr_id;
+    qpx_->wr_flags = wr->send_flags & ~IBV_SEND_INLINE;
+    switch (wr->opcode) {
+    case IBV_WR_SEND:
+      ::ibv_wr_send(qpx_);
+      break;
+    case IBV_WR_SEND_WITH_IMM:
+      ::ibv_wr_send_imm(qpx_, wr->imm_data);
+      break;
+    case IBV_WR_RDMA_WRITE:
+      ::ibv_wr_rdma_write(qpx_, wr->wr.rdma.rkey, wr->wr.rdma.remote_addr);
+      break;
+    case IBV_WR_RDMA_WRITE_WITH_IMM:
+      ::ibv_wr_rdma_write_imm(qpx_, wr->wr.rdma.rkey, wr->wr.rdma.remote_addr,
+                              wr->imm_data);
+      break;
+    case IBV_WR_RDMA_READ:
+      ::ibv_wr_rdma_read(qpx_, wr->wr.rdma.rkey, wr->wr.rdma.remote_addr);
+      break;
+    case IBV_WR_ATOMIC_CMP_AND_SWP:
+      ::ibv_wr_atomic_cmp_swp(qpx_, wr->wr.atomic.rkey,
+                              wr->wr.atomic.remote_addr,
+                              wr->wr.atomic.compare_add, wr->wr.atomic.swap);
+      break;
+    case IBV_WR_ATOMIC_FETCH_AND_ADD:
+      ::ibv_wr_atomic_fetch_add(qpx_, wr->wr.atomic.rkey,
+                                wr->wr.atomic.remote_addr,
+                                wr->wr.atomic.compare_add);
+      break;
+    default:
+      ::ibv_wr_abort(qpx_);
+      throw_with("unsupported opcode %d for extended qp",
+                 static_cast<int>(wr->opcode));
+    }
+    if (wr->send_flags & IBV_SEND_INLINE) {
+      struct ibv_data_buf bufs[qp_config::kMaxSge];
+      for (int i = 0; i < wr->num_sge; ++i) {
+        bufs[i].addr = reinterpret_cast<void *>(wr->sg_list[i].addr);
+        bufs[i].length = wr->sg_list[i].length;
+      }
+      ::ibv_wr_set_inline_data_list(qpx_, wr->num_sge, bufs);
+    } else {
+      ::ibv_wr_set_sge_list(qpx_, wr->num_sge, wr->sg_list);
+    }
+  }
+  check_rc(::ibv_wr_complete(qpx_), "failed to post send");
+}
+
+void qp::set_send_batch_size(size_t batch_size) {
+  bool schedule = false;
+  {
+    std::lock_guard lock(send_lock_);
+    flush_sends_locked();
+    schedule = schedule_failed_locked();
+    send_batch_size_ = batch_size > 1 ? batch_size : 0;
+    send_batch_wr_.resize(send_batch_size_);
+    send_batch_sge_.resize(send_batch_size_ * config_.max_send_sge);
+  }
+  if (schedule) {
+    send_cq_->schedule_flush(this);
+  }
+}
+
+static inline uint32_t total_sge_length(struct ibv_send_wr const &send_wr) {
+  uint32_t length = 0;
+  for (int i = 0; i < send_wr.num_sge; ++i) {
+    length += send_wr.sg_list[i].length;
+  }
+  return length;
+}
+
+void qp::set_inline_threshold(size_t threshold) {
+  inline_threshold_.store(
+      static_cast<uint32_t>(
+          std::min<size_t>(threshold, config_.max_inline_data)),
+      std::memory_order_relaxed);
+}
+
+size_t qp::inline_threshold() const {
+  return inline_threshold_.load(std::memory_order_relaxed);
+}
+
+bool qp::is_inline(enum ibv_wr_opcode opcode, size_t length) const {
+  switch (opcode) {
+  case IBV_WR_SEND:
+  case IBV_WR_SEND_WITH_IMM:
+  case IBV_WR_RDMA_WRITE:
+  case IBV_WR_RDMA_WRITE_WITH_IMM: {
+    auto const threshold = inline_threshold_.load(std::memory_order_relaxed);
+    return length <= threshold && threshold > 0;
+  }
+  default:
+    return false;
+  }
+}
+
+std::shared_ptr<local_mr> qp::reg_send_buffer(void *buffer, size_t length,
+                                              enum ibv_wr_opcode opcode,
+                                              buffer_pool::buffer &bounce) {
+  if (is_inline(opcode, length)) {
+    return nullptr;
+  }
+  switch (opcode) {
+  case IBV_WR_SEND:
+  case IBV_WR_SEND_WITH_IMM:
+  case IBV_WR_RDMA_WRITE:
+  case IBV_WR_RDMA_WRITE_WITH_IMM:
+    if (bounce = pd_->bounce(buffer, length); bounce) {
+      return nullptr;
+    }
+    break;
+  default:
+    break;
+  }
+  return pd_->reg_mr_cached(buffer, length);
+}
+
+void qp::submit_send(struct ibv_send_wr &send_wr) {
+  if (is_inline(send_wr.opcode, total_sge_length(send_wr))) {
+    send_wr.send_flags |= IBV_SEND_INLINE;
+  }
+  bool schedule = false;
+  {
+    std::lock_guard lock(send_lock_);
+    if (send_failed_) [[unlikely]] {
+      struct ibv_wc wc = {};
+      wc.status = IBV_WC_WR_FLUSH_ERR;
+      wc.qp_num = qp_->qp_num;
+      fail_send_locked(make_tracked_send(send_wr.wr_id, 0), wc);
+    } else if (send_overflow_len_ != 0 || send_credits_locked() == 0)
+        [[unlikely]] {
+      // Parked requests keep their submission order: nothing overtakes them.
+      park_send_locked(send_wr);
+      RDMAPP_LOG_TRACE("parked send wr on qp %p, %lu parked",
+                       reinterpret_cast<void *>(qp_), send_overflow_len_);
+      return;
+    } else {
+      schedule = enqueue_send_locked(send_wr);
+    }
+    schedule |= schedule_failed_locked();
+  }
+  // Scheduled outside of send_lock_: the CQ always takes its own lock
+  // before ours when flushing.
+  if (schedule) {
+    send_cq_->schedule_flush(this);
+  }
+}
+
+bool qp::enqueue_send_locked(struct ibv_send_wr &send_wr) {
+  if (send_batch_size_ == 0) {
+    // Each post is its own doorbell batch, so a watched request is always
+    // the last one and must be signaled.
+    track_send(send_wr);
+    if (unsignaled_watched_) {
+      signal_send(send_wr);
+    }
+    post_tracked_locked(send_wr);
+    return false;
+  }
+  assert(send_wr.num_sge <= static_cast<int>(config_.max_send_sge));
+  auto &wr = send_batch_wr_[send_batch_len_];
+  auto sges = &send_batch_sge_[send_batch_len_ * config_.max_send_sge];
+  wr = send_wr;
+  wr.next = nullptr;
+  std::copy_n(send_wr.sg_list, send_wr.num_sge, sges);
+  wr.sg_list = sges;
+  track_send(wr);
+  if (send_batch_len_ > 0) {
+    send_batch_wr_[send_batch_len_ - 1].next = &wr;
+  }
+  if (++send_batch_len_ == send_batch_size_) {
+    flush_sends_locked();
+    return false;
+  }
+  return request_flush_locked();
+}
+
+bool qp::request_flush_locked() {
+  if (send_batch_scheduled_) {
+    return false;
+  }
+  send_batch_scheduled_ = true;
+  return true;
+}
+
+bool qp::schedule_failed_locked() {
+  if (failed_sends_.empty() && failed_direct_sends_.empty()) [[likely]] {
+    return false;
+  }
+  return request_flush_locked();
+}
+
+size_t qp::send_credits_locked() const {
+  return config_.max_send_wr - (next_send_seq_ - retired_send_seq_);
+}
+
+void qp::park_send_locked(struct ibv_send_wr const &send_wr) {
+  auto const max_sge = config_.max_send_sge;
+  if (send_overflow_len_ == send_overflow_wr_.size()) [[unlikely]] {
+    // Unwrapped into a ring twice as large; the SGE lists are repointed when
+    // the requests are drained.
+    auto const capacity = send_overflow_wr_.size();
+    std::vector<struct ibv_send_wr> wrs(2 * capacity);
+    std::vector<struct ibv_sge> sges(2 * capacity * max_sge);
+    for (size_t i = 0; i < capacity; ++i) {
+      auto const from = (send_overflow_head_ + i) & (capacity - 1);
+      wrs[i] = send_overflow_wr_[from];
+      std::copy_n(&send_overflow_sge_[from * max_sge], max_sge,
+                  &sges[i * max_sge]);
+    }
+    send_overflow_wr_.swap(wrs);
+    send_overflow_sge_.swap(sges);
+    send_overflow_head_ = 0;
+  }
+  auto const index = (send_overflow_head_ + send_overflow_len_++) &
+                     (send_overflow_wr_.size() - 1);
+  auto &wr = send_overflow_wr_[index];
+  wr = send_wr;
+  wr.next = nullptr;
+  std::copy_n(send_wr.sg_list, send_wr.num_sge,
+              &send_overflow_sge_[index * max_sge]);
+}
+
+void qp::drain_overflow_locked() {
+  size_t nr_drained = 0;
+  while (send_overflow_len_ != 0 && send_credits_locked() > 0 &&
+         !send_failed_) {
+    auto const index = send_overflow_head_;
+    auto &wr = send_overflow_wr_[index];
+    wr.sg_list = &send_overflow_sge_[index * config_.max_send_sge];
+    send_overflow_head_ = (index + 1) & (send_overflow_wr_.size() - 1);
+    --send_overflow_len_;
+    enqueue_send_locked(wr);
+    ++nr_drained;
+  }
+  if (nr_drained == 0) {
+    return;
+  }
+  // Nobody else may be around to flush what was just batched.
+  flush_sends_locked();
+  RDMAPP_LOG_TRACE("posted %lu parked send wrs on qp %p, %lu still parked",
+                   nr_drained, reinterpret_cast<void *>(qp_),
+                   send_overflow_len_);
+}
+
+void qp::flush_sends() {
+  bool schedule = false;
+  {
+    std::lock_guard lock(send_lock_);
+    flush_sends_locked();
+    schedule = schedule_failed_locked();
+  }
+  if (schedule) {
+    send_cq_->schedule_flush(this);
+  }
+}
+
+void qp::flush_sends(std::vector<void *> &handles) {
+  thread_local std::vector<std::pair<uint64_t, enum ibv_wc_status>> failed;
+  decltype(direct_sent_handler_) handler;
+  {
+    std::lock_guard lock(send_lock_);
+    flush_sends_locked();
+    take_failed_sends_locked(handles, failed);
+    if (!failed.empty()) [[unlikely]] {
+      handler = direct_sent_handler_;
+    }
+  }
+  if (handler) {
+    for (auto [cookie, status] : failed) {
+      handler(cookie, status);
+    }
+  }
+  failed.clear();
+}
+
+void qp::flush_sends_locked() {
+  send_batch_scheduled_ = false;
+  if (send_batch_len_ == 0) {
+    return;
+  }
+  auto const nr_wr = std::exchange(send_batch_len_, 0);
+  if (unsignaled_watched_) {
+    signal_send(send_batch_wr_[nr_wr - 1]);
+  }
+  post_tracked_locked(send_batch_wr_[0]);
+  RDMAPP_LOG_TRACE("posted %lu batched send wrs on qp %p", nr_wr,
+                   reinterpret_cast<void *>(qp_));
+}
+
+void qp::post_tracked_locked(struct ibv_send_wr &send_wr) {
+  struct ibv_send_wr *bad_send_wr = nullptr;
+  try {
+    post_send(send_wr, bad_send_wr);
+    return;
+  } catch (std::exception const &e) {
+    RDMAPP_LOG_ERROR("%s on qp %p", e.what(), reinterpret_cast<void *>(qp_));
+  }
+  // An extended Queue Pair posts all or nothing.
+  if (bad_send_wr == nullptr) {
+    bad_send_wr = &send_wr;
+  }
+  // The chain holds the last tracked work requests: those from bad_send_wr
+  // on never reached the send queue and would never complete.
+  uint64_t nr_unposted = 0;
+  for (auto wr = bad_send_wr; wr != nullptr; wr = wr->next) {
+    ++nr_unposted;
+  }
+  fail_sends_locked(next_send_seq_ - nr_unposted, IBV_WC_WR_FLUSH_ERR);
+  next_send_seq_ -= nr_unposted;
+  // Moved to the error state, the Queue Pair flushes the work requests that
+  // were posted, which complete through the CQ once the NIC is done with
+  // their buffers.
+  struct ibv_qp_attr qp_attr = {};
+  qp_attr.qp_state = IBV_QPS_ERR;
+  if (::ibv_modify_qp(qp_, &qp_attr, IBV_QP_STATE) != 0) [[unlikely]] {
+    RDMAPP_LOG_ERROR("failed to move qp %p to the error state: %s",
+                     reinterpret_cast<void *>(qp_), strerror(errno));
+  }
+  abort_sends_locked();
+}
+
+void qp::fail_sends_locked(uint64_t seq, enum ibv_wc_status status) {
+  struct ibv_wc wc = {};
+  wc.status = status;
+  wc.qp_num = qp_->qp_num;
+  auto const mask = send_ring_.size() - 1;
+  for (; seq != next_send_seq_; ++seq) {
+    fail_send_locked(send_ring_[seq & mask], wc);
+  }
+}
+
+void qp::fail_send_locked(tracked_send const &entry, struct ibv_wc const &wc) {
+  if (entry.direct) {
+    if (direct_sent_handler_) {
+      failed_direct_sends_.emplace_back(entry.cookie, wc.status);
+    }
+    return;
+  }
+  if (entry.slot == nullptr) {
+    return;
+  }
+  if (entry.slot->coroutine_addr == nullptr) {
+    completions_.release(entry.slot);
+    return;
+  }
+  if (auto h = detail::complete_slot(*entry.slot, wc); h != nullptr) {
+    failed_sends_.push_back(h);
+  }
+}
+
+void qp::abort_sends_locked() {
+  send_failed_ = true;
+  struct ibv_wc wc = {};
+  wc.status = IBV_WC_WR_FLUSH_ERR;
+  wc.qp_num = qp_->qp_num;
+  for (; send_overflow_len_ != 0; --send_overflow_len_) {
+    auto const &wr = send_overflow_wr_[send_overflow_head_];
+    fail_send_locked(make_tracked_send(wr.wr_id, 0), wc);
+    send_overflow_head_ =
+        (send_overflow_head_ + 1) & (send_overflow_wr_.size() - 1);
+  }
+}
+
+void qp::take_failed_sends_locked(
+    std::vector<void *> &handles,
+    std::vector<std::pair<uint64_t, enum ibv_wc_status>> &direct) {
+  if (!failed_sends_.empty()) [[unlikely]] {
+    handles.insert(handles.end(), failed_sends_.begin(), failed_sends_.end());
+    failed_sends_.clear();
+  }
+  if (!failed_direct_sends_.empty()) [[unlikely]] {
+    direct.insert(direct.end(), failed_direct_sends_.begin(),
+                  failed_direct_sends_.end());
+    failed_direct_sends_.clear();
+  }
+}
+
+void qp::set_signal_interval(size_t interval) {
+  bool schedule = false;
+  {
+    std::lock_guard lock(send_lock_);
+    flush_sends_locked();
+    schedule = schedule_failed_locked();
+    signal_interval_ =
+        interval > 1 ? std::min<size_t>(interval, config_.max_send_wr / 2) : 0;
+    if (signal_interval_ == 1) {
+      signal_interval_ = 0;
+    }
+    unsignaled_ = 0;
+    unsignaled_watched_ = false;
+  }
+  if (schedule) {
+    send_cq_->schedule_flush(this);
+  }
+}
+
+void qp::track_send(struct ibv_send_wr &send_wr) {
+  assert(next_send_seq_ - retired_send_seq_ < send_ring_.size());
+  auto const seq = next_send_seq_++;
+  auto &entry = send_ring_[seq & (send_ring_.size() - 1)];
+  entry = make_tracked_send(send_wr.wr_id, total_sge_length(send_wr));
+  send_wr.wr_id = detail::make_tracked_wr_id(seq);
+  send_wr.send_flags &= ~IBV_SEND_SIGNALED;
+  if (++unsignaled_ >= signal_interval_) {
+    signal_send(send_wr);
+  } else if (entry.slot != nullptr || (entry.direct && direct_sent_handler_)) {
+    unsignaled_watched_ = true;
+  }
+}
+
+qp::tracked_send qp::make_tracked_send(uint64_t wr_id, uint32_t length) {
+  tracked_send entry = {};
+  entry.direct = detail::is_direct_wr_id(wr_id);
+  if (entry.direct) {
+    entry.cookie = wr_id >> 2;
+  } else {
+    entry.slot = reinterpret_cast<detail::completion_slot *>(wr_id);
+  }
+  entry.length = length;
+  return entry;
+}
+
+void qp::signal_send(struct ibv_send_wr &send_wr) {
+  send_wr.send_flags |= IBV_SEND_SIGNALED;
+  unsignaled_ = 0;
+  unsignaled_watched_ = false;
+}
+
+void qp::retire_sends(struct ibv_wc const &wc, std::vector<void *> &handles,
+                      uint64_t completed_at) {
+  thread_local std::vector<std::pair<uint64_t, enum ibv_wc_status>> sent;
+  decltype(direct_sent_handler_) handler;
+  {
+    std::lock_guard lock(send_lock_);
+    auto const seq = detail::tracked_wr_id_seq(wc.wr_id);
+    if (seq - retired_send_seq_ >= next_send_seq_ - retired_send_seq_)
+        [[unlikely]] {
+      RDMAPP_LOG_DEBUG("ignored stale send completion seq=%lu on qp %p", seq,
+                       reinterpret_cast<void *>(qp_));
+      return;
+    }
+    auto const mask = send_ring_.size() - 1;
+    // Send queue work requests complete in order: every unsignaled request
+    // posted before the completed one has finished successfully.
+    while (retired_send_seq_ != seq + 1) {
+      auto const retiring = retired_send_seq_++;
+      auto &entry = send_ring_[retiring & mask];
+      auto const status = retiring == seq ? wc.status : IBV_WC_SUCCESS;
+      if (entry.direct) {
+        if (direct_sent_handler_) {
+          sent.emplace_back(entry.cookie, status);
+        }
+        continue;
+      }
+      if (entry.slot == nullptr) {
+        continue;
+      }
+      if (entry.slot->coroutine_addr == nullptr) [[unlikely]] {
+        completions_.release(entry.slot);
+        continue;
+      }
+      struct ibv_wc entry_wc = wc;
+      entry_wc.status = status;
+      if (entry_wc.status == IBV_WC_SUCCESS) {
+        entry_wc.byte_len = entry.length;
+      }
+      if (auto h = detail::complete_slot(*entry.slot, entry_wc, completed_at);
+          h != nullptr) {
+        handles.push_back(h);
+      }
+    }
+    if (wc.status != IBV_WC_SUCCESS && !send_failed_) [[unlikely]] {
+      // The Queue Pair is in the error state: the NIC flushes what was
+      // posted, and nothing parked can be posted anymore.
+      abort_sends_locked();
+    }
+    drain_overflow_locked();
+    take_failed_sends_locked(handles, sent);
+    // Copied, as on_direct_sent() may replace it once the lock is released.
+    if (!sent.empty()) {
+      handler = direct_sent_handler_;
+    }
+  }
+  // Called without send_lock_, so that the handler can post again.
+  if (handler) {
+    for (auto [cookie, status] : sent) {
+      handler(cookie, status);
+    }
+  }
+  sent.clear();
+}
+
+void qp::on_direct_sent(
+    std::function<void(uint64_t cookie, enum ibv_wc_status status)> handler) {
+  std::lock_guard lock(send_lock_);
+  direct_sent_handler_ = std::move(handler);
+}
+
+void qp::abandon_send(detail::completion_slot *slot) {
+  std::lock_guard lock(send_lock_);
+  slot->coroutine_addr = nullptr;
+}
+
 void qp::post_recv(struct ibv_recv_wr const &recv_wr,
                    struct ibv_recv_wr *&bad_recv_wr) const {
   (this->*(post_recv_fn))(recv_wr, bad_recv_wr);
@@ -216,65 +821,23 @@ void qp::post_recv_srq(struct ibv_recv_wr const &recv_wr,
            "failed to post srq recv");
 }
 
-qp::send_awaitable::send_awaitable(std::shared_ptr<qp> qp, void *buffer,
-                                   size_t length, enum ibv_wr_opcode opcode)
-    : qp_(qp),
-      local_mr_(std::make_shared<local_mr>(qp_->pd_->reg_mr(buffer, length))),
-      remote_mr_(), wc_(), opcode_(opcode) {}
-qp::send_awaitable::send_awaitable(std::shared_ptr<qp> qp, void *buffer,
-                                   size_t length, enum ibv_wr_opcode opcode,
-                                   remote_mr const &remote_mr)
+template <enum ibv_wr_opcode Opcode>
+qp::send_awaitable<Opcode>::send_awaitable(std::shared_ptr<qp> qp,
+                                           void *buffer, size_t length,
+                                           operands const &operands)
     : qp_(qp),
-      local_mr_(std::make_shared<local_mr>(qp_->pd_->reg_mr(buffer, length))),
-      remote_mr_(remote_mr), opcode_(opcode) {}
-qp::send_awaitable::send_awaitable(std::shared_ptr<qp> qp, void *buffer,
-                                   size_t length, enum ibv_wr_opcode opcode,
-                                   remote_mr const &remote_mr, uint32_t imm)
-    : qp_(qp),
-      local_mr_(std::make_shared<local_mr>(qp_->pd_->reg_mr(buffer, length))),
-      remote_mr_(remote_mr), imm_(imm), opcode_(opcode) {}
-qp::send_awaitable::send_awaitable(std::shared_ptr<qp> qp, void *buffer,
-                                   size_t length, enum ibv_wr_opcode opcode,
-                                   remote_mr const &remote_mr, uint64_t add)
-    : qp_(qp),
-      local_mr_(std::make_shared<local_mr>(qp_->pd_->reg_mr(buffer, length))),
-      remote_mr_(remote_mr), compare_add_(add), opcode_(opcode) {}
-qp::send_awaitable::send_awaitable(std::shared_ptr<qp> qp, void *buffer,
-                                   size_t length, enum ibv_wr_opcode opcode,
-                                   remote_mr const &remote_mr, uint64_t compare,
-                                   uint64_t swap)
-    : qp_(qp),
-      local_mr_(std::make_shared<local_mr>(qp_->pd_->reg_mr(buffer, length))),
-      remote_mr_(remote_mr), compare_add_(compare), swap_(swap),
-      opcode_(opcode) {}
-qp::send_awaitable::send_awaitable(std::shared_ptr<qp> qp,
-                                   std::shared_ptr<local_mr> local_mr,
-                                   enum ibv_wr_opcode opcode)
-    : qp_(qp), local_mr_(local_mr), remote_mr_(), wc_(), opcode_(opcode) {}
-qp::send_awaitable::send_awaitable(std::shared_ptr<qp> qp,
-                                   std::shared_ptr<local_mr> local_mr,
-                                   enum ibv_wr_opcode opcode,
-                                   remote_mr const &remote_mr)
-    : qp_(qp), local_mr_(local_mr), remote_mr_(remote_mr), opcode_(opcode) {}
-qp::send_awaitable::send_awaitable(std::shared_ptr<qp> qp,
-                                   std::shared_ptr<local_mr> local_mr,
-                                   enum ibv_wr_opcode opcode,
-                                   remote_mr const &remote_mr, uint32_t imm)
-    : qp_(qp), local_mr_(local_mr), remote_mr_(remote_mr), imm_(imm),
-      opcode_(opcode) {}
-qp::send_awaitable::send_awaitable(std::shared_ptr<qp> qp,
-                                   std::shared_ptr<local_mr> local_mr,
-                                   enum ibv_wr_opcode opcode,
-                                   remote_mr const &remote_mr, uint64_t add)
-    : qp_(qp), local_mr_(local_mr), remote_mr_(remote_mr), compare_add_(add),
-      opcode_(opcode) {}
-qp::send_awaitable::send_awaitable(std::shared_ptr<qp> qp,
-                                   std::shared_ptr<local_mr> local_mr,
-                                   enum ibv_wr_opcode opcode,
-                                   remote_mr const &remote_mr,
-                                   uint64_t compare, uint64_t swap)
-    : qp_(qp), local_mr_(local_mr), remote_mr_(remote_mr),
-      compare_add_(compare), swap_(swap), opcode_(opcode) {}
+      local_mr_(qp_->reg_send_buffer(buffer, length, Opcode, bounce_)),
+      buffer_(buffer), length_(length), operands_(operands) {}
+template <enum ibv_wr_opcode Opcode>
+qp::send_awaitable<Opcode>::send_awaitable(std::shared_ptr<qp> qp,
+                                           std::shared_ptr<local_mr> local_mr,
+                                           operands const &operands)
+    : qp_(qp), local_mr_(local_mr), operands_(operands) {}
+template <enum ibv_wr_opcode Opcode>
+qp::send_awaitable<Opcode>::send_awaitable(
+    std::shared_ptr<qp> qp, std::span<local_mr_segment const> segments,
+    operands const &operands)
+    : qp_(qp), segments_(segments), operands_(operands) {}
 
 static inline struct ibv_sge fill_local_sge(local_mr const &mr, const size_t length) {
   struct ibv_sge sge = {};
@@ -292,165 +855,246 @@ static inline struct ibv_sge fill_local_sge(local_mr const &mr) {
   return sge;
 }
 
-bool qp::send_awaitable::await_ready() const noexcept { return false; }
-bool qp::send_awaitable::await_suspend(std::coroutine_handle<> h) noexcept {
-  coroutine_addr_ = h.address();
+static inline int fill_segment_sges(std::span<local_mr_segment const> segments,
+                                    struct ibv_sge *sges) {
+  for (size_t i = 0; i < segments.size(); ++i) {
+    auto const &segment = segments[i];
+    assert(segment.offset + segment.length <= segment.mr->length());
+    sges[i].addr = reinterpret_cast<uint64_t>(segment.mr->addr()) +
+                   segment.offset;
+    sges[i].length = segment.length;
+    sges[i].lkey = segment.mr->lkey();
+  }
+  return static_cast<int>(segments.size());
+}
 
-  if (length_ == -1) {
-    length_ = local_mr_->length();
+template <enum ibv_wr_opcode Opcode>
+bool qp::send_awaitable<Opcode>::await_ready() const noexcept {
+  return false;
+}
+
+template <enum ibv_wr_opcode Opcode>
+bool qp::send_awaitable<Opcode>::await_suspend(
+    std::coroutine_handle<> h) noexcept {
+
+  struct ibv_sge send_sges[qp_config::kMaxSge];
+  int num_sge = 1;
+  unsigned int send_flags = IBV_SEND_SIGNALED;
+  if (!segments_.empty()) {
+    num_sge = fill_segment_sges(segments_, send_sges);
+  } else if (bounce_) {
+    send_sges[0] = {};
+    send_sges[0].addr = reinterpret_cast<uint64_t>(bounce_.addr());
+    send_sges[0].length = length_;
+    send_sges[0].lkey = bounce_.lkey();
+  } else if (local_mr_ != nullptr && buffer_ != nullptr) {
+    // A raw buffer: its registration may be a cached one covering more.
+    send_sges[0] = fill_local_sge(*local_mr_, length_);
+    send_sges[0].addr = reinterpret_cast<uint64_t>(buffer_);
+  } else if (local_mr_ != nullptr) {
+    if (length_ == static_cast<size_t>(-1)) {
+      length_ = local_mr_->length();
+    }
+    send_sges[0] = fill_local_sge(*local_mr_, length_);
+  } else {
+    // Found inline when the buffer was not registered: the buffer is copied
+    // at post time and needs no lkey, whatever the threshold is by now.
+    send_sges[0] = {};
+    send_sges[0].addr = reinterpret_cast<uint64_t>(buffer_);
+    send_sges[0].length = length_;
+    send_flags |= IBV_SEND_INLINE;
   }
-  auto send_sge = fill_local_sge(*local_mr_, length_);
 
   struct ibv_send_wr send_wr = {};
-  struct ibv_send_wr *bad_send_wr = nullptr;
-  send_wr.opcode = opcode_;
+  send_wr.opcode = Opcode;
   send_wr.next = nullptr;
-  send_wr.num_sge = 1;
-  send_wr.wr_id = reinterpret_cast<uint64_t>(this);
-  send_wr.send_flags = IBV_SEND_SIGNALED;
-  send_wr.sg_list = &send_sge;
-  if (is_rdma()) {
-    assert(remote_mr_.addr() != nullptr);
-    send_wr.wr.rdma.remote_addr = reinterpret_cast<uint64_t>(remote_mr_.addr());
-    send_wr.wr.rdma.rkey = remote_mr_.rkey();
-    if (opcode_ == IBV_WR_RDMA_WRITE_WITH_IMM) {
-      send_wr.imm_data = imm_;
-    }
-  } else if (is_atomic()) {
-    assert(remote_mr_.addr() != nullptr);
-    send_wr.wr.atomic.remote_addr =
-        reinterpret_cast<uint64_t>(remote_mr_.addr());
-    send_wr.wr.atomic.rkey = remote_mr_.rkey();
-    send_wr.wr.atomic.compare_add = compare_add_;
-    if (opcode_ == IBV_WR_ATOMIC_CMP_AND_SWP) {
-      send_wr.wr.atomic.swap = swap_;
+  send_wr.num_sge = num_sge;
+  send_wr.send_flags = send_flags;
+  send_wr.sg_list = send_sges;
+  operands_.apply(send_wr);
+
+  try {
+    slot_ = qp_->completions_.acquire(h.address());
+    send_wr.wr_id = reinterpret_cast<uint64_t>(slot_);
+    qp_->submit_send(send_wr);
+  } catch (...) {
+    if (slot_ != nullptr) {
+      qp_->abandon_send(slot_);
     }
+    exception_ = std::current_exception();
+    return false;
   }
-
-  qp_->post_send(send_wr, bad_send_wr);
-
   return true;
 }
 
-constexpr bool qp::send_awaitable::is_rdma() const {
-  return opcode_ == IBV_WR_RDMA_READ || opcode_ == IBV_WR_RDMA_WRITE ||
-         opcode_ == IBV_WR_RDMA_WRITE_WITH_IMM;
-}
-
-constexpr bool qp::send_awaitable::is_atomic() const {
-  return opcode_ == IBV_WR_ATOMIC_CMP_AND_SWP ||
-         opcode_ == IBV_WR_ATOMIC_FETCH_AND_ADD;
-}
-
-uint32_t qp::send_awaitable::await_resume() const {
+template <enum ibv_wr_opcode Opcode>
+uint32_t qp::send_awaitable<Opcode>::await_resume() const {
   if (exception_) [[unlikely]] {
     std::rethrow_exception(exception_);
   }
-  check_wc_status(wc_.status, "failed to send");
-  return wc_.byte_len;
+  auto const result =
+      qp_->completions_.take(slot_, detail::wc_opcode_of(Opcode));
+  check_wc_status(result.status, "failed to send");
+  return result.byte_len;
 }
 
-qp::send_awaitable qp::send(void *buffer, size_t length) {
-  return qp::send_awaitable(this->shared_from_this(), buffer, length,
-                            IBV_WR_SEND);
+template class qp::send_awaitable<IBV_WR_SEND>;
+template class qp::send_awaitable<IBV_WR_RDMA_WRITE>;
+template class qp::send_awaitable<IBV_WR_RDMA_WRITE_WITH_IMM>;
+template class qp::send_awaitable<IBV_WR_RDMA_READ>;
+template class qp::send_awaitable<IBV_WR_ATOMIC_FETCH_AND_ADD>;
+template class qp::send_awaitable<IBV_WR_ATOMIC_CMP_AND_SWP>;
+
+qp::send_awaitable<IBV_WR_SEND> qp::send(void *buffer, size_t length) {
+  return send_awaitable<IBV_WR_SEND>(this->shared_from_this(), buffer, length,
+                                     {});
 }
 
-qp::send_awaitable qp::write(remote_mr const &remote_mr, void *buffer,
-                             size_t length) {
-  return qp::send_awaitable(this->shared_from_this(), buffer, length,
-                            IBV_WR_RDMA_WRITE, remote_mr);
+qp::send_awaitable<IBV_WR_RDMA_WRITE>
+qp::write(remote_mr const &remote_mr, void *buffer, size_t length) {
+  return send_awaitable<IBV_WR_RDMA_WRITE>(this->shared_from_this(), buffer,
+                                           length, {remote_mr});
 }
 
-qp::send_awaitable qp::write_with_imm(remote_mr const &remote_mr, void *buffer,
-                                      size_t length, uint32_t imm) {
-  return qp::send_awaitable(this->shared_from_this(), buffer, length,
-                            IBV_WR_RDMA_WRITE_WITH_IMM, remote_mr, imm);
+qp::send_awaitable<IBV_WR_RDMA_WRITE_WITH_IMM>
+qp::write_with_imm(remote_mr const &remote_mr, void *buffer, size_t length,
+                   uint32_t imm) {
+  return send_awaitable<IBV_WR_RDMA_WRITE_WITH_IMM>(
+      this->shared_from_this(), buffer, length, {remote_mr, imm});
 }
 
-qp::send_awaitable qp::read(remote_mr const &remote_mr, void *buffer,
-                            size_t length) {
-  return qp::send_awaitable(this->shared_from_this(), buffer, length,
-                            IBV_WR_RDMA_READ, remote_mr);
+qp::send_awaitable<IBV_WR_RDMA_READ>
+qp::read(remote_mr const &remote_mr, void *buffer, size_t length) {
+  return send_awaitable<IBV_WR_RDMA_READ>(this->shared_from_this(), buffer,
+                                          length, {remote_mr});
 }
 
-qp::send_awaitable qp::fetch_and_add(remote_mr const &remote_mr, void *buffer,
-                                     size_t length, uint64_t add) {
+qp::send_awaitable<IBV_WR_ATOMIC_FETCH_AND_ADD>
+qp::fetch_and_add(remote_mr const &remote_mr, void *buffer, size_t length,
+                  uint64_t add) {
   assert(pd_->device_ptr()->is_fetch_and_add_supported());
-  return qp::send_awaitable(this->shared_from_this(), buffer, length,
-                            IBV_WR_ATOMIC_FETCH_AND_ADD, remote_mr, add);
+  return send_awaitable<IBV_WR_ATOMIC_FETCH_AND_ADD>(
+      this->shared_from_this(), buffer, length, {remote_mr, add});
 }
 
-qp::send_awaitable qp::compare_and_swap(remote_mr const &remote_mr,
-                                        void *buffer, size_t length,
-                                        uint64_t compare, uint64_t swap) {
+qp::send_awaitable<IBV_WR_ATOMIC_CMP_AND_SWP>
+qp::compare_and_swap(remote_mr const &remote_mr, void *buffer, size_t length,
+                     uint64_t compare, uint64_t swap) {
   assert(pd_->device_ptr()->is_compare_and_swap_supported());
-  return qp::send_awaitable(this->shared_from_this(), buffer, length,
-                            IBV_WR_ATOMIC_CMP_AND_SWP, remote_mr, compare,
-                            swap);
+  return send_awaitable<IBV_WR_ATOMIC_CMP_AND_SWP>(
+      this->shared_from_this(), buffer, length, {remote_mr, compare, swap});
 }
 
-qp::send_awaitable qp::send(std::shared_ptr<local_mr> local_mr) {
-  return qp::send_awaitable(this->shared_from_this(), local_mr, IBV_WR_SEND);
+qp::send_awaitable<IBV_WR_SEND> qp::send(std::shared_ptr<local_mr> local_mr) {
+  return send_awaitable<IBV_WR_SEND>(this->shared_from_this(), local_mr, {});
 }
 
-qp::send_awaitable qp::write(remote_mr const &remote_mr,
-                             std::shared_ptr<local_mr> local_mr) {
-  return qp::send_awaitable(this->shared_from_this(), local_mr,
-                            IBV_WR_RDMA_WRITE, remote_mr);
+qp::send_awaitable<IBV_WR_RDMA_WRITE>
+qp::write(remote_mr const &remote_mr, std::shared_ptr<local_mr> local_mr) {
+  return send_awaitable<IBV_WR_RDMA_WRITE>(this->shared_from_this(), local_mr,
+                                           {remote_mr});
 }
 
-qp::send_awaitable qp::write_with_imm(remote_mr const &remote_mr,
-                                      std::shared_ptr<local_mr> local_mr,
-                                      uint32_t imm) {
-  return qp::send_awaitable(this->shared_from_this(), local_mr,
-                            IBV_WR_RDMA_WRITE_WITH_IMM, remote_mr, imm);
+qp::send_awaitable<IBV_WR_RDMA_WRITE_WITH_IMM>
+qp::write_with_imm(remote_mr const &remote_mr,
+                   std::shared_ptr<local_mr> local_mr, uint32_t imm) {
+  return send_awaitable<IBV_WR_RDMA_WRITE_WITH_IMM>(
+      this->shared_from_this(), local_mr, {remote_mr, imm});
 }
 
-qp::send_awaitable qp::read(remote_mr const &remote_mr,
-                            std::shared_ptr<local_mr> local_mr) {
-  return qp::send_awaitable(this->shared_from_this(), local_mr,
-                            IBV_WR_RDMA_READ, remote_mr);
+qp::send_awaitable<IBV_WR_RDMA_READ>
+qp::read(remote_mr const &remote_mr, std::shared_ptr<local_mr> local_mr) {
+  return send_awaitable<IBV_WR_RDMA_READ>(this->shared_from_this(), local_mr,
+                                          {remote_mr});
 }
 
-qp::send_awaitable qp::fetch_and_add(remote_mr const &remote_mr,
-                                     std::shared_ptr<local_mr> local_mr,
-                                     uint64_t add) {
+qp::send_awaitable<IBV_WR_ATOMIC_FETCH_AND_ADD>
+qp::fetch_and_add(remote_mr const &remote_mr,
+                  std::shared_ptr<local_mr> local_mr, uint64_t add) {
   assert(pd_->device_ptr()->is_fetch_and_add_supported());
-  return qp::send_awaitable(this->shared_from_this(), local_mr,
-                            IBV_WR_ATOMIC_FETCH_AND_ADD, remote_mr, add);
+  return send_awaitable<IBV_WR_ATOMIC_FETCH_AND_ADD>(
+      this->shared_from_this(), local_mr, {remote_mr, add});
 }
 
-qp::send_awaitable qp::compare_and_swap(remote_mr const &remote_mr,
-                                        std::shared_ptr<local_mr> local_mr,
-                                        uint64_t compare, uint64_t swap) {
+qp::send_awaitable<IBV_WR_ATOMIC_CMP_AND_SWP>
+qp::compare_and_swap(remote_mr const &remote_mr,
+                     std::shared_ptr<local_mr> local_mr, uint64_t compare,
+                     uint64_t swap) {
   assert(pd_->device_ptr()->is_compare_and_swap_supported());
-  return qp::send_awaitable(this->shared_from_this(), local_mr,
-                            IBV_WR_ATOMIC_CMP_AND_SWP, remote_mr, compare,
-                            swap);
+  return send_awaitable<IBV_WR_ATOMIC_CMP_AND_SWP>(
+      this->shared_from_this(), local_mr, {remote_mr, compare, swap});
+}
+
+void qp::check_send_segments(std::span<local_mr_segment const> segments) const {
+  if (segments.empty() || segments.size() > config_.max_send_sge) [[unlikely]] {
+    throw_with("expected 1 to %u send segments, got %lu", config_.max_send_sge,
+               segments.size());
+  }
+}
+
+qp::send_awaitable<IBV_WR_SEND>
+qp::send(std::span<local_mr_segment const> segments) {
+  check_send_segments(segments);
+  return send_awaitable<IBV_WR_SEND>(this->shared_from_this(), segments, {});
+}
+
+qp::send_awaitable<IBV_WR_RDMA_WRITE>
+qp::write(remote_mr const &remote_mr,
+          std::span<local_mr_segment const> segments) {
+  check_send_segments(segments);
+  return send_awaitable<IBV_WR_RDMA_WRITE>(this->shared_from_this(), segments,
+                                           {remote_mr});
+}
+
+qp::send_awaitable<IBV_WR_RDMA_WRITE_WITH_IMM>
+qp::write_with_imm(remote_mr const &remote_mr,
+                   std::span<local_mr_segment const> segments, uint32_t imm) {
+  check_send_segments(segments);
+  return send_awaitable<IBV_WR_RDMA_WRITE_WITH_IMM>(
+      this->shared_from_this(), segments, {remote_mr, imm});
 }
 
 qp::recv_awaitable::recv_awaitable(std::shared_ptr<qp> qp, void *buffer,
                                    size_t length)
-    : qp_(qp),
-      local_mr_(std::make_shared<local_mr>(qp_->pd_->reg_mr(buffer, length))),
-      wc_() {}
+    : qp_(qp), local_mr_(qp_->pd_->reg_mr_cached(buffer, length)),
+      buffer_(buffer), length_(length) {}
 qp::recv_awaitable::recv_awaitable(std::shared_ptr<qp> qp,
                                    std::shared_ptr<local_mr> local_mr)
-    : qp_(qp), local_mr_(local_mr), wc_() {}
+    : qp_(qp), local_mr_(local_mr) {}
+qp::recv_awaitable::recv_awaitable(std::shared_ptr<qp> qp,
+                                   std::span<local_mr_segment const> segments)
+    : qp_(qp), segments_(segments) {}
 
 bool qp::recv_awaitable::await_ready() const noexcept { return false; }
 bool qp::recv_awaitable::await_suspend(std::coroutine_handle<> h) noexcept {
-  coroutine_addr_ = h.address();
-  auto recv_sge = fill_local_sge(*local_mr_);
+  struct ibv_sge recv_sges[qp_config::kMaxSge];
+  int num_sge = 1;
+  if (!segments_.empty()) {
+    num_sge = fill_segment_sges(segments_, recv_sges);
+  } else if (buffer_ != nullptr) {
+    recv_sges[0] = fill_local_sge(*local_mr_, length_);
+    recv_sges[0].addr = reinterpret_cast<uint64_t>(buffer_);
+  } else {
+    recv_sges[0] = fill_local_sge(*local_mr_);
+  }
 
   struct ibv_recv_wr recv_wr = {};
   struct ibv_recv_wr *bad_recv_wr = nullptr;
   recv_wr.next = nullptr;
-  recv_wr.num_sge = 1;
-  recv_wr.wr_id = reinterpret_cast<uint64_t>(this);
-  recv_wr.sg_list = &recv_sge;
+  recv_wr.num_sge = num_sge;
+  recv_wr.sg_list = recv_sges;
 
-  qp_->post_recv(recv_wr, bad_recv_wr);
+  try {
+    slot_ = qp_->completions_.acquire(h.address());
+    recv_wr.wr_id = qp_->completions_.wr_id(slot_);
+    qp_->post_recv(recv_wr, bad_recv_wr);
+  } catch (...) {
+    if (slot_ != nullptr) {
+      qp_->completions_.release(slot_);
+    }
+    exception_ = std::current_exception();
+    return false;
+  }
   return true;
 }
 
@@ -459,11 +1103,12 @@ qp::recv_awaitable::await_resume() const {
   if (exception_) [[unlikely]] {
     std::rethrow_exception(exception_);
   }
-  check_wc_status(wc_.status, "failed to recv");
-  if (wc_.wc_flags & IBV_WC_WITH_IMM) {
-    return std::make_pair(wc_.byte_len, wc_.imm_data);
+  auto const result = qp_->completions_.take(slot_, IBV_WC_RECV);
+  check_wc_status(result.status, "failed to recv");
+  if (result.wc_flags & IBV_WC_WITH_IMM) {
+    return std::make_pair(result.byte_len, result.imm_data);
   }
-  return std::make_pair(wc_.byte_len, std::nullopt);
+  return std::make_pair(result.byte_len, std::nullopt);
 }
 
 qp::recv_awaitable qp::recv(void *buffer, size_t length) {
@@ -474,17 +1119,83 @@ qp::recv_awaitable qp::recv(std::shared_ptr<local_mr> local_mr) {
   return qp::recv_awaitable(this->shared_from_this(), local_mr);
 }
 
+qp::recv_awaitable qp::recv(std::span<local_mr_segment const> segments) {
+  auto const max_recv_sge =
+      srq_ != nullptr ? srq_->max_sge() : config_.max_recv_sge;
+  if (segments.empty() || segments.size() > max_recv_sge) [[unlikely]] {
+    throw_with("expected 1 to %lu recv segments, got %lu", max_recv_sge,
+               segments.size());
+  }
+  return qp::recv_awaitable(this->shared_from_this(), segments);
+}
+
+void qp::reserve_cqes() {
+  send_cq_->reserve(config_.max_send_wr);
+  try {
+    if (srq_ != nullptr) {
+      recv_cq_->reserve(srq_->max_wr(), srq_.get());
+    } else {
+      recv_cq_->reserve(config_.max_recv_wr);
+    }
+  } catch (...) {
+    send_cq_->unreserve(config_.max_send_wr);
+    throw;
+  }
+  cqes_reserved_ = true;
+}
+
+void qp::release_cqes() {
+  if (!cqes_reserved_) {
+    return;
+  }
+  send_cq_->unreserve(config_.max_send_wr);
+  if (srq_ != nullptr) {
+    recv_cq_->unreserve(srq_->max_wr(), srq_.get());
+  } else {
+    recv_cq_->unreserve(config_.max_recv_wr);
+  }
+  cqes_reserved_ = false;
+}
+
 void qp::destroy() {
   if (qp_ == nullptr) [[unlikely]] {
     return;
   }
 
+  send_cq_->cancel_flush(this);
+  send_cq_->detach(qp_->qp_num);
+  release_cqes();
+  // No completion comes for the sends still pending once the Queue Pair is
+  // gone: they fail, and are resumed after it is destroyed, when the NIC no
+  // longer touches their buffers.
+  std::vector<void *> handles;
+  std::vector<std::pair<uint64_t, enum ibv_wc_status>> failed;
+  decltype(direct_sent_handler_) handler;
+  {
+    std::lock_guard lock(send_lock_);
+    abort_sends_locked();
+    fail_sends_locked(retired_send_seq_, IBV_WC_WR_FLUSH_ERR);
+    retired_send_seq_ = next_send_seq_;
+    send_batch_len_ = 0;
+    take_failed_sends_locked(handles, failed);
+    handler = direct_sent_handler_;
+  }
   if (auto rc = ::ibv_destroy_qp(qp_); rc != 0) [[unlikely]] {
     RDMAPP_LOG_ERROR("failed to destroy qp %p: %s",
                      reinterpret_cast<void *>(qp_), strerror(errno));
   } else {
     RDMAPP_LOG_TRACE("destroyed qp %p", reinterpret_cast<void *>(qp_));
   }
+  qp_ = nullptr;
+  qpx_ = nullptr;
+  if (handler) {
+    for (auto [cookie, status] : failed) {
+      handler(cookie, status);
+    }
+  }
+  for (auto h_ptr : handles) {
+    std::coroutine_handle<>::from_address(h_ptr).resume();
+  }
 }
 
 qp::~qp() { destroy(); }
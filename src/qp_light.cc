@@ -1,91 +1,162 @@
 #include <cassert>
+#include <exception>
+
+#include "rdmapp/error.h"
 #include "rdmapp/qp.h"
 
+#include "rdmapp/detail/completion.h"
+
 namespace rdmapp {
 
-qp::light_send_awaitable::light_send_awaitable(qp* qp,
-                                  size_t length,
-                                  local_mr* local_mr,
-                                  remote_mr* remote_mr, uint32_t imm)
-    : qp_(qp), length_(length), local_mr_(local_mr), remote_mr_(remote_mr), imm_(imm) {}
+qp::light_send_awaitable::light_send_awaitable(
+    qp *qp, local_mr *local_mr, size_t length, enum ibv_wr_opcode opcode,
+    remote_mr *remote_mr, uint32_t imm, uint64_t compare_add, uint64_t swap)
+    : qp_(qp), local_mr_(local_mr), remote_mr_(remote_mr),
+      compare_add_(compare_add), swap_(swap), length_(length), imm_(imm),
+      opcode_(opcode) {}
+
+qp::light_send_awaitable qp::write_with_imm(remote_mr *remote_mr,
+                                            local_mr *local_mr, size_t length,
+                                            uint32_t imm) {
+  return qp::light_send_awaitable(this, local_mr, length,
+                                  IBV_WR_RDMA_WRITE_WITH_IMM, remote_mr, imm);
+}
+
+qp::light_send_awaitable qp::send(local_mr *local_mr, size_t length) {
+  return qp::light_send_awaitable(this, local_mr, length, IBV_WR_SEND);
+}
+
+qp::light_send_awaitable qp::write(remote_mr *remote_mr, local_mr *local_mr,
+                                   size_t length) {
+  return qp::light_send_awaitable(this, local_mr, length, IBV_WR_RDMA_WRITE,
+                                  remote_mr);
+}
 
-qp::light_send_awaitable qp::write_with_imm(remote_mr* remote_mr,
-	local_mr* local_mr, size_t length, uint32_t imm) {
-	return qp::light_send_awaitable(this, length, local_mr, remote_mr, imm);
+qp::light_send_awaitable qp::read(remote_mr *remote_mr, local_mr *local_mr,
+                                  size_t length) {
+  return qp::light_send_awaitable(this, local_mr, length, IBV_WR_RDMA_READ,
+                                  remote_mr);
 }
 
+qp::light_send_awaitable qp::fetch_and_add(remote_mr *remote_mr,
+                                           local_mr *local_mr, uint64_t add) {
+  return qp::light_send_awaitable(this, local_mr, sizeof(uint64_t),
+                                  IBV_WR_ATOMIC_FETCH_AND_ADD, remote_mr, 0,
+                                  add);
+}
+
+qp::light_send_awaitable qp::compare_and_swap(remote_mr *remote_mr,
+                                              local_mr *local_mr,
+                                              uint64_t compare,
+                                              uint64_t swap) {
+  return qp::light_send_awaitable(this, local_mr, sizeof(uint64_t),
+                                  IBV_WR_ATOMIC_CMP_AND_SWP, remote_mr, 0,
+                                  compare, swap);
+}
 
 bool qp::light_send_awaitable::await_ready() const noexcept { return false; }
-bool qp::light_send_awaitable::await_suspend(std::coroutine_handle<> h) noexcept {
-	coroutine_addr_ = h.address();
 
-	if (length_ == -1) {
-		length_ = local_mr_->length();
-	}
-	// fill_local_sge
+bool qp::light_send_awaitable::await_suspend(
+    std::coroutine_handle<> h) noexcept {
+  if (length_ == static_cast<size_t>(-1)) {
+    length_ = local_mr_->length();
+  }
   struct ibv_sge send_sge = {};
   send_sge.addr = reinterpret_cast<uint64_t>(local_mr_->addr());
   send_sge.length = length_;
   send_sge.lkey = local_mr_->lkey();
 
-	struct ibv_send_wr send_wr = {};
-	struct ibv_send_wr *bad_send_wr = nullptr;
-	send_wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
-	send_wr.next = nullptr;
-	send_wr.num_sge = 1;
-	send_wr.wr_id = reinterpret_cast<uint64_t>(this);
-	send_wr.send_flags = IBV_SEND_SIGNALED;
-	send_wr.sg_list = &send_sge;
-	assert(remote_mr_->addr() != nullptr);
-	send_wr.wr.rdma.remote_addr = reinterpret_cast<uint64_t>(remote_mr_->addr());
-	send_wr.wr.rdma.rkey = remote_mr_->rkey();
-	send_wr.imm_data = imm_;
-
-	qp_->post_send(send_wr, bad_send_wr);
-	return true;
+  struct ibv_send_wr send_wr = {};
+  send_wr.opcode = opcode_;
+  send_wr.next = nullptr;
+  send_wr.num_sge = 1;
+  send_wr.send_flags = IBV_SEND_SIGNALED;
+  send_wr.sg_list = &send_sge;
+  switch (opcode_) {
+  case IBV_WR_RDMA_WRITE_WITH_IMM:
+    send_wr.imm_data = imm_;
+    [[fallthrough]];
+  case IBV_WR_RDMA_WRITE:
+  case IBV_WR_RDMA_READ:
+    assert(remote_mr_->addr() != nullptr);
+    send_wr.wr.rdma.remote_addr =
+        reinterpret_cast<uint64_t>(remote_mr_->addr());
+    send_wr.wr.rdma.rkey = remote_mr_->rkey();
+    break;
+  case IBV_WR_ATOMIC_CMP_AND_SWP:
+    send_wr.wr.atomic.swap = swap_;
+    [[fallthrough]];
+  case IBV_WR_ATOMIC_FETCH_AND_ADD:
+    assert(remote_mr_->addr() != nullptr);
+    send_wr.wr.atomic.remote_addr =
+        reinterpret_cast<uint64_t>(remote_mr_->addr());
+    send_wr.wr.atomic.rkey = remote_mr_->rkey();
+    send_wr.wr.atomic.compare_add = compare_add_;
+    break;
+  default:
+    break;
+  }
+
+  try {
+    slot_ = qp_->completions_.acquire(h.address());
+    send_wr.wr_id = reinterpret_cast<uint64_t>(slot_);
+    qp_->submit_send(send_wr);
+  } catch (...) {
+    if (slot_ != nullptr) {
+      qp_->abandon_send(slot_);
+    }
+    exception_ = std::current_exception();
+    return false;
+  }
+  return true;
 }
 
 uint32_t qp::light_send_awaitable::await_resume() const {
-	return wc_.byte_len;
+  if (exception_) [[unlikely]] {
+    std::rethrow_exception(exception_);
+  }
+  auto const result =
+      qp_->completions_.take(slot_, detail::wc_opcode_of(opcode_));
+  check_wc_status(result.status, "failed to send");
+  return result.byte_len;
 }
 
-void qp::write_with_imm_direct(remote_mr* remote_mr, local_mr* local_mr, size_t length, uint32_t imm) {
-	if (length == -1) {
-		length = local_mr->length();
-	}
-	// fill_local_sge
+void qp::write_with_imm_direct(remote_mr *remote_mr, local_mr *local_mr,
+                               size_t length, uint32_t imm, uint64_t cookie) {
+  if (length == static_cast<size_t>(-1)) {
+    length = local_mr->length();
+  }
   struct ibv_sge send_sge = {};
   send_sge.addr = reinterpret_cast<uint64_t>(local_mr->addr());
   send_sge.length = length;
   send_sge.lkey = local_mr->lkey();
 
-	struct ibv_send_wr send_wr = {};
-	struct ibv_send_wr *bad_send_wr = nullptr;
-	send_wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
-	send_wr.next = nullptr;
-	send_wr.num_sge = 1;
-	send_wr.send_flags = IBV_SEND_SIGNALED;
-	send_wr.sg_list = &send_sge;
-	assert(remote_mr->addr() != nullptr);
-	send_wr.wr.rdma.remote_addr = reinterpret_cast<uint64_t>(remote_mr->addr());
-	send_wr.wr.rdma.rkey = remote_mr->rkey();
-	send_wr.imm_data = imm;
-
-	this->post_send(send_wr, bad_send_wr);
+  struct ibv_send_wr send_wr = {};
+  send_wr.wr_id = detail::make_direct_wr_id(cookie);
+  send_wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+  send_wr.next = nullptr;
+  send_wr.num_sge = 1;
+  send_wr.sg_list = &send_sge;
+  assert(remote_mr->addr() != nullptr);
+  send_wr.wr.rdma.remote_addr = reinterpret_cast<uint64_t>(remote_mr->addr());
+  send_wr.wr.rdma.rkey = remote_mr->rkey();
+  send_wr.imm_data = imm;
+
+  this->submit_send(send_wr);
 }
 
-qp::light_recv_awaitable qp::recv(local_mr* local_mr) {
+qp::light_recv_awaitable qp::recv(local_mr *local_mr) {
   return qp::light_recv_awaitable(this, local_mr);
 }
 
-qp::light_recv_awaitable::light_recv_awaitable(qp* qp, local_mr* local_mr)
-                          : qp_(qp), local_mr_(local_mr), wc_() {}
+qp::light_recv_awaitable::light_recv_awaitable(qp *qp, local_mr *local_mr)
+    : qp_(qp), local_mr_(local_mr) {}
 
 bool qp::light_recv_awaitable::await_ready() const noexcept { return false; }
-bool qp::light_recv_awaitable::await_suspend(std::coroutine_handle<> h) noexcept {
-  coroutine_addr_ = h.address();
-	// fill_local_sge
-	struct ibv_sge recv_sge = {};
+
+bool qp::light_recv_awaitable::await_suspend(
+    std::coroutine_handle<> h) noexcept {
+  struct ibv_sge recv_sge = {};
   recv_sge.addr = reinterpret_cast<uint64_t>(local_mr_->addr());
   recv_sge.length = local_mr_->length();
   recv_sge.lkey = local_mr_->lkey();
@@ -94,19 +165,33 @@ bool qp::light_recv_awaitable::await_suspend(std::coroutine_handle<> h) noexcept
   struct ibv_recv_wr *bad_recv_wr = nullptr;
   recv_wr.next = nullptr;
   recv_wr.num_sge = 1;
-  recv_wr.wr_id = reinterpret_cast<uint64_t>(this);
   recv_wr.sg_list = &recv_sge;
 
-  qp_->post_recv(recv_wr, bad_recv_wr);
+  try {
+    slot_ = qp_->completions_.acquire(h.address());
+    recv_wr.wr_id = qp_->completions_.wr_id(slot_);
+    qp_->post_recv(recv_wr, bad_recv_wr);
+  } catch (...) {
+    if (slot_ != nullptr) {
+      qp_->completions_.release(slot_);
+    }
+    exception_ = std::current_exception();
+    return false;
+  }
   return true;
 }
 
 std::pair<uint32_t, std::optional<uint32_t>>
 qp::light_recv_awaitable::await_resume() const {
-  if (wc_.wc_flags & IBV_WC_WITH_IMM) {
-    return std::make_pair(wc_.byte_len, wc_.imm_data);
+  if (exception_) [[unlikely]] {
+    std::rethrow_exception(exception_);
+  }
+  auto const result = qp_->completions_.take(slot_, IBV_WC_RECV);
+  check_wc_status(result.status, "failed to recv");
+  if (result.wc_flags & IBV_WC_WITH_IMM) {
+    return std::make_pair(result.byte_len, result.imm_data);
   }
-  return std::make_pair(wc_.byte_len, std::nullopt);
+  return std::make_pair(result.byte_len, std::nullopt);
 }
 
-}
\ No newline at end of file
+} // namespace rdmapp
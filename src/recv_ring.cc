@@ -0,0 +1,345 @@
+#include "rdmapp/recv_ring.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <exception>
+#include <mutex>
+#include <utility>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/error.h"
+
+#include "rdmapp/detail/debug.h"
+
+namespace rdmapp {
+
+recv_ring::view::view() : ring_(nullptr), index_(0) {}
+
+recv_ring::view::view(recv_ring *ring, uint32_t index)
+    : ring_(ring), index_(index) {}
+
+recv_ring::view::view(view &&other)
+    : ring_(std::exchange(other.ring_, nullptr)), index_(other.index_) {}
+
+recv_ring::view &recv_ring::view::operator=(view &&other) {
+  if (this != &other) {
+    release();
+    ring_ = std::exchange(other.ring_, nullptr);
+    index_ = other.index_;
+  }
+  return *this;
+}
+
+void *recv_ring::view::data() const {
+  return ring_->region_ + index_ * ring_->buffer_size_;
+}
+
+uint32_t recv_ring::view::size() const {
+  return ring_->slots_[index_]->result.byte_len;
+}
+
+std::optional<uint32_t> recv_ring::view::imm() const {
+  auto const &result = ring_->slots_[index_]->result;
+  if (result.wc_flags & IBV_WC_WITH_IMM) {
+    return result.imm_data;
+  }
+  return std::nullopt;
+}
+
+void recv_ring::view::release() {
+  if (ring_ != nullptr) {
+    std::exchange(ring_, nullptr)->release(index_);
+  }
+}
+
+recv_ring::view::~view() { release(); }
+
+recv_ring::recv_awaitable::recv_awaitable(recv_ring *ring)
+    : ring_(ring), coroutine_addr_(nullptr), index_(0) {}
+
+bool recv_ring::recv_awaitable::await_ready() noexcept {
+  std::lock_guard lock(ring_->lock_);
+  if (ring_->ready_.empty()) {
+    return false;
+  }
+  index_ = ring_->ready_.front();
+  ring_->ready_.pop_front();
+  return true;
+}
+
+bool recv_ring::recv_awaitable::await_suspend(
+    std::coroutine_handle<> h) noexcept {
+  std::lock_guard lock(ring_->lock_);
+  // A buffer may have completed since await_ready.
+  if (!ring_->ready_.empty()) {
+    index_ = ring_->ready_.front();
+    ring_->ready_.pop_front();
+    return false;
+  }
+  coroutine_addr_ = h.address();
+  ring_->waiters_.push_back(this);
+  return true;
+}
+
+recv_ring::view recv_ring::recv_awaitable::await_resume() {
+  // A failed buffer is not reposted: the Queue Pair is in the error state and
+  // would flush it right away.
+  check_wc_status(ring_->slots_[index_]->result.status, "failed to recv");
+  return view(ring_, index_);
+}
+
+recv_ring::recv_ring(std::shared_ptr<qp> qp, std::shared_ptr<srq> srq,
+                     std::shared_ptr<pd> pd, size_t nr_buffers,
+                     size_t buffer_size, size_t repost_batch)
+    : qp_(qp), srq_(srq), pd_(pd), buffer_size_(buffer_size),
+      repost_batch_(std::max<size_t>(repost_batch, 1)), region_(nullptr),
+      mr_(nullptr), completions_(nr_buffers), stats_(), min_depth_(nr_buffers),
+      adapt_period_(0), last_adapt_(), completions_at_adapt_(0),
+      arrival_rate_(0), limit_armed_(false) {
+  if (nr_buffers == 0 || buffer_size == 0) [[unlikely]] {
+    throw_with("recv ring needs at least one buffer of at least one byte");
+  }
+  auto const region_size =
+      (nr_buffers * buffer_size + 4095) & ~static_cast<size_t>(4095);
+  region_ = static_cast<uint8_t *>(std::aligned_alloc(4096, region_size));
+  check_ptr(region_, "failed to allocate recv ring");
+  mr_ = ::ibv_reg_mr(pd_->pd_, region_, region_size, IBV_ACCESS_LOCAL_WRITE);
+  if (mr_ == nullptr) [[unlikely]] {
+    std::free(region_);
+    check_ptr(mr_, "failed to reg recv ring");
+  }
+
+  slots_.reserve(nr_buffers);
+  released_.reserve(nr_buffers);
+  repost_wr_.resize(nr_buffers);
+  repost_sge_.resize(nr_buffers);
+  for (uint32_t i = 0; i < nr_buffers; ++i) {
+    // A fresh slab hands out its slots in order, so the slot index doubles
+    // as the buffer index.
+    auto slot = completions_.acquire(this, &recv_ring::on_complete);
+    assert(slot->index == i);
+    slots_.push_back(slot);
+    released_.push_back(i);
+  }
+
+  {
+    std::lock_guard lock(lock_);
+    stats_.depth = nr_buffers;
+    // Buffers that fail to post here stay released and are retried by the
+    // next repost.
+    repost_locked();
+    // The initial post is not a repost.
+    stats_.reposts = 0;
+    stats_.repost_batches = 0;
+  }
+  if (srq_ != nullptr) {
+    srq_->on_limit_reached([this]() { handle_limit_reached(); });
+    arm_limit();
+  }
+  RDMAPP_LOG_DEBUG("created recv ring of %lu buffers of %lu bytes", nr_buffers,
+                   buffer_size);
+}
+
+recv_ring::recv_ring(std::shared_ptr<qp> qp, size_t nr_buffers,
+                     size_t buffer_size, size_t repost_batch)
+    : recv_ring(qp, nullptr, qp->pd_ptr(), nr_buffers, buffer_size,
+                repost_batch) {}
+
+recv_ring::recv_ring(std::shared_ptr<srq> srq, size_t nr_buffers,
+                     size_t buffer_size, size_t repost_batch)
+    : recv_ring(nullptr, srq, srq->pd_, nr_buffers, buffer_size,
+                repost_batch) {}
+
+void *recv_ring::on_complete(detail::completion_slot &slot) {
+  auto ring = static_cast<recv_ring *>(slot.coroutine_addr);
+  std::lock_guard lock(ring->lock_);
+  ++ring->stats_.completions;
+  if (--ring->stats_.posted == 0) [[unlikely]] {
+    ++ring->stats_.starvations;
+    ring->stats_.depth = std::min(ring->slots_.size(), ring->stats_.depth * 2);
+  }
+  if (ring->waiters_.empty()) {
+    ring->ready_.push_back(slot.index);
+    return nullptr;
+  }
+  auto waiter = ring->waiters_.front();
+  ring->waiters_.pop_front();
+  waiter->index_ = slot.index;
+  return waiter->coroutine_addr_;
+}
+
+void recv_ring::repost_locked() {
+  adapt_locked();
+  if (stats_.posted >= stats_.depth) {
+    return;
+  }
+  auto const nr = std::min(released_.size(), stats_.depth - stats_.posted);
+  if (nr == 0) {
+    return;
+  }
+  // The most recently released buffers go first, they are likely still in
+  // cache.
+  auto const first = released_.size() - nr;
+  for (size_t i = 0; i < nr; ++i) {
+    auto const index = released_[first + i];
+    auto slot = slots_[index];
+    completions_.rearm(slot);
+    auto &sge = repost_sge_[i];
+    sge.addr = reinterpret_cast<uint64_t>(region_ + index * buffer_size_);
+    sge.length = buffer_size_;
+    sge.lkey = mr_->lkey;
+    auto &recv_wr = repost_wr_[i];
+    recv_wr.wr_id = completions_.wr_id(slot);
+    recv_wr.sg_list = &sge;
+    recv_wr.num_sge = 1;
+    recv_wr.next = i + 1 < nr ? &repost_wr_[i + 1] : nullptr;
+  }
+  struct ibv_recv_wr *bad_recv_wr = nullptr;
+  auto posted = nr;
+  try {
+    if (qp_ != nullptr) {
+      qp_->post_recv(repost_wr_[0], bad_recv_wr);
+    } else {
+      check_rc(::ibv_post_srq_recv(srq_->srq_, repost_wr_.data(),
+                                   &bad_recv_wr),
+               "failed to post srq recv");
+    }
+  } catch (std::exception const &e) {
+    // Buffers from the failed one on stay released for the next attempt.
+    posted = bad_recv_wr == nullptr
+                 ? 0
+                 : static_cast<size_t>(bad_recv_wr - repost_wr_.data());
+    RDMAPP_LOG_ERROR("recv ring reposted %lu of %lu buffers: %s", posted, nr,
+                     e.what());
+  }
+  released_.erase(released_.begin() + first,
+                  released_.begin() + first + posted);
+  stats_.posted += posted;
+  stats_.reposts += posted;
+  ++stats_.repost_batches;
+}
+
+void recv_ring::adapt_locked() {
+  if (adapt_period_ == std::chrono::steady_clock::duration::zero()) {
+    return;
+  }
+  auto const now = std::chrono::steady_clock::now();
+  if (now - last_adapt_ < adapt_period_) {
+    return;
+  }
+  auto const periods = static_cast<double>((now - last_adapt_).count()) /
+                       adapt_period_.count();
+  auto const sample = (stats_.completions - completions_at_adapt_) / periods;
+  arrival_rate_ = 0.75 * arrival_rate_ + 0.25 * sample;
+  last_adapt_ = now;
+  completions_at_adapt_ = stats_.completions;
+  // Cover two periods of arrivals plus a batch held back for reposting.
+  // Shrink by at most a quarter at a time, so that a lull does not undo the
+  // growth a burst just caused.
+  auto target = static_cast<size_t>(2 * arrival_rate_) + repost_batch_;
+  target = std::max(target, stats_.depth - stats_.depth / 4);
+  stats_.depth = std::clamp(target, min_depth_, slots_.size());
+}
+
+void recv_ring::arm_limit() {
+  uint32_t limit = 0;
+  {
+    std::lock_guard lock(lock_);
+    if (srq_ == nullptr || limit_armed_) {
+      return;
+    }
+    limit = std::max<size_t>(stats_.depth / 4, 1);
+    // Armed below the posted count only, or it would fire right away.
+    if (stats_.posted <= limit) {
+      return;
+    }
+    limit_armed_ = true;
+  }
+  try {
+    srq_->arm_limit(limit);
+  } catch (std::exception const &e) {
+    RDMAPP_LOG_ERROR("recv ring failed to arm srq limit: %s", e.what());
+    std::lock_guard lock(lock_);
+    limit_armed_ = false;
+  }
+}
+
+void recv_ring::handle_limit_reached() {
+  {
+    std::lock_guard lock(lock_);
+    limit_armed_ = false;
+    ++stats_.limit_events;
+    stats_.depth = std::min(slots_.size(), stats_.depth * 2);
+    repost_locked();
+  }
+  arm_limit();
+}
+
+void recv_ring::release(uint32_t index) {
+  bool rearm_limit = false;
+  {
+    std::lock_guard lock(lock_);
+    released_.push_back(index);
+    // Repost once a batch is missing, or early when the ring runs low, so
+    // that a slow consumer holding a partial batch does not starve the Queue
+    // Pair.
+    auto const deficit =
+        stats_.posted < stats_.depth ? stats_.depth - stats_.posted : 0;
+    if (deficit >= repost_batch_ || stats_.posted <= repost_batch_) {
+      repost_locked();
+    }
+    rearm_limit = srq_ != nullptr && !limit_armed_;
+  }
+  if (rearm_limit) [[unlikely]] {
+    arm_limit();
+  }
+}
+
+recv_ring::recv_awaitable recv_ring::recv() { return recv_awaitable(this); }
+
+void recv_ring::flush() {
+  {
+    std::lock_guard lock(lock_);
+    repost_locked();
+  }
+  arm_limit();
+}
+
+void recv_ring::adapt_depth(size_t min_depth,
+                            std::chrono::microseconds period) {
+  std::lock_guard lock(lock_);
+  min_depth_ = std::clamp<size_t>(min_depth, 1, slots_.size());
+  adapt_period_ = period;
+  last_adapt_ = std::chrono::steady_clock::now();
+  completions_at_adapt_ = stats_.completions;
+}
+
+recv_ring_stats recv_ring::stats() {
+  std::lock_guard lock(lock_);
+  return stats_;
+}
+
+recv_ring::~recv_ring() {
+  if (srq_ != nullptr) {
+    srq_->on_limit_reached(nullptr);
+  }
+  if (!waiters_.empty() || stats_.posted != 0) [[unlikely]] {
+    RDMAPP_LOG_DEBUG("destroying recv ring with %lu waiters and %lu posted "
+                     "buffers",
+                     waiters_.size(), stats_.posted);
+  }
+  for (auto slot : slots_) {
+    completions_.release(slot);
+  }
+  if (mr_ != nullptr) {
+    if (auto rc = ::ibv_dereg_mr(mr_); rc != 0) [[unlikely]] {
+      RDMAPP_LOG_ERROR("failed to dereg recv ring mr %p",
+                       reinterpret_cast<void *>(mr_));
+    }
+  }
+  std::free(region_);
+}
+
+} // namespace rdmapp
@@ -0,0 +1,191 @@
+#include "rdmapp/sharded_runtime.h"
+
+#include <coroutine>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/error.h"
+
+#include "rdmapp/detail/completion.h"
+#include "rdmapp/detail/debug.h"
+#include "rdmapp/detail/numa.h"
+
+namespace rdmapp {
+
+static thread_local sharded_runtime::shard *current_shard = nullptr;
+
+static inline void resume(void *h_ptr) {
+  std::coroutine_handle<>::from_address(h_ptr).resume();
+}
+
+sharded_runtime::shard::shard(std::shared_ptr<device> device, int cpu,
+                              size_t num_cqe, poll_batch batch_size,
+                              std::chrono::nanoseconds spin_budget)
+    : cpu_(cpu), node_(detail::cpu_node(cpu)), batch_(batch_size),
+      spin_budget_(spin_budget), device_(device), frames_(nullptr),
+      wc_(nullptr), has_spawned_(false), stopped_(false) {
+  std::latch ready(1);
+  // The completion queue is sized here but created by the pinned thread, so
+  // that the driver allocates its buffer on the local node.
+  spawned_.push_back([this, num_cqe]() {
+    if (spin_budget_ != detail::cq_waiter::kSpinForever) {
+      channel_ = std::make_shared<comp_channel>(device_);
+    }
+    cq_ = std::make_shared<cq>(device_, num_cqe, channel_);
+  });
+  thread_ = std::jthread(&shard::run, this, std::ref(ready));
+  ready.wait();
+  if (exception_) {
+    thread_.join();
+    detail::free_on_node(wc_, batch_.max() * sizeof(struct ibv_wc));
+    if (frames_ != nullptr) {
+      frames_->release();
+    }
+    std::rethrow_exception(exception_);
+  }
+}
+
+void sharded_runtime::shard::setup() {
+  detail::pin_thread(cpu_);
+  current_shard = this;
+  frames_ = new detail::frame_pool(node_);
+  detail::frame_pool::current() = frames_;
+  wc_ = static_cast<struct ibv_wc *>(
+      detail::alloc_on_node(batch_.max() * sizeof(struct ibv_wc), node_));
+  run_spawned();
+  waiter_ = std::make_unique<detail::cq_waiter>(
+      std::vector<std::shared_ptr<cq>>{cq_}, spin_budget_,
+      [this]() { return has_spawned_.load(std::memory_order_acquire); });
+}
+
+bool sharded_runtime::shard::run_spawned() {
+  std::deque<std::function<void()>> spawned;
+  {
+    std::lock_guard lock(spawn_lock_);
+    spawned.swap(spawned_);
+    has_spawned_.store(false, std::memory_order_relaxed);
+  }
+  for (auto &fn : spawned) {
+    fn();
+  }
+  return !spawned.empty();
+}
+
+void sharded_runtime::shard::run(std::latch &ready) {
+  try {
+    setup();
+  } catch (...) {
+    exception_ = std::current_exception();
+    ready.count_down();
+    return;
+  }
+  ready.count_down();
+  waiter_->bind_thread();
+  RDMAPP_LOG_DEBUG("shard started on cpu %d node %d", cpu_, node_);
+  while (!stopped_.load(std::memory_order_relaxed)) {
+    try {
+      auto nr_wc = cq_->poll(wc_, batch_.size());
+      batch_.update(nr_wc);
+      metrics_.dispatch(*cq_, wc_, nr_wc, resume);
+      bool progress = nr_wc != 0;
+      if (has_spawned_.load(std::memory_order_acquire)) {
+        progress |= run_spawned();
+      }
+      detail::flush_sends(*cq_, resume);
+      waiter_->idle(progress, stopped_);
+    } catch (std::exception const &e) {
+      RDMAPP_LOG_ERROR("shard on cpu %d stopped: %s", cpu_, e.what());
+      stopped_ = true;
+    }
+  }
+}
+
+std::shared_ptr<cq> sharded_runtime::shard::cq_ptr() const { return cq_; }
+
+int sharded_runtime::shard::cpu() const { return cpu_; }
+
+int sharded_runtime::shard::node() const { return node_; }
+
+void sharded_runtime::shard::post(std::function<void()> fn) {
+  {
+    std::lock_guard lock(spawn_lock_);
+    spawned_.push_back(std::move(fn));
+    has_spawned_.store(true, std::memory_order_seq_cst);
+  }
+  waiter_->wake();
+}
+
+void sharded_runtime::shard::spawn(std::function<task<void>()> fn) {
+  post([this, fn = std::move(fn)]() {
+    try {
+      fn().detach();
+    } catch (std::exception const &e) {
+      RDMAPP_LOG_ERROR("failed to spawn on cpu %d: %s", cpu_, e.what());
+    }
+  });
+}
+
+poller_metrics_snapshot sharded_runtime::shard::metrics() const {
+  return metrics_.snapshot();
+}
+
+sharded_runtime::shard::~shard() {
+  stopped_ = true;
+  if (waiter_) {
+    waiter_->wake();
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  detail::free_on_node(wc_, batch_.max() * sizeof(struct ibv_wc));
+  if (frames_ != nullptr) {
+    frames_->release();
+  }
+}
+
+sharded_runtime::sharded_runtime(std::shared_ptr<device> device,
+                                 std::vector<int> cpus, size_t num_cqe,
+                                 poll_batch batch_size,
+                                 std::chrono::nanoseconds spin_budget)
+    : device_(device) {
+  auto const node = device_->numa_node();
+  if (cpus.empty()) {
+    cpus = detail::node_cpus(node);
+    if (cpus.empty()) {
+      cpus = detail::node_cpus(-1);
+    }
+  }
+  if (cpus.empty()) [[unlikely]] {
+    throw_with("no cpu to run shards on");
+  }
+  for (auto cpu : cpus) {
+    if (node >= 0 && detail::cpu_node(cpu) != node) {
+      RDMAPP_LOG_INFO("shard on cpu %d is remote from the device on node %d",
+                      cpu, node);
+    }
+    shards_.push_back(std::make_unique<shard>(device_, cpu, num_cqe,
+                                              batch_size, spin_budget));
+  }
+}
+
+size_t sharded_runtime::size() const { return shards_.size(); }
+
+sharded_runtime::shard &sharded_runtime::operator[](size_t i) {
+  return *shards_[i];
+}
+
+sharded_runtime::shard *sharded_runtime::current() { return current_shard; }
+
+sharded_runtime::~sharded_runtime() {
+  // Shards stop in the reverse order of their creation.
+  while (!shards_.empty()) {
+    shards_.pop_back();
+  }
+}
+
+} // namespace rdmapp
@@ -1,29 +1,71 @@
 #include "rdmapp/srq.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <cstring>
 #include <memory>
+#include <mutex>
+#include <utility>
 
 #include <infiniband/verbs.h>
 
 #include "rdmapp/device.h"
 #include "rdmapp/error.h"
+#include "rdmapp/qp.h"
 
 #include "rdmapp/detail/debug.h"
 
 namespace rdmapp {
 
-srq::srq(std::shared_ptr<pd> pd, size_t max_wr) : srq_(nullptr), pd_(pd) {
+srq::srq(std::shared_ptr<pd> pd, size_t max_wr, size_t max_sge)
+    : srq_(nullptr), pd_(pd), max_wr_(max_wr), max_sge_(max_sge) {
+  // Receives through a Queue Pair copy their segments into an array of
+  // qp_config::kMaxSge entries.
+  uint32_t const device_max_sge = std::min<uint32_t>(
+      qp_config::kMaxSge,
+      static_cast<uint32_t>(pd_->device_ptr()->device_attr().max_srq_sge));
+  if (max_sge == 0 || max_sge > device_max_sge) [[unlikely]] {
+    throw_with("srq sge limit must be within [1, %u]", device_max_sge);
+  }
   struct ibv_srq_init_attr srq_init_attr;
   srq_init_attr.srq_context = this;
-  srq_init_attr.attr.max_sge = 1;
+  srq_init_attr.attr.max_sge = max_sge;
   srq_init_attr.attr.max_wr = max_wr;
-  srq_init_attr.attr.srq_limit = max_wr;
+  // The limit is ignored on creation; it is armed with arm_limit.
+  srq_init_attr.attr.srq_limit = 0;
 
   srq_ = ::ibv_create_srq(pd_->pd_, &srq_init_attr);
   check_ptr(srq_, "failed to create srq");
+  // The device may round the depth up.
+  max_wr_ = srq_init_attr.attr.max_wr;
   RDMAPP_LOG_DEBUG("created srq %p", reinterpret_cast<void *>(srq_));
 }
 
+size_t srq::max_sge() const { return max_sge_; }
+
+size_t srq::max_wr() const { return max_wr_; }
+
+void srq::arm_limit(uint32_t limit) {
+  struct ibv_srq_attr srq_attr = {};
+  srq_attr.srq_limit = limit;
+  check_rc(::ibv_modify_srq(srq_, &srq_attr, IBV_SRQ_LIMIT),
+           "failed to arm srq limit");
+  RDMAPP_LOG_TRACE("armed srq %p limit=%u", reinterpret_cast<void *>(srq_),
+                   limit);
+}
+
+void srq::on_limit_reached(std::function<void()> handler) {
+  std::lock_guard lock(limit_mutex_);
+  limit_handler_ = std::move(handler);
+}
+
+void srq::handle_limit_reached() {
+  std::lock_guard lock(limit_mutex_);
+  if (limit_handler_) {
+    limit_handler_();
+  }
+}
+
 srq::~srq() {
   if (srq_ == nullptr) [[unlikely]] {
     return;
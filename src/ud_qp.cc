@@ -0,0 +1,400 @@
+#include "rdmapp/ud_qp.h"
+
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <strings.h>
+#include <vector>
+
+#include <infiniband/verbs.h>
+
+#include "rdmapp/error.h"
+#include "rdmapp/pd.h"
+
+#include "rdmapp/detail/debug.h"
+#include "rdmapp/detail/serdes.h"
+
+namespace rdmapp {
+
+ud_address::ud_address(uint16_t lid, uint32_t qpn, union ibv_gid const &gid)
+    : lid(lid), qpn(qpn), gid(gid) {}
+
+ud_address::ud_address(deserialized_qp const &remote_qp)
+    : ud_address(remote_qp.header.lid, remote_qp.header.qp_num,
+                 remote_qp.header.gid) {}
+
+bool ud_address::operator==(ud_address const &other) const {
+  return lid == other.lid && qpn == other.qpn &&
+         ::memcmp(gid.raw, other.gid.raw, sizeof(gid.raw)) == 0;
+}
+
+size_t ud_qp::ah_hash::operator()(ud_address const &address) const {
+  auto hash = std::hash<uint64_t>{}(address.gid.global.subnet_prefix);
+  hash ^= std::hash<uint64_t>{}(address.gid.global.interface_id) +
+          0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+  hash ^= std::hash<uint64_t>{}((static_cast<uint64_t>(address.lid) << 32) |
+                                address.qpn) +
+          0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+  return hash;
+}
+
+std::atomic<uint32_t> ud_qp::next_sq_psn = 1;
+
+ud_qp::ud_qp(std::shared_ptr<pd> pd, std::shared_ptr<cq> cq,
+             std::shared_ptr<srq> srq, qp_config const &config, uint32_t qkey)
+    : ud_qp(pd, cq, cq, srq, config, qkey) {}
+
+ud_qp::ud_qp(std::shared_ptr<pd> pd, std::shared_ptr<cq> recv_cq,
+             std::shared_ptr<cq> send_cq, std::shared_ptr<srq> srq,
+             qp_config const &config, uint32_t qkey)
+    : qp_(nullptr), pd_(pd), recv_cq_(recv_cq), send_cq_(send_cq), srq_(srq),
+      config_(config), completions_(config.max_send_wr + config.max_recv_wr),
+      cqes_reserved_(false), qkey_(qkey), sq_psn_(next_sq_psn.fetch_add(1)) {
+  completions_.set_timed(
+      recv_cq_->timestamps() != timestamp_source::none ||
+      send_cq_->timestamps() != timestamp_source::none);
+  create();
+}
+
+void ud_qp::create() {
+  auto const &device_attr = pd_->device_ptr()->device_attr();
+  auto const &port_attr = pd_->device_ptr()->port_attr();
+  uint32_t const max_wr = device_attr.max_qp_wr;
+  if (config_.max_send_wr == 0 || config_.max_send_wr > max_wr ||
+      config_.max_recv_wr == 0 || config_.max_recv_wr > max_wr) [[unlikely]] {
+    throw_with("wr limits must be within [1, %u]", max_wr);
+  }
+  if (config_.path_mtu > port_attr.active_mtu) {
+    config_.path_mtu = port_attr.active_mtu;
+  }
+
+  struct ibv_qp_init_attr qp_init_attr = {};
+  ::bzero(&qp_init_attr, sizeof(qp_init_attr));
+  qp_init_attr.qp_type = IBV_QPT_UD;
+  qp_init_attr.recv_cq = recv_cq_->cq_;
+  qp_init_attr.send_cq = send_cq_->cq_;
+  qp_init_attr.cap.max_recv_sge = 1;
+  qp_init_attr.cap.max_send_sge = 1;
+  qp_init_attr.cap.max_recv_wr = config_.max_recv_wr;
+  qp_init_attr.cap.max_send_wr = config_.max_send_wr;
+  qp_init_attr.cap.max_inline_data = config_.max_inline_data;
+  qp_init_attr.sq_sig_all = 0;
+  qp_init_attr.qp_context = this;
+  if (srq_ != nullptr) {
+    qp_init_attr.srq = srq_->srq_;
+  }
+  qp_ = ::ibv_create_qp(pd_->pd_, &qp_init_attr);
+  check_ptr(qp_, "failed to create ud qp");
+  config_.max_send_wr = qp_init_attr.cap.max_send_wr;
+  config_.max_recv_wr = qp_init_attr.cap.max_recv_wr;
+  config_.max_inline_data = qp_init_attr.cap.max_inline_data;
+
+  try {
+    reserve_cqes();
+    struct ibv_qp_attr qp_attr = {};
+    ::bzero(&qp_attr, sizeof(qp_attr));
+    qp_attr.qp_state = IBV_QPS_INIT;
+    qp_attr.pkey_index = 0;
+    qp_attr.port_num = pd_->device_ptr()->port_num();
+    qp_attr.qkey = qkey_;
+    check_rc(::ibv_modify_qp(qp_, &qp_attr,
+                             IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT |
+                                 IBV_QP_QKEY),
+             "failed to transition ud qp to init state");
+
+    ::bzero(&qp_attr, sizeof(qp_attr));
+    qp_attr.qp_state = IBV_QPS_RTR;
+    check_rc(::ibv_modify_qp(qp_, &qp_attr, IBV_QP_STATE),
+             "failed to transition ud qp to rtr state");
+
+    ::bzero(&qp_attr, sizeof(qp_attr));
+    qp_attr.qp_state = IBV_QPS_RTS;
+    qp_attr.sq_psn = sq_psn_;
+    check_rc(::ibv_modify_qp(qp_, &qp_attr, IBV_QP_STATE | IBV_QP_SQ_PSN),
+             "failed to transition ud qp to rts state");
+  } catch (std::exception const &e) {
+    RDMAPP_LOG_ERROR("%s", e.what());
+    destroy();
+    throw;
+  }
+  RDMAPP_LOG_TRACE("created ud qp %p lid=%u qpn=%u psn=%u",
+                   reinterpret_cast<void *>(qp_), pd_->device_ptr()->lid(),
+                   qp_->qp_num, sq_psn_);
+}
+
+struct ibv_ah *ud_qp::ah(ud_address const &address) {
+  {
+    std::shared_lock lock(ah_mutex_);
+    if (auto it = ah_cache_.find(address); it != ah_cache_.end()) [[likely]] {
+      return it->second;
+    }
+  }
+  std::unique_lock lock(ah_mutex_);
+  if (auto it = ah_cache_.find(address); it != ah_cache_.end()) {
+    return it->second;
+  }
+  struct ibv_ah_attr ah_attr = {};
+  ::bzero(&ah_attr, sizeof(ah_attr));
+  ah_attr.is_global = 1;
+  ah_attr.grh.dgid = address.gid;
+  ah_attr.grh.sgid_index = pd_->device_->gid_index_;
+  ah_attr.grh.hop_limit = 16;
+  ah_attr.dlid = address.lid;
+  ah_attr.sl = 0;
+  ah_attr.src_path_bits = 0;
+  ah_attr.port_num = pd_->device_ptr()->port_num();
+  auto ah = ::ibv_create_ah(pd_->pd_, &ah_attr);
+  check_ptr(ah, "failed to create address handle");
+  ah_cache_.emplace(address, ah);
+  RDMAPP_LOG_TRACE("created ah %p for lid=%u qpn=%u",
+                   reinterpret_cast<void *>(ah), address.lid, address.qpn);
+  return ah;
+}
+
+size_t ud_qp::ah_cache_size() {
+  std::shared_lock lock(ah_mutex_);
+  return ah_cache_.size();
+}
+
+size_t ud_qp::max_message_size() const {
+  return static_cast<size_t>(128) << config_.path_mtu;
+}
+
+std::vector<uint8_t> ud_qp::serialize() const {
+  std::vector<uint8_t> buffer;
+  auto it = std::back_inserter(buffer);
+  detail::serialize(pd_->device_ptr()->lid(), it);
+  detail::serialize(qp_->qp_num, it);
+  detail::serialize(sq_psn_, it);
+  detail::serialize(static_cast<uint32_t>(user_data_.size()), it);
+  detail::serialize(pd_->device_ptr()->gid(), it);
+  std::copy(user_data_.cbegin(), user_data_.cend(), it);
+  return buffer;
+}
+
+ud_address ud_qp::address() const {
+  return ud_address(pd_->device_ptr()->lid(), qp_->qp_num,
+                    pd_->device_ptr()->gid());
+}
+
+std::vector<uint8_t> &ud_qp::user_data() { return user_data_; }
+
+std::shared_ptr<pd> ud_qp::pd_ptr() const { return pd_; }
+
+ud_qp::send_awaitable::send_awaitable(std::shared_ptr<ud_qp> qp,
+                                      ud_address const &peer,
+                                      std::shared_ptr<local_mr> local_mr,
+                                      size_t length,
+                                      std::optional<uint32_t> imm)
+    : qp_(qp), local_mr_(local_mr), peer_(peer), buffer_(local_mr->addr()),
+      length_(length), imm_(imm) {}
+
+ud_qp::send_awaitable::send_awaitable(std::shared_ptr<ud_qp> qp,
+                                      ud_address const &peer, void *buffer,
+                                      size_t length,
+                                      std::optional<uint32_t> imm)
+    : qp_(qp), peer_(peer), buffer_(buffer), length_(length), imm_(imm) {
+  if (length_ > qp_->config_.max_inline_data) {
+    bounce_ = qp_->pd_->bounce(buffer, length);
+    if (!bounce_) {
+      local_mr_ = qp_->pd_->reg_mr_cached(buffer, length);
+    }
+  }
+}
+
+bool ud_qp::send_awaitable::await_ready() const noexcept { return false; }
+
+bool ud_qp::send_awaitable::await_suspend(std::coroutine_handle<> h) noexcept {
+  try {
+    if (length_ > qp_->max_message_size()) [[unlikely]] {
+      throw_with("datagram of %lu bytes exceeds the path mtu of %lu bytes",
+                 length_, qp_->max_message_size());
+    }
+    struct ibv_sge send_sge = {};
+    send_sge.addr = reinterpret_cast<uint64_t>(buffer_);
+    send_sge.length = length_;
+    struct ibv_send_wr send_wr = {};
+    struct ibv_send_wr *bad_send_wr = nullptr;
+    send_wr.num_sge = 1;
+    send_wr.sg_list = &send_sge;
+    send_wr.send_flags = IBV_SEND_SIGNALED;
+    if (bounce_) {
+      send_sge.addr = reinterpret_cast<uint64_t>(bounce_.addr());
+      send_sge.lkey = bounce_.lkey();
+    } else if (local_mr_ != nullptr) {
+      send_sge.lkey = local_mr_->lkey();
+    } else {
+      send_wr.send_flags |= IBV_SEND_INLINE;
+    }
+    if (imm_.has_value()) {
+      send_wr.opcode = IBV_WR_SEND_WITH_IMM;
+      send_wr.imm_data = imm_.value();
+    } else {
+      send_wr.opcode = IBV_WR_SEND;
+    }
+    send_wr.wr.ud.ah = qp_->ah(peer_);
+    send_wr.wr.ud.remote_qpn = peer_.qpn;
+    send_wr.wr.ud.remote_qkey = qp_->qkey_;
+    slot_ = qp_->completions_.acquire(h.address());
+    send_wr.wr_id = qp_->completions_.wr_id(slot_);
+    check_rc(::ibv_post_send(qp_->qp_, &send_wr, &bad_send_wr),
+             "failed to post ud send");
+  } catch (...) {
+    if (slot_ != nullptr) {
+      qp_->completions_.release(slot_);
+    }
+    exception_ = std::current_exception();
+    return false;
+  }
+  return true;
+}
+
+uint32_t ud_qp::send_awaitable::await_resume() const {
+  if (exception_) [[unlikely]] {
+    std::rethrow_exception(exception_);
+  }
+  auto const result = qp_->completions_.take(slot_, IBV_WC_SEND);
+  check_wc_status(result.status, "failed to send datagram");
+  return length_;
+}
+
+ud_qp::recv_awaitable::recv_awaitable(std::shared_ptr<ud_qp> qp,
+                                      std::shared_ptr<local_mr> local_mr)
+    : qp_(qp), local_mr_(local_mr) {}
+
+bool ud_qp::recv_awaitable::await_ready() const noexcept { return false; }
+
+bool ud_qp::recv_awaitable::await_suspend(std::coroutine_handle<> h) noexcept {
+  try {
+    if (local_mr_->length() <= kGrhSize) [[unlikely]] {
+      throw_with("recv buffer of %lu bytes cannot hold the %lu byte grh",
+                 local_mr_->length(), kGrhSize);
+    }
+    struct ibv_sge recv_sge = {};
+    recv_sge.addr = reinterpret_cast<uint64_t>(local_mr_->addr());
+    recv_sge.length = local_mr_->length();
+    recv_sge.lkey = local_mr_->lkey();
+    struct ibv_recv_wr recv_wr = {};
+    struct ibv_recv_wr *bad_recv_wr = nullptr;
+    recv_wr.num_sge = 1;
+    recv_wr.sg_list = &recv_sge;
+    slot_ = qp_->completions_.acquire(h.address());
+    recv_wr.wr_id = qp_->completions_.wr_id(slot_);
+    if (qp_->srq_ != nullptr) {
+      check_rc(::ibv_post_srq_recv(qp_->srq_->srq_, &recv_wr, &bad_recv_wr),
+               "failed to post ud srq recv");
+    } else {
+      check_rc(::ibv_post_recv(qp_->qp_, &recv_wr, &bad_recv_wr),
+               "failed to post ud recv");
+    }
+  } catch (...) {
+    if (slot_ != nullptr) {
+      qp_->completions_.release(slot_);
+    }
+    exception_ = std::current_exception();
+    return false;
+  }
+  return true;
+}
+
+ud_recv_result ud_qp::recv_awaitable::await_resume() const {
+  if (exception_) [[unlikely]] {
+    std::rethrow_exception(exception_);
+  }
+  auto const wc = qp_->completions_.take(slot_, IBV_WC_RECV);
+  check_wc_status(wc.status, "failed to recv datagram");
+  ud_recv_result result;
+  result.length = wc.byte_len - kGrhSize;
+  result.source.lid = wc.slid;
+  result.source.qpn = wc.src_qp;
+  if (wc.wc_flags & IBV_WC_GRH) {
+    auto grh = reinterpret_cast<struct ibv_grh const *>(local_mr_->addr());
+    result.source.gid = grh->sgid;
+  } else {
+    ::bzero(&result.source.gid, sizeof(result.source.gid));
+  }
+  if (wc.wc_flags & IBV_WC_WITH_IMM) {
+    result.imm = wc.imm_data;
+  }
+  return result;
+}
+
+ud_qp::send_awaitable ud_qp::send(ud_address const &peer,
+                                  std::shared_ptr<local_mr> local_mr) {
+  return send_awaitable(this->shared_from_this(), peer, local_mr,
+                        local_mr->length(), std::nullopt);
+}
+
+ud_qp::send_awaitable ud_qp::send_with_imm(ud_address const &peer,
+                                           std::shared_ptr<local_mr> local_mr,
+                                           uint32_t imm) {
+  return send_awaitable(this->shared_from_this(), peer, local_mr,
+                        local_mr->length(), imm);
+}
+
+ud_qp::send_awaitable ud_qp::send(ud_address const &peer, void *buffer,
+                                  size_t length) {
+  return send_awaitable(this->shared_from_this(), peer, buffer, length,
+                        std::nullopt);
+}
+
+ud_qp::recv_awaitable ud_qp::recv(std::shared_ptr<local_mr> local_mr) {
+  return recv_awaitable(this->shared_from_this(), local_mr);
+}
+
+void ud_qp::reserve_cqes() {
+  send_cq_->reserve(config_.max_send_wr);
+  try {
+    if (srq_ != nullptr) {
+      recv_cq_->reserve(srq_->max_wr(), srq_.get());
+    } else {
+      recv_cq_->reserve(config_.max_recv_wr);
+    }
+  } catch (...) {
+    send_cq_->unreserve(config_.max_send_wr);
+    throw;
+  }
+  cqes_reserved_ = true;
+}
+
+void ud_qp::release_cqes() {
+  if (!cqes_reserved_) {
+    return;
+  }
+  send_cq_->unreserve(config_.max_send_wr);
+  if (srq_ != nullptr) {
+    recv_cq_->unreserve(srq_->max_wr(), srq_.get());
+  } else {
+    recv_cq_->unreserve(config_.max_recv_wr);
+  }
+  cqes_reserved_ = false;
+}
+
+void ud_qp::destroy() {
+  for (auto &[address, ah] : ah_cache_) {
+    if (auto rc = ::ibv_destroy_ah(ah); rc != 0) [[unlikely]] {
+      RDMAPP_LOG_ERROR("failed to destroy ah %p: %s",
+                       reinterpret_cast<void *>(ah), strerror(rc));
+    }
+  }
+  ah_cache_.clear();
+  if (qp_ == nullptr) [[unlikely]] {
+    return;
+  }
+  release_cqes();
+  if (auto rc = ::ibv_destroy_qp(qp_); rc != 0) [[unlikely]] {
+    RDMAPP_LOG_ERROR("failed to destroy ud qp %p: %s",
+                     reinterpret_cast<void *>(qp_), strerror(errno));
+  } else {
+    RDMAPP_LOG_TRACE("destroyed ud qp %p", reinterpret_cast<void *>(qp_));
+  }
+  qp_ = nullptr;
+}
+
+ud_qp::~ud_qp() { destroy(); }
+
+} // namespace rdmapp